@@ -12,6 +12,7 @@ const FixedStatusMessage = ({ is_error, message }) => (
 
 export default function MomentPage() {
   const [moment, setMoment] = useState(null);
+  const [imageUrl, setImageUrl] = useState("");
   const [error, setError] = useState(null);
   const [loggedInUser, setLoggedInUser] = useState(null);
   const params = useParams();
@@ -59,18 +60,40 @@ export default function MomentPage() {
     fetchMoment();
   }, [momentid]);
 
-  const getImageData = (image_data, image_filename) => {
-    if (!image_data || image_data.length === 0) {
-      return "";
-    }
-    const file_extension = image_filename.split('.').pop();
-    let binary = "";
-    for(let i = 0; i < image_data.length; i++) {
-      binary += !(i - 1 & 1) ? String.fromCharCode(parseInt(image_data.substring(i - 1, i + 1), 16)) : "";
-    }
-    const base64_encoded = btoa(binary);
-    return `data:image/${file_extension};base64,${base64_encoded}`;
-  };
+  // The moment only links its image; an <img> can't send the Authorization header, so the bytes
+  // are fetched here and shown through a blob URL
+  useEffect(() => {
+    if (!moment?.image_url) return;
+
+    let objectUrl = null;
+    let cancelled = false;
+    const fetchImage = async () => {
+      try {
+        const response = await fetch(`/api${moment.image_url}`, {
+          headers: {
+            'Authorization': `Bearer ${localStorage.getItem('accessToken')}`
+          }
+        });
+
+        if (!response.ok) {
+          throw new Error(response.statusText);
+        }
+
+        const blob = await response.blob();
+        if (cancelled) return;
+        objectUrl = URL.createObjectURL(blob);
+        setImageUrl(objectUrl);
+      } catch (error) {
+        setError(error);
+      }
+    };
+
+    fetchImage();
+    return () => {
+      cancelled = true;
+      if (objectUrl) URL.revokeObjectURL(objectUrl);
+    };
+  }, [moment]);
 
   const convertToHumanReadableDateTimeString = (input_date_time) => {
     const event = new Date(input_date_time);
@@ -115,13 +138,17 @@ export default function MomentPage() {
           </span>
         ))}
       </section>
-      <figure>
-        <img 
-          src={getImageData(moment.image_data, moment.image_filename)} 
-          alt={moment.image_caption} 
-        />
-        <figcaption>{moment.image_caption}</figcaption>
-      </figure>
+      {moment.image_url && (
+        <figure>
+          {imageUrl && (
+            <img 
+              src={imageUrl} 
+              alt={moment.image_caption} 
+            />
+          )}
+          <figcaption>{moment.image_caption}</figcaption>
+        </figure>
+      )}
       <p 
         className={styles.cursiveFont}
         dangerouslySetInnerHTML={{ __html: moment.description }}
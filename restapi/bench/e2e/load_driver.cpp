@@ -0,0 +1,526 @@
+// Closed-loop HTTP load driver for a running Momentos server.
+//
+// Every client thread keeps one keep-alive connection and sends its next request as soon as the
+// previous response arrived. Prints one line per run with throughput and latency percentiles:
+//
+//   momentos_load --scenario list --clients 8 --seconds 10 [--format csv|json] [--header]
+//
+// Scenarios: login, total, list, detail, offset_deep, cursor_deep, add, import. All but login use a
+// token from one /login up front. offset_deep and cursor_deep read the same pages from --deep-page
+// on (default 100), by current_page and by the cursors of a walk there, to compare how OFFSET and
+// keyset pagination hold up deep in a listing. add posts one moment per request through /addmoment, import posts --batch moments per
+// request to /moments/import; moments_per_s compares the two. Written moments are titled
+// "bench write <n>" and stay in the database.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        std::string host = "127.0.0.1";
+        int port = 5000;
+        std::string scenario = "list";
+        size_t clients = 8;
+        double seconds = 10;
+        double warmup_seconds = 2;
+        std::string username = "bench-e2e";
+        std::string password = "bench-password";
+        size_t page_size = 20;
+        size_t deep_page = 100;
+        size_t batch = 1000;
+        std::string format = "csv";
+        bool header = false;
+    };
+
+    struct Response
+    {
+        int status = 0;
+        std::string body;
+    };
+
+    /**
+     * One keep-alive HTTP/1.1 connection. Responses are expected to carry a Content-Length, which
+     * Crow always sends.
+     */
+    class Connection
+    {
+    public:
+        Connection(const std::string& host, int port)
+            : host_(host), port_(port)
+        {
+        }
+
+        ~Connection() { close(); }
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        Response send(const std::string& request)
+        {
+            // A server that closed an idle connection is only noticed when writing or reading
+            for (int attempt = 0; attempt < 2; attempt++)
+            {
+                if (fd_ < 0)
+                {
+                    open();
+                }
+                if (write_all(request))
+                {
+                    if (auto response = read_response())
+                    {
+                        return *response;
+                    }
+                }
+                close();
+            }
+            throw std::runtime_error("Connection lost");
+        }
+
+    private:
+        void open()
+        {
+            fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<uint16_t>(port_));
+            if (fd_ < 0 || ::inet_pton(AF_INET, host_.c_str(), &address.sin_addr) != 1
+                || ::connect(fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+            {
+                close();
+                throw std::runtime_error("Could not connect to " + host_ + ":" + std::to_string(port_));
+            }
+            const int one = 1;
+            ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            buffer_.clear();
+        }
+
+        void close()
+        {
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        bool write_all(const std::string& data)
+        {
+            size_t written = 0;
+            while (written < data.size())
+            {
+                const ssize_t n = ::send(fd_, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+                if (n <= 0)
+                {
+                    return false;
+                }
+                written += static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        bool fill()
+        {
+            char chunk[16384];
+            const ssize_t n = ::recv(fd_, chunk, sizeof(chunk), 0);
+            if (n <= 0)
+            {
+                return false;
+            }
+            buffer_.append(chunk, static_cast<size_t>(n));
+            return true;
+        }
+
+        std::optional<Response> read_response()
+        {
+            size_t header_end;
+            while ((header_end = buffer_.find("\r\n\r\n")) == std::string::npos)
+            {
+                if (!fill())
+                {
+                    return std::nullopt;
+                }
+            }
+            Response response;
+            response.status = std::atoi(buffer_.c_str() + buffer_.find(' ') + 1);
+
+            size_t content_length = 0;
+            bool keep_alive = true;
+            size_t line = buffer_.find("\r\n") + 2;
+            while (line < header_end)
+            {
+                const size_t line_end = buffer_.find("\r\n", line);
+                std::string header = buffer_.substr(line, line_end - line);
+                std::transform(header.begin(), header.end(), header.begin(), [](unsigned char c) { return std::tolower(c); });
+                if (header.rfind("content-length:", 0) == 0)
+                {
+                    content_length = std::strtoull(header.c_str() + 15, nullptr, 10);
+                }
+                else if (header.rfind("connection:", 0) == 0 && header.find("close") != std::string::npos)
+                {
+                    keep_alive = false;
+                }
+                line = line_end + 2;
+            }
+
+            const size_t body_start = header_end + 4;
+            while (buffer_.size() < body_start + content_length)
+            {
+                if (!fill())
+                {
+                    return std::nullopt;
+                }
+            }
+            response.body = buffer_.substr(body_start, content_length);
+            buffer_.erase(0, body_start + content_length);
+            if (!keep_alive)
+            {
+                close();
+            }
+            return response;
+        }
+
+        const std::string host_;
+        const int port_;
+        int fd_ = -1;
+        std::string buffer_;
+    };
+
+    std::string get_request(const Options& options, const std::string& target, const std::string& token)
+    {
+        return "GET " + target + " HTTP/1.1\r\nHost: " + options.host + "\r\nAuthorization: Bearer " + token + "\r\n\r\n";
+    }
+
+    std::string post_request(const Options& options, const std::string& target, const std::string& token,
+                             const std::string& content_type, const std::string& body)
+    {
+        return "POST " + target + " HTTP/1.1\r\nHost: " + options.host + "\r\nAuthorization: Bearer " + token
+            + "\r\nContent-Type: " + content_type + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+
+    // The same moment for both write scenarios, so that they only differ in how it is sent
+    constexpr const char* WRITE_DESCRIPTION = "Written by the load driver to compare single adds with bulk imports";
+    constexpr const char* WRITE_DATE = "2024-05-01";
+    constexpr const char* WRITE_FEELING = "happy";
+
+    std::string add_moment_request(const Options& options, const std::string& token, size_t n)
+    {
+        const std::string boundary = "momentos-load-boundary";
+        std::string body;
+        const auto field = [&](const char* name, const std::string& value) {
+            body += "--" + boundary + "\r\nContent-Disposition: form-data; name=\"" + name + "\"\r\n\r\n" + value + "\r\n";
+        };
+        field("moment-title", "bench write " + std::to_string(n));
+        field("moment-date", WRITE_DATE);
+        field("moment-description", WRITE_DESCRIPTION);
+        field("moment-feelings", WRITE_FEELING);
+        body += "--" + boundary + "--\r\n";
+        return post_request(options, "/addmoment", token, "multipart/form-data; boundary=" + boundary, body);
+    }
+
+    std::string import_request(const Options& options, const std::string& token, size_t first)
+    {
+        std::string body;
+        for (size_t n = first; n < first + options.batch; n++)
+        {
+            body += "{\"title\":\"bench write " + std::to_string(n) + "\",\"description\":\"" + WRITE_DESCRIPTION
+                + "\",\"date\":\"" + WRITE_DATE + "\",\"feelings\":[\"" + WRITE_FEELING + "\"]}\n";
+        }
+        return post_request(options, "/moments/import", token, "application/x-ndjson", body);
+    }
+
+    // Moments each request of the scenario writes, none for the read scenarios
+    size_t moments_per_request(const Options& options)
+    {
+        if (options.scenario == "add")
+        {
+            return 1;
+        }
+        if (options.scenario == "import")
+        {
+            return options.batch;
+        }
+        return 0;
+    }
+
+    std::string login_request(const Options& options)
+    {
+        const std::string body = "{\"username\":\"" + options.username + "\",\"password\":\"" + options.password + "\"}";
+        return "POST /login HTTP/1.1\r\nHost: " + options.host + "\r\nContent-Type: application/json\r\nContent-Length: "
+            + std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+
+    // Value of a string field in a flat JSON object, good enough for the login response
+    std::string json_string_field(const std::string& json, const std::string& name)
+    {
+        const std::string key = "\"" + name + "\":\"";
+        const size_t start = json.find(key);
+        if (start == std::string::npos)
+        {
+            return "";
+        }
+        const size_t value = start + key.size();
+        return json.substr(value, json.find('"', value) - value);
+    }
+
+    // The pages the deep scenarios cycle through, starting at --deep-page
+    constexpr size_t DEEP_PAGES = 16;
+
+    std::vector<uint64_t> moment_ids(const std::string& listing)
+    {
+        std::vector<uint64_t> ids;
+        const std::string key = "\"id\":";
+        for (size_t at = listing.find(key); at != std::string::npos; at = listing.find(key, at + 1))
+        {
+            ids.push_back(std::strtoull(listing.c_str() + at + key.size(), nullptr, 10));
+        }
+        return ids;
+    }
+
+    /**
+     * The requests a scenario cycles through. All but login are authenticated with one token.
+     */
+    std::vector<std::string> scenario_requests(const Options& options)
+    {
+        if (options.scenario == "login")
+        {
+            return {login_request(options)};
+        }
+
+        Connection connection(options.host, options.port);
+        const Response login = connection.send(login_request(options));
+        const std::string token = json_string_field(login.body, "access_token");
+        if (login.status != 200 || token.empty())
+        {
+            throw std::runtime_error("Login as " + options.username + " failed with status " + std::to_string(login.status));
+        }
+
+        const std::string listing = "/moments?page_size=" + std::to_string(options.page_size);
+        if (options.scenario == "total")
+        {
+            return {get_request(options, "/moments/total", token)};
+        }
+        if (options.scenario == "list")
+        {
+            return {get_request(options, listing, token)};
+        }
+        if (options.scenario == "detail")
+        {
+            const Response page = connection.send(get_request(options, "/moments?page_size=100", token));
+            std::vector<std::string> requests;
+            for (const uint64_t id : moment_ids(page.body))
+            {
+                requests.push_back(get_request(options, "/moments/" + std::to_string(id), token));
+            }
+            if (requests.empty())
+            {
+                throw std::runtime_error("The user has no moments to read");
+            }
+            return requests;
+        }
+        if (options.scenario == "offset_deep")
+        {
+            std::vector<std::string> requests;
+            for (size_t page = options.deep_page; page < options.deep_page + DEEP_PAGES; page++)
+            {
+                requests.push_back(get_request(options, listing + "&current_page=" + std::to_string(page), token));
+            }
+            return requests;
+        }
+        if (options.scenario == "cursor_deep")
+        {
+            // A client can only get this deep by following next_cursor page after page
+            std::vector<std::string> requests;
+            std::string cursor;
+            for (size_t page = 1;; page++)
+            {
+                if (page >= options.deep_page)
+                {
+                    requests.push_back(get_request(options, listing + "&cursor=" + cursor, token));
+                }
+                if (page + 1 == options.deep_page + DEEP_PAGES)
+                {
+                    return requests;
+                }
+                const Response response = connection.send(get_request(options, listing + "&cursor=" + cursor, token));
+                cursor = json_string_field(response.body, "next_cursor");
+                if (response.status != 200 || cursor.empty())
+                {
+                    throw std::runtime_error("The listing ends before page " + std::to_string(page + 1));
+                }
+            }
+        }
+        if (options.scenario == "add" || options.scenario == "import")
+        {
+            std::vector<std::string> requests;
+            for (size_t n = 0; n < 16; n++)
+            {
+                requests.push_back(options.scenario == "add" ? add_moment_request(options, token, n)
+                                                             : import_request(options, token, n * options.batch));
+            }
+            return requests;
+        }
+        throw std::invalid_argument("Unknown scenario " + options.scenario);
+    }
+
+    Options parse_options(int argc, char** argv)
+    {
+        Options options;
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string flag = argv[i];
+            const auto value = [&]() -> std::string {
+                if (i + 1 >= argc)
+                {
+                    throw std::invalid_argument(flag + " needs a value");
+                }
+                return argv[++i];
+            };
+            if (flag == "--host") options.host = value();
+            else if (flag == "--port") options.port = std::stoi(value());
+            else if (flag == "--scenario") options.scenario = value();
+            else if (flag == "--clients") options.clients = std::max<size_t>(1, std::stoul(value()));
+            else if (flag == "--seconds") options.seconds = std::stod(value());
+            else if (flag == "--warmup") options.warmup_seconds = std::stod(value());
+            else if (flag == "--user") options.username = value();
+            else if (flag == "--password") options.password = value();
+            else if (flag == "--page-size") options.page_size = std::stoul(value());
+            else if (flag == "--deep-page") options.deep_page = std::max<size_t>(1, std::stoul(value()));
+            else if (flag == "--batch") options.batch = std::max<size_t>(1, std::stoul(value()));
+            else if (flag == "--format") options.format = value();
+            else if (flag == "--header") options.header = true;
+            else throw std::invalid_argument("Unknown option " + flag);
+        }
+        return options;
+    }
+
+    double percentile_ms(const std::vector<uint32_t>& sorted_us, double percentile)
+    {
+        if (sorted_us.empty())
+        {
+            return 0;
+        }
+        const size_t index = std::min(sorted_us.size() - 1, static_cast<size_t>(percentile * sorted_us.size()));
+        return sorted_us[index] / 1000.0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const Options options = parse_options(argc, argv);
+        const std::vector<std::string> requests = scenario_requests(options);
+
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        const auto measure_from = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.warmup_seconds));
+        const auto stop = measure_from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+
+        // Latencies in microseconds and failures, per client; merged once all clients stopped
+        std::vector<std::vector<uint32_t>> latencies(options.clients);
+        std::vector<uint64_t> errors(options.clients, 0);
+        std::atomic<bool> failed{false};
+        std::vector<std::thread> clients;
+        for (size_t client = 0; client < options.clients; client++)
+        {
+            clients.emplace_back([&, client] {
+                try
+                {
+                    Connection connection(options.host, options.port);
+                    size_t next = client;
+                    for (auto now = Clock::now(); now < stop; )
+                    {
+                        const Response response = connection.send(requests[next % requests.size()]);
+                        next++;
+                        const auto done = Clock::now();
+                        if (now >= measure_from)
+                        {
+                            if (response.status >= 200 && response.status < 400)
+                            {
+                                latencies[client].push_back(static_cast<uint32_t>(
+                                    std::chrono::duration_cast<std::chrono::microseconds>(done - now).count()));
+                            }
+                            else
+                            {
+                                errors[client]++;
+                            }
+                        }
+                        now = done;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "Client " << client << ": " << e.what() << "\n";
+                    failed = true;
+                }
+            });
+        }
+        for (auto& client : clients)
+        {
+            client.join();
+        }
+        if (failed)
+        {
+            return 1;
+        }
+
+        std::vector<uint32_t> all;
+        uint64_t error_count = 0;
+        for (size_t client = 0; client < options.clients; client++)
+        {
+            all.insert(all.end(), latencies[client].begin(), latencies[client].end());
+            error_count += errors[client];
+        }
+        std::sort(all.begin(), all.end());
+        const double rps = all.size() / options.seconds;
+        const double moments_per_s = rps * moments_per_request(options);
+
+        char line[512];
+        if (options.format == "json")
+        {
+            std::snprintf(line, sizeof(line),
+                          "{\"scenario\":\"%s\",\"clients\":%zu,\"seconds\":%g,\"requests\":%zu,\"errors\":%llu,"
+                          "\"rps\":%.1f,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"moments_per_s\":%.1f}",
+                          options.scenario.c_str(), options.clients, options.seconds, all.size(),
+                          static_cast<unsigned long long>(error_count), rps, percentile_ms(all, 0.5),
+                          percentile_ms(all, 0.99), percentile_ms(all, 0.999), moments_per_s);
+        }
+        else
+        {
+            if (options.header)
+            {
+                std::cout << "scenario,clients,seconds,requests,errors,rps,p50_ms,p99_ms,p999_ms,moments_per_s\n";
+            }
+            std::snprintf(line, sizeof(line), "%s,%zu,%g,%zu,%llu,%.1f,%.3f,%.3f,%.3f,%.1f", options.scenario.c_str(),
+                          options.clients, options.seconds, all.size(), static_cast<unsigned long long>(error_count),
+                          rps, percentile_ms(all, 0.5), percentile_ms(all, 0.99), percentile_ms(all, 0.999),
+                          moments_per_s);
+        }
+        std::cout << line << std::endl;
+        return 0;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 2;
+    }
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+#
+# End-to-end throughput and latency of the main routes against a locally running PostgreSQL.
+# Creates the database from mkm_db.sql and seed.sql unless it exists, starts the server, and runs
+# the load driver once per scenario. Build with -DMKM_BUILD_BENCHMARKS=ON first.
+#
+#   ./run.sh [build directory] [seconds per scenario] [clients]  > e2e.csv
+#
+# Output is CSV: scenario,clients,seconds,requests,errors,rps,p50_ms,p99_ms,p999_ms,moments_per_s
+# The add and import scenarios write moments one at a time and in batches of MKM_E2E_BATCH
+# (default 1000); their moments are deleted again at the end.
+# Connection settings come from the usual PG* variables.
+#
+set -euo pipefail
+
+BUILD="${1:-build}"
+DURATION="${2:-10}"
+CLIENTS="${3:-8}"
+DB="${MKM_E2E_DB:-mkm_e2e}"
+BATCH="${MKM_E2E_BATCH:-1000}"
+PORT=5000
+HERE="$(cd "$(dirname "$0")" && pwd)"
+
+if [ -z "$(psql -d postgres -Atc "SELECT 1 FROM pg_database WHERE datname = '$DB'")" ]; then
+    createdb "$DB"
+    # A half-loaded database would be picked up as it is by the next run
+    if ! psql -q -v ON_ERROR_STOP=1 -d "$DB" -f "$HERE/../../mkm_db.sql" > /dev/null \
+        || ! psql -q -d "$DB" -f "$HERE/seed.sql" > /dev/null; then
+        dropdb "$DB"
+        exit 1
+    fi
+fi
+
+IMAGES="$(mktemp -d)"
+MKM_DB_CONNINFO="dbname=$DB" MKM_IMAGE_STORE_DIR="$IMAGES" "$BUILD/Momentos" > "$IMAGES/server.log" 2>&1 &
+SERVER=$!
+cleanup() {
+    kill "$SERVER" 2> /dev/null || true
+    wait "$SERVER" 2> /dev/null || true
+    rm -rf "$IMAGES"
+    # Written moments are dropped again so that the next run reads the same data
+    psql -q -d "$DB" -c "DELETE FROM public.moments WHERE title LIKE 'bench write %'" > /dev/null
+}
+trap cleanup EXIT
+
+# The server exits at startup if it can't prepare its statements or load the feelings
+for attempt in $(seq 50); do
+    curl -fs "http://127.0.0.1:$PORT/" > /dev/null && break
+    if ! kill -0 "$SERVER" 2> /dev/null || [ "$attempt" = 50 ]; then
+        echo "The server did not start:" >&2
+        cat "$IMAGES/server.log" >&2
+        exit 1
+    fi
+    sleep 0.2
+done
+
+header=--header
+for scenario in login total list detail offset_deep cursor_deep add import; do
+    "$BUILD/bench/momentos_load" --port "$PORT" --scenario "$scenario" --clients "$CLIENTS" --seconds "$DURATION" \
+        --batch "$BATCH" $header
+    header=
+done
@@ -0,0 +1,33 @@
+--
+-- Dataset for the end-to-end load benchmark: one user who can log in, owning 10k moments.
+--
+--   username bench-e2e, password bench-password
+--
+-- Load into a database created from mkm_db.sql:  psql -d mkm_e2e -f seed.sql
+--
+
+\set ON_ERROR_STOP on
+\set moments 10000
+
+BEGIN;
+
+-- Same bcrypt cost as BCRYPT_COST in password_hashing.h, so that /login costs what it costs in production
+INSERT INTO public.users(username, fullname, birthdate, emailid, password_hash)
+VALUES ('bench-e2e', 'Load Benchmark', '1990-01-01',
+        'bench-e2e@example.com', public.crypt('bench-password', public.gen_salt('bf', 8)))
+ON CONFLICT DO NOTHING;
+
+-- A single statement, so the moments triggers update the user's total once for the whole load
+INSERT INTO public.moments(username, title, description, moment_date, image_caption, created_date, last_modified_date)
+SELECT 'bench-e2e',
+       'moment ' || i,
+       md5(i::text) || ' ' || md5((i * 7)::text) || ' walked along the ' || (ARRAY['river', 'coast', 'ridge', 'park'])[1 + i % 4],
+       date '2020-01-01' + (i % 1500),
+       CASE WHEN i % 3 = 0 THEN 'caption ' || md5((i * 13)::text) END,
+       timestamptz '2020-01-01' + i * interval '1 minute',
+       timestamptz '2020-01-01' + i * interval '1 minute'
+FROM generate_series(1, :moments) AS i;
+
+COMMIT;
+
+VACUUM ANALYZE public.moments;
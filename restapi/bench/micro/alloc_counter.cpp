@@ -0,0 +1,100 @@
+#include "alloc_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    thread_local uint64_t allocations = 0;
+
+    void* counted_allocate(std::size_t size)
+    {
+        allocations++;
+        if (void* pointer = std::malloc(size == 0 ? 1 : size))
+        {
+            return pointer;
+        }
+        throw std::bad_alloc();
+    }
+
+    void* counted_allocate(std::size_t size, std::align_val_t alignment)
+    {
+        allocations++;
+        const auto align = static_cast<std::size_t>(alignment);
+        // aligned_alloc wants a multiple of the alignment
+        if (void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align))
+        {
+            return pointer;
+        }
+        throw std::bad_alloc();
+    }
+}
+
+namespace mkm::bench
+{
+    uint64_t thread_allocations()
+    {
+        return allocations;
+    }
+}
+
+// std::pmr::new_delete_resource() goes through the aligned forms, std::allocator through the plain ones
+void* operator new(std::size_t size)
+{
+    return counted_allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_allocate(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return counted_allocate(size, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept
+{
+    std::free(pointer);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+namespace mkm::bench
+{
+/**
+ * @brief operator new calls made by the calling thread so far. The benchmark binary replaces the
+ * global operator new to count them, see alloc_counter.cpp.
+ */
+uint64_t thread_allocations();
+}   // namespace mkm::bench
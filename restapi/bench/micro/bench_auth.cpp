@@ -0,0 +1,76 @@
+#include "http_helpers.h"
+
+#include <benchmark/benchmark.h>
+#include <jwt-cpp/jwt.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Same claims as the tokens /login hands out
+    std::string make_token(const std::string& username)
+    {
+        const auto now = std::chrono::system_clock::now();
+        return jwt::create()
+            .set_issuer("MKM")
+            .set_type("JWS")
+            .set_issued_at(now)
+            .set_expires_at(now + std::chrono::seconds{mkm::JWT_EXPIRY_SECONDS})
+            .set_payload_claim("username", jwt::claim(username))
+            .sign(jwt::algorithm::hs512{mkm::JWT_SECRET});
+    }
+
+    crow::request request_with_token(const std::string& token)
+    {
+        crow::request req;
+        req.headers.emplace("Authorization", "Bearer " + token);
+        return req;
+    }
+}
+
+static void BM_validate_string(benchmark::State& state)
+{
+    const std::string value(state.range(0), 'a');
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(mkm::validate_string(value, 1024, "moment-title"));
+    }
+    state.SetBytesProcessed(state.iterations() * value.size());
+}
+BENCHMARK(BM_validate_string)->Arg(16)->Arg(1024);
+
+// Any request after the first one with the same token
+static void BM_verify_authorization_header_cached(benchmark::State& state)
+{
+    const crow::request req = request_with_token(make_token("bench"));
+    std::string username;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(mkm::verify_authorization_header(req, username));
+    }
+}
+BENCHMARK(BM_verify_authorization_header_cached);
+
+// Decoding and checking the signature: twice as many tokens as the token cache holds by default,
+// used round robin, so that every lookup misses
+static void BM_verify_authorization_header_uncached(benchmark::State& state)
+{
+    static const std::vector<crow::request> requests = [] {
+        std::vector<crow::request> requests;
+        for (size_t i = 0; i < 20000; i++)
+        {
+            requests.push_back(request_with_token(make_token("bench-" + std::to_string(i))));
+        }
+        return requests;
+    }();
+    std::string username;
+    size_t next = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(mkm::verify_authorization_header(requests[next], username));
+        next = (next + 1) % requests.size();
+    }
+}
+BENCHMARK(BM_verify_authorization_header_uncached);
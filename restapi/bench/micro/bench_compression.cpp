@@ -0,0 +1,119 @@
+#include "compression.h"
+#include "http_helpers.h"
+#include "sample_moments.h"
+
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace
+{
+    /**
+     * A listing page as GET /moments sends it. Unlike sample_moments(), titles and descriptions
+     * differ from moment to moment, so that the compression ratio is a realistic one.
+     */
+    std::string listing_body(size_t count)
+    {
+        static constexpr std::string_view WORDS[] = {
+            "river", "walked", "the", "harbor", "lights", "evening", "with", "friends", "quiet", "coffee",
+            "morning", "rain", "laughed", "and", "train", "station", "late", "dinner", "mountains", "slowly",
+            "sunset", "a", "long", "conversation", "about", "nothing", "market", "bread", "warm", "city",
+            "finally", "letter", "old", "photos", "garden", "after", "work", "music", "played", "first"};
+        uint32_t seed = 12345;
+        const auto next = [&seed] {
+            seed = seed * 1664525 + 1013904223;
+            return seed >> 8;
+        };
+        const auto sentence = [&](size_t words) {
+            std::string text;
+            for (size_t i = 0; i < words; i++)
+            {
+                text += i == 0 ? "" : " ";
+                text += WORDS[next() % std::size(WORDS)];
+            }
+            return text + ".";
+        };
+
+        auto moments = mkm::bench::sample_moments(count);
+        for (auto& moment : moments)
+        {
+            moment.title = sentence(2 + next() % 5);
+            moment.description = sentence(15 + next() % 60);
+        }
+        const crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+            json.begin_object();
+            json.key("moments");
+            mkm::write_moments_json(json, moments);
+            json.key("next_cursor");
+            json.null();
+            json.end_object();
+        });
+        return response.body;
+    }
+
+    // A stream set up and torn down per response, as Crow's compress_string() does it
+    bool compress_with_fresh_stream(std::string_view input, int level, std::string& output)
+    {
+        z_stream stream{};
+        if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+        output.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef*>(output.data());
+        stream.avail_out = static_cast<uInt>(output.size());
+        const bool done = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+        output.resize(stream.total_out);
+        deflateEnd(&stream);
+        return done;
+    }
+
+    void report(benchmark::State& state, size_t raw_bytes, size_t sent_bytes)
+    {
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw_bytes));
+        state.counters["raw_bytes"] = static_cast<double>(raw_bytes);
+        state.counters["sent_bytes"] = static_cast<double>(sent_bytes);
+        state.counters["ratio"] = static_cast<double>(sent_bytes) / static_cast<double>(raw_bytes);
+    }
+}
+
+// gzip with the thread's reused stream, as the server does it. Args: moments, zlib level
+static void BM_compress_listing(benchmark::State& state)
+{
+    const std::string body = listing_body(state.range(0));
+    const int level = static_cast<int>(state.range(1));
+    std::string compressed;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(mkm::compress(body, mkm::ContentEncoding::GZIP, level, compressed));
+    }
+    report(state, body.size(), compressed.size());
+}
+BENCHMARK(BM_compress_listing)->Args({2, 1})->Args({20, 1})->Args({20, 5})->Args({100, 1})->Args({100, 5})->Args({100, 9});
+
+static void BM_compress_listing_fresh_stream(benchmark::State& state)
+{
+    const std::string body = listing_body(state.range(0));
+    const int level = static_cast<int>(state.range(1));
+    std::string compressed;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(compress_with_fresh_stream(body, level, compressed));
+    }
+    report(state, body.size(), compressed.size());
+}
+BENCHMARK(BM_compress_listing_fresh_stream)->Args({2, 1})->Args({20, 1})->Args({100, 1});
+
+static void BM_negotiate_encoding(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(mkm::negotiate_encoding("gzip, deflate, br, zstd"));
+    }
+}
+BENCHMARK(BM_negotiate_encoding);
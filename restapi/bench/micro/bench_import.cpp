@@ -0,0 +1,81 @@
+#include "copy_binary.h"
+#include "feelings.h"
+#include "moment_import.h"
+#include "request_arena.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+namespace
+{
+    // count moments as an import body, one JSON object per line, as exported by another app
+    std::string moments_ndjson(size_t count)
+    {
+        for (const char* feeling : {"happy", "sad"})
+        {
+            mkm::feeling_dictionary().intern(feeling);
+        }
+        std::string body;
+        for (size_t i = 0; i < count; i++)
+        {
+            body += "{\"title\":\"Evening walk number " + std::to_string(i) + "\","
+                    "\"description\":\"Walked along the river until the lights came on over the harbor. "
+                    "The air was \\\"still warm\\\" and the water quiet.\","
+                    "\"date\":\"2024-06-21\",\"feelings\":[\"happy\",\"sad\"]}\n";
+        }
+        return body;
+    }
+}
+
+// Reading and validating an import body as /moments/import does
+static void BM_import_read(benchmark::State& state)
+{
+    const std::string body = moments_ndjson(state.range(0));
+    for (auto _ : state)
+    {
+        mkm::RequestArena arena;
+        mkm::MomentImport import(state.range(0), arena.resource());
+        import.feed(body);
+        import.finish();
+        benchmark::DoNotOptimize(import.moments().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * body.size());
+}
+BENCHMARK(BM_import_read)->Arg(100)->Arg(10000);
+
+// Encoding the read moments for the binary COPY, with the columns of import_moments()
+static void BM_import_copy_encode(benchmark::State& state)
+{
+    const std::string body = moments_ndjson(state.range(0));
+    mkm::RequestArena arena;
+    mkm::MomentImport import(state.range(0), arena.resource());
+    import.feed(body);
+    import.finish();
+    const auto& dictionary = mkm::feeling_dictionary();
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        std::string data;
+        mkm::CopyBinaryWriter copy(data);
+        copy.header();
+        for (const auto& moment : import.moments())
+        {
+            copy.begin_row(5);
+            copy.text("bench");
+            copy.text(moment.title);
+            copy.text(moment.description);
+            copy.date(moment.date);
+            copy.begin_text_array();
+            moment.feelings.for_each([&](uint8_t id) { copy.text_array_element(dictionary.name(id)); });
+            copy.end_text_array();
+        }
+        copy.trailer();
+        bytes = data.size();
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.counters["copy_bytes_per_moment"] = static_cast<double>(bytes) / state.range(0);
+}
+BENCHMARK(BM_import_copy_encode)->Arg(100)->Arg(10000);
@@ -0,0 +1,156 @@
+#include "http_helpers.h"
+#include "sample_moments.h"
+
+#include <benchmark/benchmark.h>
+#include <crow/json.h>
+
+#include <string>
+#include <vector>
+
+namespace
+{
+    // How moments were serialized before JsonWriter, kept as the baseline
+    crow::json::wvalue moment_to_wvalue(const mkm::Moment& moment)
+    {
+        crow::json::wvalue json{
+            {"id", moment.id},
+            {"title", std::string(moment.title)},
+            {"description", std::string(moment.description)},
+            {"date", mkm::format_date(moment.date)},
+            {"image_filename", std::string(moment.image_filename)},
+            {"image_caption", std::string(moment.image_caption)},
+            {"created_date", mkm::format_timestamp(moment.created_date)},
+            {"last_modified_date", mkm::format_timestamp(moment.last_modified_date)}
+        };
+        const auto feelings = mkm::feeling_dictionary().names(moment.feelings);
+        json["feelings"] = std::vector<crow::json::wvalue>(feelings.begin(), feelings.end());
+        if (!moment.image_filename.empty())
+        {
+            const std::string image_url = "/moments/" + std::to_string(moment.id) + "/image";
+            json["image_url"] = image_url;
+            json["thumbnail_url"] = image_url + "?size=thumb";
+            json["thumbnail_ready"] = moment.derivative_status == mkm::DerivativeStatus::READY;
+        }
+        else
+        {
+            json["image_url"] = nullptr;
+            json["thumbnail_url"] = nullptr;
+            json["thumbnail_ready"] = false;
+        }
+        return json;
+    }
+
+    /**
+     * Args: moments, description length. 0 keeps sample_moments()' paragraph, otherwise the
+     * description is repeated up to that length, up to 2000 as the API allows.
+     */
+    std::vector<mkm::Moment> page_moments(const benchmark::State& state)
+    {
+        auto moments = mkm::bench::sample_moments(state.range(0));
+        if (const auto length = static_cast<size_t>(state.range(1)); length != 0)
+        {
+            for (auto& moment : moments)
+            {
+                std::string description;
+                while (description.size() < length)
+                {
+                    description += moment.description + "\n";
+                }
+                description.resize(length);
+                moment.description = std::move(description);
+            }
+        }
+        return moments;
+    }
+}
+
+// One moment, as answered by GET /moments/<id>
+static void BM_moment_json_wvalue(benchmark::State& state)
+{
+    const mkm::Moment moment = mkm::bench::sample_moments(2).back();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(moment_to_wvalue(moment).dump());
+    }
+}
+BENCHMARK(BM_moment_json_wvalue);
+
+static void BM_moment_json(benchmark::State& state)
+{
+    const mkm::Moment moment = mkm::bench::sample_moments(2).back();
+    for (auto _ : state)
+    {
+        crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+            mkm::write_moment_json(json, moment);
+        });
+        benchmark::DoNotOptimize(response.body.data());
+    }
+}
+BENCHMARK(BM_moment_json);
+
+// A listing page: building the JSON value and serializing it, as GET /moments used to
+static void BM_moments_page_json_wvalue(benchmark::State& state)
+{
+    const auto moments = page_moments(state);
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        crow::json::wvalue json;
+        std::vector<crow::json::wvalue> items;
+        items.reserve(moments.size());
+        for (const auto& moment : moments)
+        {
+            items.push_back(moment_to_wvalue(moment));
+        }
+        json["moments"] = std::move(items);
+        json["next_cursor"] = nullptr;
+        const std::string body = json.dump();
+        bytes += body.size();
+        benchmark::DoNotOptimize(body.data());
+    }
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations() * moments.size());
+}
+BENCHMARK(BM_moments_page_json_wvalue)->Args({20, 0})->Args({100, 0})->Args({20, 2000})->Args({100, 2000});
+
+// The same page written straight into the response, as GET /moments does now
+static void BM_moments_page_json(benchmark::State& state)
+{
+    const auto moments = page_moments(state);
+    size_t bytes = 0;
+    for (auto _ : state)
+    {
+        crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+            json.begin_object();
+            json.key("moments");
+            mkm::write_moments_json(json, moments);
+            json.key("next_cursor");
+            json.null();
+            json.end_object();
+        });
+        bytes += response.body.size();
+        benchmark::DoNotOptimize(response.body.data());
+    }
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations() * moments.size());
+}
+BENCHMARK(BM_moments_page_json)->Args({20, 0})->Args({100, 0})->Args({20, 2000})->Args({100, 2000});
+
+// Escaping a long description with a few quotes and line breaks in it
+static void BM_append_json_string(benchmark::State& state)
+{
+    std::string text;
+    while (text.size() < 2000)
+    {
+        text += "Walked along the river until the lights came on. The air was \"still warm\".\n";
+    }
+    std::string out;
+    for (auto _ : state)
+    {
+        out.clear();
+        mkm::append_json_string(out, text);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_append_json_string);
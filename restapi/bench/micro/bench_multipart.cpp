@@ -0,0 +1,60 @@
+#include "multipart_stream.h"
+
+#include <benchmark/benchmark.h>
+
+#include <filesystem>
+#include <string>
+
+namespace
+{
+    constexpr const char* BOUNDARY = "----MomentosBenchBoundary7MA4YWxkTrZu0gW";
+
+    // An add-moment form as the front end sends it, with an image of image_size bytes if not 0
+    std::string moment_form(size_t image_size)
+    {
+        std::string body;
+        const auto field = [&body](const char* name, const std::string& value) {
+            body += std::string("--") + BOUNDARY + "\r\n";
+            body += std::string("Content-Disposition: form-data; name=\"") + name + "\"\r\n\r\n";
+            body += value + "\r\n";
+        };
+        field("moment-title", "Evening walk");
+        field("moment-description", std::string(400, 'd'));
+        field("moment-date", "2024-06-21");
+        field("moment-feelings", "happy, at peace, grateful");
+        field("moment-image-caption", "Harbor lights");
+        if (image_size > 0)
+        {
+            body += std::string("--") + BOUNDARY + "\r\n";
+            body += "Content-Disposition: form-data; name=\"moment-image\"; filename=\"walk.jpg\"\r\n";
+            body += "Content-Type: image/jpeg\r\n\r\n";
+            // Dashes and CRs make the parser look at candidate delimiters inside the data too
+            for (size_t i = 0; i < image_size; i++)
+            {
+                body += static_cast<char>("\r-abcdefghijklmnopqrstuvwxyz0123456789"[i % 38]);
+            }
+            body += "\r\n";
+        }
+        body += std::string("--") + BOUNDARY + "--\r\n";
+        return body;
+    }
+}
+
+// Parsing the whole body as the add/update routes do, the image going through the image store
+static void BM_parse_moment_form(benchmark::State& state)
+{
+    const auto root = std::filesystem::temp_directory_path() / "momentos-bench-image-store";
+    const mkm::ImageStore store(root);
+    const std::string body = moment_form(state.range(0));
+    for (auto _ : state)
+    {
+        mkm::StreamedForm form(store, "moment-image", 2000, 10 * 1024 * 1024);
+        mkm::MultipartParser parser(BOUNDARY, form);
+        parser.feed(body);
+        parser.finish();
+        benchmark::DoNotOptimize(form.file());
+    }
+    state.SetBytesProcessed(state.iterations() * body.size());
+    std::filesystem::remove_all(root);
+}
+BENCHMARK(BM_parse_moment_form)->Arg(0)->Arg(64 * 1024)->Arg(1024 * 1024);
@@ -0,0 +1,103 @@
+#include "alloc_counter.h"
+#include "async_db.h"
+#include "moment_rows.h"
+#include "request_arena.h"
+#include "sample_moments.h"
+
+#include <benchmark/benchmark.h>
+#include <libpq-fe.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /**
+     * A text-format result with the columns of the listing statements, built client side so that
+     * no server is needed
+     */
+    std::shared_ptr<PGresult> listing_result(size_t rows)
+    {
+        static const char* const columns[] = {"id", "username", "title", "description", "moment_days",
+                                              "image_filename", "image_path", "thumbnail_path", "preview_path",
+                                              "derivative_status", "image_caption", "created_us",
+                                              "last_modified_us", "feelings"};
+        constexpr int column_count = sizeof(columns) / sizeof(columns[0]);
+
+        std::shared_ptr<PGresult> result(PQmakeEmptyPGresult(nullptr, PGRES_TUPLES_OK), PQclear);
+        std::vector<PGresAttDesc> attributes(column_count);
+        for (int i = 0; i < column_count; i++)
+        {
+            attributes[i] = PGresAttDesc{const_cast<char*>(columns[i]), 0, 0, 0, 0, -1, -1};
+        }
+        PQsetResultAttrs(result.get(), column_count, attributes.data());
+
+        const auto moments = mkm::bench::sample_moments(rows);
+        for (size_t row = 0; row < moments.size(); row++)
+        {
+            const auto& moment = moments[row];
+            const std::string values[] = {std::to_string(moment.id), moment.username, std::string(moment.title),
+                                          std::string(moment.description), std::to_string(moment.date),
+                                          std::string(moment.image_filename), std::string(moment.image_path),
+                                          std::string(moment.thumbnail_path), std::string(moment.preview_path),
+                                          std::to_string(static_cast<int>(moment.derivative_status)),
+                                          std::string(moment.image_caption), std::to_string(moment.created_date),
+                                          std::to_string(moment.last_modified_date), "{happy,sad,scared}"};
+            for (int column = 0; column < column_count; column++)
+            {
+                PQsetvalue(result.get(), static_cast<int>(row), column, const_cast<char*>(values[column].c_str()),
+                           static_cast<int>(values[column].size()));
+            }
+        }
+        return result;
+    }
+}
+
+// Mapping the rows of an asynchronous listing result onto the heap, as GET /moments did before
+// request arenas. Threads show what malloc contention does to it.
+static void BM_moments_from_rows(benchmark::State& state)
+{
+    const auto result = listing_result(state.range(0));
+    const int rows = PQntuples(result.get());
+    const uint64_t allocations = mkm::bench::thread_allocations();
+    for (auto _ : state)
+    {
+        std::vector<mkm::Moment> moments;
+        moments.reserve(rows);
+        for (int row = 0; row < rows; row++)
+        {
+            moments.push_back(mkm::moment_from_list_row(mkm::PgRow(result.get(), row), std::pmr::get_default_resource()));
+        }
+        benchmark::DoNotOptimize(moments.data());
+    }
+    state.counters["allocs_per_row"] = benchmark::Counter(
+        static_cast<double>(mkm::bench::thread_allocations() - allocations) / static_cast<double>(state.iterations() * rows),
+        benchmark::Counter::kAvgThreads);
+    state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_moments_from_rows)->Arg(20)->Arg(100)->Threads(1)->Threads(8);
+
+// The same inside a RequestArena, as GET /moments does now
+static void BM_moments_from_rows_arena(benchmark::State& state)
+{
+    const auto result = listing_result(state.range(0));
+    const int rows = PQntuples(result.get());
+    const uint64_t allocations = mkm::bench::thread_allocations();
+    for (auto _ : state)
+    {
+        mkm::RequestArena arena;
+        std::vector<mkm::Moment> moments;
+        moments.reserve(rows);
+        for (int row = 0; row < rows; row++)
+        {
+            moments.push_back(mkm::moment_from_list_row(mkm::PgRow(result.get(), row)));
+        }
+        benchmark::DoNotOptimize(moments.data());
+    }
+    state.counters["allocs_per_row"] = benchmark::Counter(
+        static_cast<double>(mkm::bench::thread_allocations() - allocations) / static_cast<double>(state.iterations() * rows),
+        benchmark::Counter::kAvgThreads);
+    state.SetItemsProcessed(state.iterations() * rows);
+}
+BENCHMARK(BM_moments_from_rows_arena)->Arg(20)->Arg(100)->Threads(1)->Threads(8);
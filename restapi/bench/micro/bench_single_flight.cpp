@@ -0,0 +1,132 @@
+#include "single_flight.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Every iteration is one burst of this many identical calls, one per thread
+    constexpr int CALLERS = 8;
+
+    // Keeps the leader's work running until every other caller of the burst has joined its
+    // flight, so that each burst coalesces completely however the threads are scheduled
+    template<typename Flight>
+    void wait_for_followers(const Flight& flight, uint64_t followers)
+    {
+        while (flight.stats().followers < followers)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void run_burst(const std::function<void()>& call)
+    {
+        std::vector<std::thread> threads;
+        threads.reserve(CALLERS);
+        for (int i = 0; i < CALLERS; i++)
+        {
+            threads.emplace_back(call);
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Fails the case unless the bursts coalesced and every caller got the outcome of the work
+    void check_flights(benchmark::State& state, const mkm::FlightStats& stats, uint64_t delivered)
+    {
+        const uint64_t calls = stats.leaders + stats.followers;
+        if (stats.leaders >= calls)
+        {
+            state.SkipWithError("No call was coalesced");
+        }
+        else if (delivered != calls)
+        {
+            state.SkipWithError("A caller missed the outcome of its flight");
+        }
+        state.counters["calls_per_leader"] = static_cast<double>(calls) / static_cast<double>(stats.leaders);
+    }
+}
+
+// Bursts of identical blocking calls, as concurrent cache misses for one user make them
+static void BM_single_flight_burst(benchmark::State& state)
+{
+    mkm::SingleFlight<int> flight;
+    std::atomic<uint64_t> delivered{0};
+    uint64_t bursts = 0;
+    for (auto _ : state)
+    {
+        const uint64_t followers = ++bursts * (CALLERS - 1);
+        run_burst([&] {
+            if (flight.run("count", [&] { wait_for_followers(flight, followers); return 42; }) == 42)
+            {
+                delivered.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    check_flights(state, flight.stats(), delivered.load());
+}
+BENCHMARK(BM_single_flight_burst)->UseRealTime();
+
+// The same when the work throws: the leader and every waiter must see the exception
+static void BM_single_flight_burst_error(benchmark::State& state)
+{
+    mkm::SingleFlight<int> flight;
+    std::atomic<uint64_t> delivered{0};
+    uint64_t bursts = 0;
+    for (auto _ : state)
+    {
+        const uint64_t followers = ++bursts * (CALLERS - 1);
+        run_burst([&] {
+            try
+            {
+                flight.run("count", [&]() -> int {
+                    wait_for_followers(flight, followers);
+                    throw std::runtime_error("query failed");
+                });
+            }
+            catch (const std::runtime_error&)
+            {
+                delivered.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    check_flights(state, flight.stats(), delivered.load());
+}
+BENCHMARK(BM_single_flight_burst_error)->UseRealTime();
+
+// AsyncSingleFlight with work that throws while starting: every waiter gets the fallback result
+static void BM_async_single_flight_burst_error(benchmark::State& state)
+{
+    mkm::AsyncSingleFlight<int> flight(-1);
+    std::atomic<uint64_t> delivered{0};
+    uint64_t bursts = 0;
+    for (auto _ : state)
+    {
+        const uint64_t followers = ++bursts * (CALLERS - 1);
+        run_burst([&] {
+            flight.run("count",
+                [](std::function<void()> completion) { completion(); },
+                [&](const int& result) {
+                    if (result == -1)
+                    {
+                        delivered.fetch_add(1, std::memory_order_relaxed);
+                    }
+                },
+                [&](mkm::AsyncSingleFlight<int>::Done) {
+                    wait_for_followers(flight, followers);
+                    throw std::runtime_error("query failed");
+                });
+        });
+    }
+    check_flights(state, flight.stats(), delivered.load());
+}
+BENCHMARK(BM_async_single_flight_burst_error)->UseRealTime();
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Moment.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace mkm::bench
+{
+// A made-up image store hash, 64 hex digits like a real one
+inline std::string hash(size_t moment, size_t variant)
+{
+    char text[65];
+    std::snprintf(text, sizeof(text), "3fa1c0ffee%054zx", moment * 3 + variant);
+    return text;
+}
+
+/**
+ * @brief Moments shaped like a typical listing page: a short title, a paragraph of description,
+ * a few feelings and, for most of them, a stored image
+ */
+inline std::vector<Moment> sample_moments(size_t count)
+{
+    std::vector<Moment> moments;
+    moments.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Moment moment;
+        moment.id = 1000 + i;
+        moment.username = "bench";
+        moment.title = "Evening walk number " + std::to_string(i);
+        moment.description = "Walked along the river until the lights came on over the harbor. "
+                             "The air was \"still warm\" and the water quiet.";
+        moment.date = *parse_date("2024-06-21");
+        for (const char* feeling : {"happy", "sad", "scared"})
+        {
+            moment.feelings.add(*feeling_dictionary().intern(feeling));
+        }
+        if (i % 4 != 0)
+        {
+            moment.image_filename = "walk-" + std::to_string(i) + ".jpg";
+            // Image store hashes are SHA-256 in hex
+            moment.image_path = hash(i, 0);
+            moment.thumbnail_path = hash(i, 1);
+            moment.preview_path = hash(i, 2);
+            moment.derivative_status = DerivativeStatus::READY;
+        }
+        moment.image_caption = "Harbor lights";
+        // 2024-06-21 20:15:03.123456+00
+        moment.created_date = 1719000903123456;
+        moment.last_modified_date = 1719000903123456;
+        moments.push_back(std::move(moment));
+    }
+    return moments;
+}
+}   // namespace mkm::bench
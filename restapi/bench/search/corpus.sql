@@ -0,0 +1,38 @@
+--
+-- Synthetic corpus for the moment search benchmark: one user owning 1M moments.
+-- Every title carries search terms of known selectivity, so that latency can be compared from
+-- "almost every row matches" down to "a handful of rows match":
+--
+--   sunset   10%      harbor   1%      lantern  0.1%      zephyr  0.001%
+--
+-- Load into a database created from mkm_db.sql:  psql -d mkm_bench -f corpus.sql
+--
+
+\set ON_ERROR_STOP on
+\set moments 1000000
+
+BEGIN;
+
+INSERT INTO public.users(username, fullname, birthdate, emailid, password_hash)
+VALUES ('bench', 'Search Benchmark', '1990-01-01',
+        'bench@example.com', '!') -- not a bcrypt hash, so nobody can log in as this user
+ON CONFLICT DO NOTHING;
+
+-- A single statement, so the moments triggers update the user's total once for the whole load
+INSERT INTO public.moments(username, title, description, moment_date, image_caption, created_date)
+SELECT 'bench',
+       'moment ' || i
+           || CASE WHEN i % 10 = 0 THEN ' sunset' ELSE '' END
+           || CASE WHEN i % 100 = 0 THEN ' harbor' ELSE '' END
+           || CASE WHEN i % 1000 = 0 THEN ' lantern' ELSE '' END
+           || CASE WHEN i % 100000 = 0 THEN ' zephyr' ELSE '' END,
+       -- Filler words so that descriptions have a realistic number of distinct lexemes
+       md5(i::text) || ' ' || md5((i * 7)::text) || ' walked along the ' || (ARRAY['river', 'coast', 'ridge', 'park'])[1 + i % 4],
+       date '2020-01-01' + (i % 1500),
+       CASE WHEN i % 3 = 0 THEN 'caption ' || md5((i * 13)::text) END,
+       timestamptz '2020-01-01' + i * interval '1 minute'
+FROM generate_series(1, :moments) AS i;
+
+COMMIT;
+
+VACUUM ANALYZE public.moments;
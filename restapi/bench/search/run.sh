@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+#
+# Moment search latency at different selectivities, old LIKE filter vs. the full-text index.
+# Needs a database loaded with corpus.sql; pgbench comes with the PostgreSQL client tools.
+#
+#   ./run.sh [database] [seconds per case] [clients]  > search.csv
+#
+# Output is CSV: method,term,selectivity,clients,tps,latency_ms
+#
+set -euo pipefail
+
+DB="${1:-mkm_bench}"
+DURATION="${2:-10}"
+CLIENTS="${3:-4}"
+USERNAME="bench"
+PAGE_SIZE=20
+STATEMENTS="$(cd "$(dirname "$0")" && pwd)/../../src/db_statements.cpp"
+
+SCRIPT_DIR="$(mktemp -d)"
+trap 'rm -rf "$SCRIPT_DIR"' EXIT
+
+# SQL of a prepared statement as db_statements.cpp registers it, e.g. statement_sql MOMENTS_SEARCH_PAGE_DESC
+statement_sql() {
+    awk -v name="{stmt::$1," '
+        function literals(line,    sql) {
+            sql = ""
+            while (match(line, /"[^"]*"|MOMENT_LIST_COLUMNS/)) {
+                token = substr(line, RSTART, RLENGTH)
+                sql = sql (token == "MOMENT_LIST_COLUMNS" ? columns : substr(token, 2, RLENGTH - 2))
+                line = substr(line, RSTART + RLENGTH)
+            }
+            return sql
+        }
+        /^#define MOMENT_LIST_COLUMNS/ { in_columns = 1; next }
+        in_columns { columns = columns literals($0); in_columns = /\\$/; next }
+        index($0, name) { in_statement = 1; next }
+        in_statement { sql = sql literals($0); if ($0 ~ /},$/) { print sql; exit } }
+    ' "$STATEMENTS"
+}
+
+# pgbench binds :variables as parameters of a prepared statement, in the server's $n order
+search_script() {
+    local sql="$1"
+    echo "\\set offset 0"
+    echo "\\set limit $PAGE_SIZE"
+    sed -e "s/\\\$1/:username/g" -e "s/\\\$2/:offset/g" -e "s/\\\$3/:limit/g" -e "s/\\\$4/:query/g" <<< "$sql;"
+}
+
+query_for() {
+    local method="$1" term="$2"
+    case "$method" in
+        like)
+            # The filter search used before the full-text index
+            echo "SELECT id, title FROM public.moments WHERE username='$USERNAME' AND title LIKE '%' || '$term' || '%' ORDER BY created_date DESC, id DESC LIMIT $PAGE_SIZE;" ;;
+        fts_date)
+            search_script "$(statement_sql MOMENTS_SEARCH_PAGE_DESC)" ;;
+        fts_ranked)
+            search_script "$(statement_sql MOMENTS_SEARCH_RANKED_PAGE)" ;;
+        fts_prefix)
+            # What the search box sends while the word is still being typed
+            search_script "$(statement_sql MOMENTS_SEARCH_PAGE_DESC)" ;;
+    esac
+}
+
+echo "method,term,selectivity,clients,tps,latency_ms"
+for entry in sunset:0.1 harbor:0.01 lantern:0.001 zephyr:0.00001; do
+    term="${entry%%:*}"
+    selectivity="${entry##*:}"
+    for method in like fts_date fts_ranked fts_prefix; do
+        script="$SCRIPT_DIR/$method-$term.sql"
+        query_for "$method" "$term" > "$script"
+        # The tsquery db_utils builds for the term, as a prefix match
+        query="'$term':*"
+        if [ "$method" = fts_prefix ]; then
+            query="'${term:0:3}':*"
+        fi
+        output="$(pgbench -n -M prepared -D username="$USERNAME" -D query="$query" -f "$script" \
+            -c "$CLIENTS" -j "$CLIENTS" -T "$DURATION" "$DB" 2>/dev/null)"
+        tps="$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' <<< "$output" | head -n 1)"
+        latency="$(sed -n 's/^latency average = \([0-9.]*\) ms/\1/p' <<< "$output")"
+        echo "$method,$term,$selectivity,$CLIENTS,$tps,$latency"
+    done
+done
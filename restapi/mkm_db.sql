@@ -29,6 +29,14 @@ CREATE EXTENSION IF NOT EXISTS pgcrypto WITH SCHEMA public;
 
 COMMENT ON EXTENSION pgcrypto IS 'cryptographic functions';
 
+
+--
+-- Name: btree_gin; Type: EXTENSION; Schema: -; Owner: -
+-- Lets one GIN index cover both the owner of a moment and its search terms
+--
+
+CREATE EXTENSION IF NOT EXISTS btree_gin WITH SCHEMA public;
+
 SET default_tablespace = '';
 SET default_table_access_method = heap;
 
@@ -44,6 +52,10 @@ CREATE TABLE public.users (
     emailid character varying(100) NOT NULL,
     password_hash character varying(255) NOT NULL,
     account_creation_time timestamp with time zone DEFAULT now() NOT NULL,
+    moment_count bigint DEFAULT 0 NOT NULL, -- maintained by the trigger_moments_* triggers
+    -- Bumped on every change to the user's moments, behind the validators of moment listings
+    moments_version bigint DEFAULT 0 NOT NULL,
+    moments_modified timestamp with time zone DEFAULT now() NOT NULL,
     CONSTRAINT users_pkey PRIMARY KEY (user_id),
     CONSTRAINT unique_email UNIQUE (emailid),
     CONSTRAINT unique_username UNIQUE (username)
@@ -60,50 +72,116 @@ CREATE TABLE public.feelings (
     CONSTRAINT unique_feeling UNIQUE (name)
 );
 
+-- The vocabulary the moment forms offer. The server interns these at startup and only accepts
+-- feelings found here.
+INSERT INTO public.feelings (name) VALUES ('angry'), ('happy'), ('sad'), ('scared');
+
 
 --
 -- Name: moments; Type: TABLE; Schema: public; Owner: mkm_user
 --
 
 CREATE TABLE public.moments (
-    moment_id uuid DEFAULT public.gen_random_uuid() NOT NULL,
-    user_id uuid NOT NULL,
+    -- Moments are addressed as /moments/<id> and always together with their owner
+    id bigint GENERATED ALWAYS AS IDENTITY,
+    username character varying(40) NOT NULL,
     title character varying(100) NOT NULL,
     description character varying(2000) NOT NULL,
     moment_date date NOT NULL,
-    image_path character varying(255),
+    image_filename character varying(255),
+    image_data bytea, -- images uploaded before the image store existed
+    image_path character varying(255), -- SHA-256 of the image inside the image store
     image_caption character varying(100),
+    thumbnail_path character varying(255), -- image store hashes of the generated variants
+    preview_path character varying(255),
+    derivative_status smallint DEFAULT 0 NOT NULL, -- 0 none, 1 pending, 2 ready, 3 failed
+    derivatives_date timestamp with time zone, -- when the workers last recorded derivatives
+    feelings text[], -- names from the feelings table, checked by the server
     created_date timestamp with time zone DEFAULT now() NOT NULL,
     last_modified_date timestamp with time zone DEFAULT now() NOT NULL,
-    CONSTRAINT moments_pkey PRIMARY KEY (moment_id),
-    CONSTRAINT fk_user FOREIGN KEY (user_id)
-        REFERENCES public.users(user_id) ON DELETE CASCADE
+    -- Words of the title, description and caption, weighted in that order, for ranked full-text
+    -- search. The 'simple' configuration skips stemming so that prefix matches behave predictably.
+    search_vector tsvector GENERATED ALWAYS AS (
+        setweight(to_tsvector('simple'::regconfig, coalesce(title, '')), 'A') ||
+        setweight(to_tsvector('simple'::regconfig, coalesce(description, '')), 'B') ||
+        setweight(to_tsvector('simple'::regconfig, coalesce(image_caption, '')), 'C')
+    ) STORED,
+    CONSTRAINT moments_pkey PRIMARY KEY (id),
+    CONSTRAINT fk_user FOREIGN KEY (username)
+        REFERENCES public.users(username) ON DELETE CASCADE ON UPDATE CASCADE
 );
 
 
 --
--- Name: moment_feelings; Type: TABLE; Schema: public; Owner: mkm_user
---
-
-CREATE TABLE public.moment_feelings (
-    moment_id uuid NOT NULL,
-    feeling_id integer NOT NULL,
-    CONSTRAINT moment_feelings_pkey PRIMARY KEY (moment_id, feeling_id),
-    CONSTRAINT fk_feeling FOREIGN KEY (feeling_id)
-        REFERENCES public.feelings(feeling_id) ON DELETE RESTRICT,
-    CONSTRAINT fk_moment FOREIGN KEY (moment_id)
-        REFERENCES public.moments(moment_id) ON DELETE CASCADE
-);
+-- Name: moments_inserted(), moments_deleted(), moments_updated(); Type: FUNCTION; Schema: public; Owner: mkm_user
+-- Keep users.moment_count in step with the moments table, inside the same transaction as the
+-- insert or delete, so that reading a user's total never has to count rows. Every change also
+-- moves the user's listing version forward. They run once per statement over its transition
+-- table, so a bulk import or a batch delete updates each user once rather than once per row.
+--
+
+CREATE FUNCTION public.moments_inserted() RETURNS trigger
+    LANGUAGE plpgsql
+    AS $$
+BEGIN
+    UPDATE public.users u SET moment_count = u.moment_count + changed.moments,
+        moments_version = u.moments_version + 1, moments_modified = now()
+        FROM (SELECT username, count(*) AS moments FROM new_moments GROUP BY username) changed
+        WHERE u.username = changed.username;
+    RETURN NULL;
+END;
+$$;
+
+CREATE FUNCTION public.moments_deleted() RETURNS trigger
+    LANGUAGE plpgsql
+    AS $$
+BEGIN
+    UPDATE public.users u SET moment_count = u.moment_count - changed.moments,
+        moments_version = u.moments_version + 1, moments_modified = now()
+        FROM (SELECT username, count(*) AS moments FROM old_moments GROUP BY username) changed
+        WHERE u.username = changed.username;
+    RETURN NULL;
+END;
+$$;
+
+CREATE FUNCTION public.moments_updated() RETURNS trigger
+    LANGUAGE plpgsql
+    AS $$
+BEGIN
+    UPDATE public.users u SET moments_version = u.moments_version + 1, moments_modified = now()
+        WHERE u.username IN (SELECT username FROM new_moments);
+    RETURN NULL;
+END;
+$$;
+
+-- Postgres allows transition tables on single-event triggers only
+CREATE TRIGGER trigger_moments_inserted AFTER INSERT ON public.moments
+    REFERENCING NEW TABLE AS new_moments
+    FOR EACH STATEMENT EXECUTE FUNCTION public.moments_inserted();
+CREATE TRIGGER trigger_moments_deleted AFTER DELETE ON public.moments
+    REFERENCING OLD TABLE AS old_moments
+    FOR EACH STATEMENT EXECUTE FUNCTION public.moments_deleted();
+CREATE TRIGGER trigger_moments_updated AFTER UPDATE ON public.moments
+    REFERENCING NEW TABLE AS new_moments
+    FOR EACH STATEMENT EXECUTE FUNCTION public.moments_updated();
+
+-- Databases created before the counter existed start from the actual totals
+UPDATE public.users u SET moment_count = (SELECT count(*) FROM public.moments m WHERE m.username = u.username);
 
 
 --
 -- Indexes
 --
 
-CREATE INDEX idx_moments_user ON public.moments USING hash (user_id);
 CREATE INDEX idx_moments_date ON public.moments USING btree (moment_date);
+-- Lets the thumbnail workers find images whose variants are still missing
+CREATE INDEX idx_moments_derivatives_pending ON public.moments USING btree (last_modified_date) WHERE derivative_status = 1;
+-- Backs keyset pagination: (user, created_date, id) seeks in either direction. Also serves every
+-- other lookup by user, so the moments of one user don't need an index of their own.
+CREATE INDEX idx_moments_user_created ON public.moments USING btree (username, created_date, id);
+-- Full-text search within one user's moments
+CREATE INDEX idx_moments_user_search ON public.moments USING gin (username, search_vector);
 CREATE INDEX idx_feelings_name ON public.feelings USING hash (name);
-CREATE INDEX idx_moment_feelings ON public.moment_feelings USING btree (moment_id);
 
 --
 -- PostgreSQL database dump complete
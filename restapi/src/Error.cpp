@@ -10,6 +10,10 @@ std::string error_str(const ErrorCode e)
         case ErrorCode::USER_NOT_FOUND: return "User not found";
         case ErrorCode::INTERNAL_ERROR: return "Some internal error occured";
         case ErrorCode::AUTHENTICATION_ERROR: return "Invalid credentials provided";
+        case ErrorCode::INVALID_CURSOR: return "Invalid or expired page cursor";
+        case ErrorCode::MOMENT_NOT_FOUND: return "Moment not found";
+        case ErrorCode::IMAGE_NOT_FOUND: return "Moment has no image";
+        case ErrorCode::DATABASE_BUSY: return "Server busy";
         default: return "UNKNOWN ERROR";
     }
 }
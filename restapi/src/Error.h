@@ -12,7 +12,11 @@ enum class ErrorCode : uint8_t
     OK = 0,
     USER_NOT_FOUND,
     INTERNAL_ERROR,
-    AUTHENTICATION_ERROR
+    AUTHENTICATION_ERROR,
+    INVALID_CURSOR,
+    MOMENT_NOT_FOUND,
+    IMAGE_NOT_FOUND,
+    DATABASE_BUSY
 };
 
 std::string error_str(const ErrorCode e);
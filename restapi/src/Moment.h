@@ -1,24 +1,71 @@
 #pragma once
 
+#include "byte_buffer.h"
+#include "epoch_time.h"
+#include "feelings.h"
+
+#include <memory_resource>
 #include <string>
-#include <vector>
 #include <cstddef>
+#include <cstdint>
 
 namespace mkm
 {
+// Progress of the thumbnail/preview generation for a moment's image, stored as a smallint
+enum class DerivativeStatus : uint8_t
+{
+    NONE = 0,
+    PENDING,
+    READY,
+    FAILED
+};
+
+/**
+ * The text fields allocate from a std::pmr::memory_resource, the request's arena when a moment is
+ * read or parsed for one request only (see moment_with_memory()). Copies allocate from the default
+ * heap, so a copy can be kept, e.g. by the details cache, after the arena is gone.
+ */
 struct Moment
 {
     uint64_t id;
+    // Who the moment belongs to. A plain string: it is the key of every per-user cache.
     std::string username;
-    std::string title;
-    std::string description;
-    std::string date;
-    std::string image_filename;
-    std::vector<std::byte> image_content;
-    std::string image_caption;
-    std::string created_date;
-    std::string last_modified_date;
-    std::vector<std::string> feelings;
+    std::pmr::string title;
+    std::pmr::string description;
+    // NO_DATE when not given, e.g. by an update that keeps the stored one
+    EpochDays date = NO_DATE;
+    std::pmr::string image_filename;
+    // Image bytes to put into the image store when writing. Reads only fill it for moments whose
+    // image predates the store and still lives in image_data.
+    ByteBuffer image_content;
+    // SHA-256 of the image in the image store, empty for moments without an image
+    std::pmr::string image_path;
+    // Image store hashes of the downscaled variants, empty until they have been generated
+    std::pmr::string thumbnail_path;
+    std::pmr::string preview_path;
+    DerivativeStatus derivative_status = DerivativeStatus::NONE;
+    std::pmr::string image_caption;
+    // Kept as numbers and only formatted when a moment is serialized
+    EpochMicros created_date = 0;
+    EpochMicros last_modified_date = 0;
+    FeelingSet feelings;
 };
 
+/**
+ * @brief An empty moment whose text fields allocate from memory, e.g. request_memory()
+ */
+inline Moment moment_with_memory(std::pmr::memory_resource* memory)
+{
+    return Moment{
+        .id = 0,
+        .title = std::pmr::string(memory),
+        .description = std::pmr::string(memory),
+        .image_filename = std::pmr::string(memory),
+        .image_path = std::pmr::string(memory),
+        .thumbnail_path = std::pmr::string(memory),
+        .preview_path = std::pmr::string(memory),
+        .image_caption = std::pmr::string(memory)
+    };
+}
+
 }   // namespace mkm
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "async_db.h"
+#include "async_log.h"
+#include "config_env.h"
+#include "db_pool.h"
+#include "db_statements.h"
+#include "metrics.h"
+#include "tracing.h"
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace mkm
+{
+    namespace
+    {
+        void run_callback(const AsyncDb::Callback& callback, AsyncResult outcome)
+        {
+            try
+            {
+                callback(std::move(outcome));
+            }
+            catch (const std::exception& e)
+            {
+                MKM_LOG_ERROR(DB) << "Asynchronous query callback failed: " << e.what();
+            }
+        }
+    }
+
+    /**
+     * One non-blocking libpq connection whose socket is watched by the owning thread's io_context.
+     * Every query is followed by a pipeline sync point, so that a failing query only aborts itself.
+     */
+    class AsyncDb::Connection
+    {
+    public:
+        Connection(asio::io_context& io, const std::string& conninfo)
+            : io_(io), conninfo_(conninfo)
+        {
+        }
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        ~Connection()
+        {
+            disconnect();
+        }
+
+        size_t load() const { return in_flight_.size() + waiting_.size(); }
+
+        void submit(const char* statement, std::vector<std::string> params, Callback callback)
+        {
+            if (conn_ == nullptr)
+            {
+                try
+                {
+                    connect();
+                }
+                catch (const std::exception& e)
+                {
+                    MKM_LOG_ERROR(DB) << "Asynchronous database connection failed: " << e.what();
+                    asio::post(io_, [callback = std::move(callback), error = std::string(e.what())] {
+                        run_callback(callback, AsyncResult{nullptr, error});
+                    });
+                    return;
+                }
+            }
+            waiting_.push_back({statement, std::move(params), std::move(callback), current_trace()});
+            send_waiting();
+        }
+
+    private:
+        enum class Stage
+        {
+            AWAIT_RESULT,
+            // The NULL that ends the results of a query
+            AWAIT_END,
+            AWAIT_SYNC
+        };
+
+        struct Query
+        {
+            const char* statement;
+            std::vector<std::string> params;
+            Callback callback;
+            uint64_t trace;
+        };
+
+        struct InFlight
+        {
+            Callback callback;
+            Stage stage;
+            const char* statement;
+            // Time spent queued behind other queries of the connection isn't counted
+            std::chrono::steady_clock::time_point sent;
+            uint64_t trace;
+        };
+
+        // Opening a connection blocks the thread, but only happens on first use and after the
+        // server dropped the connection
+        void connect()
+        {
+            PGconn* conn = PQconnectdb(conninfo_.c_str());
+            if (conn == nullptr || PQstatus(conn) != CONNECTION_OK)
+            {
+                std::string message = conn != nullptr ? PQerrorMessage(conn) : "out of memory";
+                PQfinish(conn);
+                throw pqxx::broken_connection(message);
+            }
+            try
+            {
+                prepare_statements(conn);
+            }
+            catch (...)
+            {
+                PQfinish(conn);
+                throw;
+            }
+            if (PQsetnonblocking(conn, 1) != 0)
+            {
+                std::string message = PQerrorMessage(conn);
+                PQfinish(conn);
+                throw pqxx::broken_connection(message);
+            }
+#ifdef LIBPQ_HAS_PIPELINING
+            pipelined_ = PQenterPipelineMode(conn) == 1;
+#endif
+            conn_ = conn;
+            socket_ = std::make_unique<asio::posix::stream_descriptor>(io_, PQsocket(conn_));
+        }
+
+        void disconnect()
+        {
+            if (socket_)
+            {
+                // The descriptor belongs to libpq - stop watching it without closing it
+                socket_->cancel();
+                socket_->release();
+                socket_.reset();
+            }
+            if (conn_ != nullptr)
+            {
+                PQfinish(conn_);
+                conn_ = nullptr;
+            }
+            reading_ = false;
+            writing_ = false;
+            pipelined_ = false;
+        }
+
+        void send_waiting()
+        {
+            // Without pipeline mode libpq allows just one query at a time on a connection
+            while (!waiting_.empty() && conn_ != nullptr && (pipelined_ || in_flight_.empty()))
+            {
+                Query query = std::move(waiting_.front());
+                waiting_.pop_front();
+
+                std::vector<const char*> values;
+                values.reserve(query.params.size());
+                for (const auto& param : query.params)
+                {
+                    values.push_back(param.c_str());
+                }
+                bool sent = PQsendQueryPrepared(conn_, query.statement, static_cast<int>(values.size()),
+                                                values.data(), nullptr, nullptr, 0) == 1;
+#ifdef LIBPQ_HAS_PIPELINING
+                sent = sent && (!pipelined_ || PQpipelineSync(conn_) == 1);
+#endif
+                if (!sent)
+                {
+                    waiting_.push_front(std::move(query));
+                    broken(PQerrorMessage(conn_));
+                    return;
+                }
+                in_flight_.push_back({std::move(query.callback), Stage::AWAIT_RESULT, query.statement, std::chrono::steady_clock::now(),
+                                      query.trace});
+            }
+            flush();
+        }
+
+        void flush()
+        {
+            if (conn_ == nullptr)
+            {
+                return;
+            }
+            const int pending = PQflush(conn_);
+            if (pending < 0)
+            {
+                broken(PQerrorMessage(conn_));
+                return;
+            }
+            if (pending == 1)
+            {
+                wait_writable();
+            }
+            if (!in_flight_.empty())
+            {
+                wait_readable();
+            }
+        }
+
+        void wait_writable()
+        {
+            if (writing_)
+            {
+                return;
+            }
+            writing_ = true;
+            socket_->async_wait(asio::posix::stream_descriptor::wait_write, [this](const asio::error_code& error) {
+                if (error == asio::error::operation_aborted)
+                {
+                    return;
+                }
+                writing_ = false;
+                flush();
+            });
+        }
+
+        void wait_readable()
+        {
+            if (reading_)
+            {
+                return;
+            }
+            reading_ = true;
+            socket_->async_wait(asio::posix::stream_descriptor::wait_read, [this](const asio::error_code& error) {
+                if (error == asio::error::operation_aborted)
+                {
+                    return;
+                }
+                reading_ = false;
+                on_readable();
+            });
+        }
+
+        void on_readable()
+        {
+            if (PQconsumeInput(conn_) == 0)
+            {
+                broken(PQerrorMessage(conn_));
+                return;
+            }
+            read_results();
+            if (conn_ == nullptr)
+            {
+                return;
+            }
+            send_waiting();
+            if (!in_flight_.empty())
+            {
+                wait_readable();
+            }
+        }
+
+        void read_results()
+        {
+            while (conn_ != nullptr && !in_flight_.empty() && PQisBusy(conn_) == 0)
+            {
+                PGresult* raw = PQgetResult(conn_);
+                InFlight& query = in_flight_.front();
+                switch (query.stage)
+                {
+                case Stage::AWAIT_RESULT:
+                {
+                    if (raw == nullptr)
+                    {
+                        return;
+                    }
+                    AsyncResult outcome;
+                    std::shared_ptr<PGresult> result(raw, PQclear);
+                    const ExecStatusType status = PQresultStatus(raw);
+                    if (status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK)
+                    {
+                        outcome.result = std::move(result);
+                    }
+                    else
+                    {
+                        const char* message = PQresultErrorMessage(raw);
+                        outcome.error = *message != '\0' ? message : PQresStatus(status);
+                    }
+                    const auto received = std::chrono::steady_clock::now();
+                    metrics().query_finished(query.statement, received - query.sent, !outcome.ok());
+                    if (query.trace != 0)
+                    {
+                        tracer().record(query.trace, "db", query.statement, query.sent, received);
+                    }
+                    Callback callback = std::move(query.callback);
+                    query.stage = Stage::AWAIT_END;
+                    // May submit further queries - references into the deque survive push_back
+                    run_callback(callback, std::move(outcome));
+                    break;
+                }
+                case Stage::AWAIT_END:
+                    if (raw != nullptr)
+                    {
+                        // A single statement yields a single result - ignore anything extra
+                        PQclear(raw);
+                        break;
+                    }
+                    if (pipelined_)
+                    {
+                        query.stage = Stage::AWAIT_SYNC;
+                    }
+                    else
+                    {
+                        in_flight_.pop_front();
+                    }
+                    break;
+                case Stage::AWAIT_SYNC:
+                    if (raw == nullptr)
+                    {
+                        return;
+                    }
+#ifdef LIBPQ_HAS_PIPELINING
+                    if (PQresultStatus(raw) == PGRES_PIPELINE_SYNC)
+                    {
+                        in_flight_.pop_front();
+                    }
+#endif
+                    PQclear(raw);
+                    break;
+                }
+            }
+        }
+
+        // The server went away: fail everything on this connection, the next query reconnects
+        void broken(const std::string& message)
+        {
+            MKM_LOG_ERROR(DB) << "Asynchronous database connection lost: " << message;
+            auto in_flight = std::move(in_flight_);
+            auto waiting = std::move(waiting_);
+            in_flight_.clear();
+            waiting_.clear();
+            disconnect();
+            // Posted, like a failed connect: this may run inside submit(), whose caller expects
+            // its callback to run later, never from within the call
+            const auto fail = [this, &message](Callback callback) {
+                asio::post(io_, [callback = std::move(callback), message] {
+                    run_callback(callback, AsyncResult{nullptr, message});
+                });
+            };
+            for (auto& query : in_flight)
+            {
+                if (query.stage == Stage::AWAIT_RESULT)
+                {
+                    metrics().query_finished(query.statement, std::chrono::steady_clock::now() - query.sent, true);
+                    fail(std::move(query.callback));
+                }
+            }
+            for (auto& query : waiting)
+            {
+                fail(std::move(query.callback));
+            }
+        }
+
+        asio::io_context& io_;
+        const std::string conninfo_;
+        PGconn* conn_ = nullptr;
+        std::unique_ptr<asio::posix::stream_descriptor> socket_;
+        bool pipelined_ = false;
+        bool reading_ = false;
+        bool writing_ = false;
+        std::deque<InFlight> in_flight_;
+        std::deque<Query> waiting_;
+    };
+
+    AsyncDb::Config AsyncDb::Config::from_env()
+    {
+        Config config;
+        config.connections_per_thread = std::max<size_t>(1, env_or("MKM_ASYNC_DB_CONNECTIONS", config.connections_per_thread));
+        config.max_queued = std::max<size_t>(1, env_or("MKM_ASYNC_DB_MAX_QUEUED", config.max_queued));
+        return config;
+    }
+
+    AsyncDb& AsyncDb::for_context(asio::io_context& io)
+    {
+        // Crow runs exactly one io_context per I/O thread, so one client per thread is one per context
+        thread_local std::unique_ptr<AsyncDb> instance;
+        if (!instance)
+        {
+            instance = std::make_unique<AsyncDb>(io, db_pool().config().conninfo, Config::from_env());
+        }
+        if (&instance->io_ != &io)
+        {
+            throw std::logic_error("AsyncDb used from a thread that doesn't run the given io_context");
+        }
+        return *instance;
+    }
+
+    AsyncDb::AsyncDb(asio::io_context& io, std::string conninfo, Config config)
+        : io_(io), conninfo_(std::move(conninfo)), config_(config)
+    {
+        connections_.reserve(config_.connections_per_thread);
+        for (size_t i = 0; i < config_.connections_per_thread; i++)
+        {
+            connections_.push_back(std::make_unique<Connection>(io_, conninfo_));
+        }
+    }
+
+    AsyncDb::~AsyncDb() = default;
+
+    void AsyncDb::exec_prepared(const char* statement, std::vector<std::string> params, Callback callback)
+    {
+        auto least_loaded = std::min_element(connections_.begin(), connections_.end(),
+            [](const auto& a, const auto& b) { return a->load() < b->load(); });
+        size_t queued = 0;
+        for (const auto& connection : connections_)
+        {
+            queued += connection->load();
+        }
+        if (queued >= config_.max_queued)
+        {
+            asio::post(io_, [callback = std::move(callback)] {
+                run_callback(callback, AsyncResult{nullptr, "Too many queued queries", true});
+            });
+            return;
+        }
+        (*least_loaded)->submit(statement, std::move(params), std::move(callback));
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <libpq-fe.h>
+#include <pqxx/pqxx>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace asio
+{
+class io_context;
+}
+
+namespace mkm
+{
+/**
+ * @brief One text-format column value of a libpq result, with the subset of pqxx::field's
+ * interface the row mappers in db_utils.cpp use
+ */
+class PgField
+{
+public:
+    PgField(const PGresult* result, int row, int column)
+        : result_(result), row_(row), column_(column)
+    {
+    }
+
+    bool is_null() const { return column_ < 0 || PQgetisnull(result_, row_, column_); }
+    const char* c_str() const { return column_ < 0 ? "" : PQgetvalue(result_, row_, column_); }
+
+    template<typename T>
+    T as() const
+    {
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            return c_str()[0] == 't';
+        }
+        else if constexpr (std::is_unsigned_v<T>)
+        {
+            return static_cast<T>(std::strtoull(c_str(), nullptr, 10));
+        }
+        else
+        {
+            static_assert(std::is_integral_v<T>, "PgField::as only converts integers and booleans");
+            return static_cast<T>(std::strtoll(c_str(), nullptr, 10));
+        }
+    }
+
+    // ASCII-safe for UTF-8 too: multibyte sequences never contain the delimiters it looks for
+    pqxx::array_parser as_array() const { return pqxx::array_parser(std::string_view(c_str())); }
+
+private:
+    const PGresult* result_;
+    int row_;
+    int column_;
+};
+
+class PgRow
+{
+public:
+    PgRow(const PGresult* result, int row)
+        : result_(result), row_(row)
+    {
+    }
+
+    PgField operator[](const char* column) const { return PgField(result_, row_, PQfnumber(result_, column)); }
+
+private:
+    const PGresult* result_;
+    int row_;
+};
+
+/**
+ * @brief Outcome of an asynchronous query. Either a result, an error message, or busy when the
+ * connection's queue was full and the query was never sent.
+ */
+struct AsyncResult
+{
+    std::shared_ptr<PGresult> result;
+    std::string error;
+    bool busy = false;
+
+    bool ok() const { return result != nullptr; }
+    size_t size() const { return result ? static_cast<size_t>(PQntuples(result.get())) : 0; }
+    PgRow operator[](size_t row) const { return PgRow(result.get(), static_cast<int>(row)); }
+};
+
+/**
+ * @brief Non-blocking PostgreSQL client driven by the asio event loop of one Crow I/O thread.
+ *
+ * Queries are sent with libpq's asynchronous API over a handful of connections owned by the thread,
+ * and their sockets are watched by the thread's io_context, so a waiting request costs a callback
+ * instead of a parked worker. Where libpq supports pipeline mode (PostgreSQL 14+ client library)
+ * every connection keeps any number of queries in flight; older libpq sends one query at a time
+ * per connection and queues the rest.
+ *
+ * Not thread-safe: use it only from the thread that runs its io_context, which is where callbacks
+ * are invoked as well.
+ */
+class AsyncDb
+{
+public:
+    using Callback = std::function<void(AsyncResult)>;
+
+    struct Config
+    {
+        size_t connections_per_thread = 2;
+        // Queries allowed to wait per thread before new ones are answered with busy
+        size_t max_queued = 1024;
+
+        /**
+         * @brief Read MKM_ASYNC_DB_CONNECTIONS and MKM_ASYNC_DB_MAX_QUEUED, keeping the defaults otherwise
+         */
+        static Config from_env();
+    };
+
+    /**
+     * @brief The client of the calling thread, created on first use for io - which must be the
+     * io_context this thread runs
+     */
+    static AsyncDb& for_context(asio::io_context& io);
+
+    AsyncDb(asio::io_context& io, std::string conninfo, Config config);
+    AsyncDb(const AsyncDb&) = delete;
+    AsyncDb& operator=(const AsyncDb&) = delete;
+    ~AsyncDb();
+
+    /**
+     * @brief Run a statement of db_statements.h. Parameters are passed as text. The callback always
+     * runs later from the event loop, never inside this call.
+     */
+    void exec_prepared(const char* statement, std::vector<std::string> params, Callback callback);
+
+private:
+    class Connection;
+
+    asio::io_context& io_;
+    const std::string conninfo_;
+    const Config config_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+};
+}   // namespace mkm
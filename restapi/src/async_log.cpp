@@ -0,0 +1,511 @@
+#include "async_log.h"
+#include "config_env.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <optional>
+#include <sstream>
+
+namespace mkm
+{
+    namespace
+    {
+        constexpr const char* SUBSYSTEM_NAMES[] = {"crow", "http", "auth", "db", "images", "core"};
+        constexpr const char* LEVEL_NAMES[] = {"DEBUG   ", "INFO    ", "WARNING ", "ERROR   ", "CRITICAL"};
+
+        static_assert(std::size(SUBSYSTEM_NAMES) == static_cast<size_t>(LogSubsystem::COUNT));
+
+        std::string lowercase(std::string_view text)
+        {
+            std::string result(text);
+            std::transform(result.begin(), result.end(), result.begin(), [](unsigned char c) { return std::tolower(c); });
+            return result;
+        }
+
+        std::string_view trim(std::string_view text)
+        {
+            const auto first = text.find_first_not_of(" \t\r\n");
+            if (first == std::string_view::npos)
+            {
+                return {};
+            }
+            return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+        }
+
+        std::optional<int> parse_level(std::string_view text)
+        {
+            const std::string name = lowercase(trim(text));
+            for (size_t level = 0; level < std::size(LEVEL_NAMES); level++)
+            {
+                if (name == lowercase(trim(LEVEL_NAMES[level])))
+                {
+                    return static_cast<int>(level);
+                }
+            }
+            return std::nullopt;
+        }
+
+        std::optional<size_t> parse_subsystem(std::string_view text)
+        {
+            const std::string name = lowercase(trim(text));
+            for (size_t subsystem = 0; subsystem < std::size(SUBSYSTEM_NAMES); subsystem++)
+            {
+                if (name == SUBSYSTEM_NAMES[subsystem])
+                {
+                    return subsystem;
+                }
+            }
+            return std::nullopt;
+        }
+
+        int64_t now_microseconds()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        // Reused by every message a thread logs, so that logging doesn't allocate
+        struct ThreadLine
+        {
+            AsyncLogHandler::LineBuffer buffer;
+            std::ostream stream{&buffer};
+            bool in_use = false;
+        };
+
+        ThreadLine& thread_line()
+        {
+            thread_local ThreadLine line;
+            return line;
+        }
+
+        size_t round_up_to_power_of_two(size_t value)
+        {
+            size_t result = 64;
+            while (result < value)
+            {
+                result <<= 1;
+            }
+            return result;
+        }
+    }
+
+    AsyncLogHandler::Config AsyncLogHandler::Config::from_env()
+    {
+        Config config;
+        config.capacity = std::max<size_t>(64, env_or("MKM_LOG_BUFFER", config.capacity, EnvWarnings::STDERR));
+        config.path = env_or("MKM_LOG_FILE", config.path);
+        config.levels = env_or("MKM_LOG_LEVEL", config.levels);
+        config.levels_file = env_or("MKM_LOG_LEVELS_FILE", config.levels_file);
+        return config;
+    }
+
+    /**
+     * One message. Vyukov's bounded queue: a slot's sequence says whose turn it is - equal to the
+     * position when a producer may fill it, one past the position once it holds a message.
+     */
+    struct AsyncLogHandler::Slot
+    {
+        std::atomic<size_t> sequence;
+        int64_t time_us;
+        uint32_t cut;
+        uint16_t size;
+        uint8_t level;
+        uint8_t subsystem;
+        char text[MAX_MESSAGE];
+    };
+
+    AsyncLogHandler::LineBuffer::int_type AsyncLogHandler::LineBuffer::overflow(int_type c)
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            cut_++;
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize AsyncLogHandler::LineBuffer::xsputn(const char* s, std::streamsize count)
+    {
+        const std::streamsize stored = std::min<std::streamsize>(count, epptr() - pptr());
+        std::memcpy(pptr(), s, static_cast<size_t>(stored));
+        pbump(static_cast<int>(stored));
+        cut_ += static_cast<size_t>(count - stored);
+        return count;
+    }
+
+    AsyncLogHandler::AsyncLogHandler(Config config)
+        : config_(std::move(config))
+        , slots_(new Slot[round_up_to_power_of_two(config_.capacity)])
+        , mask_(round_up_to_power_of_two(config_.capacity) - 1)
+    {
+        for (size_t position = 0; position <= mask_; position++)
+        {
+            slots_[position].sequence.store(position, std::memory_order_relaxed);
+        }
+        for (auto& level : levels_)
+        {
+            level.store(static_cast<int>(crow::LogLevel::INFO), std::memory_order_relaxed);
+        }
+        crow::logger::setLogLevel(crow::LogLevel::INFO);
+
+        std::string problem;
+        if (config_.path.empty())
+        {
+            fd_ = STDERR_FILENO;
+        }
+        else
+        {
+            fd_ = ::open(config_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (fd_ < 0)
+            {
+                problem = "Could not open log file " + config_.path + ": " + std::strerror(errno) + ", logging to stderr";
+                fd_ = STDERR_FILENO;
+            }
+        }
+
+        if (!problem.empty())
+        {
+            log(LogSubsystem::CORE, crow::LogLevel::WARNING, problem);
+        }
+        if (!apply_levels(config_.levels))
+        {
+            log(LogSubsystem::CORE, crow::LogLevel::WARNING, "Ignoring invalid MKM_LOG_LEVEL: " + config_.levels);
+        }
+        reload_levels_file();
+
+        writer_ = std::thread([this] { writer_loop(); });
+        // Lives as long as the process, see async_log()
+        writer_.detach();
+    }
+
+    void AsyncLogHandler::log(std::string message, crow::LogLevel level)
+    {
+        log(LogSubsystem::CROW, level, message);
+    }
+
+    void AsyncLogHandler::log(LogSubsystem subsystem, crow::LogLevel level, std::string_view message, size_t cut) noexcept
+    {
+        if (message.size() > MAX_MESSAGE)
+        {
+            cut += message.size() - MAX_MESSAGE;
+            message = message.substr(0, MAX_MESSAGE);
+        }
+        if (!push(subsystem, level, message, cut))
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    bool AsyncLogHandler::push(LogSubsystem subsystem, crow::LogLevel level, std::string_view message, size_t cut) noexcept
+    {
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;)
+        {
+            slot = &slots_[position & mask_];
+            const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0)
+            {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                // The writer hasn't freed this slot yet - full
+                return false;
+            }
+            else
+            {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->time_us = now_microseconds();
+        slot->cut = static_cast<uint32_t>(std::min<size_t>(cut, UINT32_MAX));
+        slot->size = static_cast<uint16_t>(message.size());
+        slot->level = static_cast<uint8_t>(level);
+        slot->subsystem = static_cast<uint8_t>(subsystem);
+        std::memcpy(slot->text, message.data(), message.size());
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        // Only the first message after the writer went idle pays for waking it. A wake-up lost to
+        // the race with the writer going to sleep only delays the message to its next timed wake.
+        if (writer_idle_.load(std::memory_order_relaxed) && writer_idle_.exchange(false))
+        {
+            writer_wake_.notify_one();
+        }
+        return true;
+    }
+
+    bool AsyncLogHandler::queued() const noexcept
+    {
+        const size_t position = dequeue_position_.load(std::memory_order_relaxed);
+        return slots_[position & mask_].sequence.load(std::memory_order_acquire) == position + 1;
+    }
+
+    void AsyncLogHandler::set_level(LogSubsystem subsystem, crow::LogLevel level)
+    {
+        levels_[static_cast<size_t>(subsystem)].store(static_cast<int>(level), std::memory_order_relaxed);
+        if (subsystem == LogSubsystem::CROW)
+        {
+            // Crow checks its own level before formatting anything
+            crow::logger::setLogLevel(level);
+        }
+    }
+
+    bool AsyncLogHandler::apply_levels(std::string_view spec)
+    {
+        std::array<int, static_cast<size_t>(LogSubsystem::COUNT)> levels;
+        for (size_t subsystem = 0; subsystem < levels.size(); subsystem++)
+        {
+            levels[subsystem] = levels_[subsystem].load(std::memory_order_relaxed);
+        }
+
+        while (!spec.empty())
+        {
+            const size_t comma = spec.find(',');
+            const std::string_view entry = trim(spec.substr(0, comma));
+            spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+            if (entry.empty())
+            {
+                continue;
+            }
+
+            const size_t equals = entry.find('=');
+            const auto level = parse_level(equals == std::string_view::npos ? entry : entry.substr(equals + 1));
+            if (!level)
+            {
+                return false;
+            }
+            if (equals == std::string_view::npos)
+            {
+                levels.fill(*level);
+                continue;
+            }
+            const auto subsystem = parse_subsystem(entry.substr(0, equals));
+            if (!subsystem)
+            {
+                return false;
+            }
+            levels[*subsystem] = *level;
+        }
+
+        for (size_t subsystem = 0; subsystem < levels.size(); subsystem++)
+        {
+            set_level(static_cast<LogSubsystem>(subsystem), static_cast<crow::LogLevel>(levels[subsystem]));
+        }
+        return true;
+    }
+
+    void AsyncLogHandler::flush()
+    {
+        const size_t target = enqueue_position_.load(std::memory_order_relaxed);
+        std::unique_lock lock(writer_mutex_);
+        writer_idle_.store(false, std::memory_order_relaxed);
+        writer_wake_.notify_one();
+        // Bounded, in case a thread claimed a slot and never got to fill it
+        flushed_.wait_for(lock, std::chrono::seconds(2), [&] {
+            return static_cast<std::ptrdiff_t>(dequeue_position_.load(std::memory_order_acquire) - target) >= 0;
+        });
+    }
+
+    void AsyncLogHandler::writer_loop()
+    {
+        using Clock = std::chrono::steady_clock;
+        auto next_reload = Clock::now() + std::chrono::seconds(1);
+        for (;;)
+        {
+            const bool wrote = drain();
+            if (wrote)
+            {
+                std::lock_guard lock(writer_mutex_);
+                flushed_.notify_all();
+            }
+            if (!config_.levels_file.empty() && Clock::now() >= next_reload)
+            {
+                reload_levels_file();
+                next_reload = Clock::now() + std::chrono::seconds(1);
+            }
+            if (wrote)
+            {
+                continue;
+            }
+
+            std::unique_lock lock(writer_mutex_);
+            writer_idle_.store(true);
+            if (!queued())
+            {
+                writer_wake_.wait_for(lock, std::chrono::milliseconds(200));
+            }
+            writer_idle_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    bool AsyncLogHandler::drain()
+    {
+        // Formatting the date once a second is plenty
+        thread_local int64_t formatted_second = -1;
+        thread_local char date[32];
+
+        std::string text;
+        const auto append_line = [&](int64_t time_us, size_t level, size_t subsystem, std::string_view message) {
+            const int64_t second = time_us / 1000000;
+            if (second != formatted_second)
+            {
+                const std::time_t time = static_cast<std::time_t>(second);
+                std::tm utc;
+                gmtime_r(&time, &utc);
+                std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &utc);
+                formatted_second = second;
+            }
+            text += '(';
+            text += date;
+            text += ") [";
+            text += LEVEL_NAMES[std::min(level, std::size(LEVEL_NAMES) - 1)];
+            text += "] [";
+            text += SUBSYSTEM_NAMES[subsystem];
+            text += "] ";
+            text += message;
+        };
+
+        size_t position = dequeue_position_.load(std::memory_order_relaxed);
+        for (; text.size() < 64 * 1024; position++)
+        {
+            Slot& slot = slots_[position & mask_];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+            {
+                break;
+            }
+            append_line(slot.time_us, slot.level, slot.subsystem, std::string_view(slot.text, slot.size));
+            if (slot.cut != 0)
+            {
+                text += "... [" + std::to_string(slot.cut) + " more bytes]";
+            }
+            text += '\n';
+
+            slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+            dequeue_position_.store(position + 1, std::memory_order_release);
+        }
+
+        const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped_)
+        {
+            append_line(now_microseconds(), static_cast<size_t>(crow::LogLevel::WARNING), static_cast<size_t>(LogSubsystem::CORE),
+                        std::to_string(dropped - reported_dropped_) + " log message(s) dropped, buffer full\n");
+            reported_dropped_ = dropped;
+        }
+
+        if (text.empty())
+        {
+            return false;
+        }
+        write(text);
+        return true;
+    }
+
+    void AsyncLogHandler::write(const std::string& text)
+    {
+        size_t written = 0;
+        while (written < text.size())
+        {
+            const ssize_t result = ::write(fd_, text.data() + written, text.size() - written);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // Nowhere left to report it
+                return;
+            }
+            written += static_cast<size_t>(result);
+        }
+    }
+
+    void AsyncLogHandler::reload_levels_file()
+    {
+        if (config_.levels_file.empty())
+        {
+            return;
+        }
+        struct stat status;
+        if (::stat(config_.levels_file.c_str(), &status) != 0)
+        {
+            return;
+        }
+        const int64_t mtime = static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+        if (mtime == levels_file_mtime_)
+        {
+            return;
+        }
+        levels_file_mtime_ = mtime;
+
+        std::ifstream file(config_.levels_file);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        // One entry per line is as good as a comma-separated spec
+        std::string spec(trim(contents.str()));
+        std::replace(spec.begin(), spec.end(), '\n', ',');
+        if (apply_levels(spec))
+        {
+            log(LogSubsystem::CORE, crow::LogLevel::INFO, "Log levels set from " + config_.levels_file + ": " + spec);
+        }
+        else
+        {
+            log(LogSubsystem::CORE, crow::LogLevel::WARNING, "Ignoring invalid log levels in " + config_.levels_file);
+        }
+    }
+
+    AsyncLogHandler& async_log()
+    {
+        // Never destroyed: statics torn down after main() returns may still log
+        static AsyncLogHandler* instance = new AsyncLogHandler(AsyncLogHandler::Config::from_env());
+        return *instance;
+    }
+
+    LogLine::LogLine(LogSubsystem subsystem, crow::LogLevel level)
+        : subsystem_(subsystem)
+        , level_(level)
+    {
+        ThreadLine& line = thread_line();
+        if (line.in_use)
+        {
+            nested_buffer_ = std::make_unique<AsyncLogHandler::LineBuffer>();
+            nested_stream_ = std::make_unique<std::ostream>(nested_buffer_.get());
+            buffer_ = nested_buffer_.get();
+            stream_ = nested_stream_.get();
+            return;
+        }
+        line.in_use = true;
+        line.buffer.reset();
+        // Undo whatever the previous message left set
+        line.stream.clear();
+        line.stream.flags(std::ios_base::dec | std::ios_base::skipws);
+        line.stream.precision(6);
+        line.stream.width(0);
+        line.stream.fill(' ');
+        buffer_ = &line.buffer;
+        stream_ = &line.stream;
+    }
+
+    LogLine::~LogLine()
+    {
+        async_log().log(subsystem_, level_, buffer_->text(), buffer_->cut());
+        if (!nested_buffer_)
+        {
+            thread_line().in_use = false;
+        }
+    }
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <crow/logging.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace mkm
+{
+enum class LogSubsystem : uint8_t
+{
+    CROW,    // Crow's own messages: connections, request lines, routing
+    HTTP,    // request handlers
+    AUTH,    // tokens and passwords
+    DB,
+    IMAGES,  // image store and thumbnails
+    CORE,    // caches, metrics, tracing, configuration
+    COUNT
+};
+
+/**
+ * @brief Log handler that never blocks the logging thread: messages are formatted where they are
+ * logged, copied into a bounded lock-free ring and written out by a background thread. When the
+ * ring is full a message is dropped and counted instead.
+ *
+ * Levels are kept per subsystem and can be changed while running - see apply_levels(). Crow's own
+ * messages come in through the crow::ILogHandler interface, under LogSubsystem::CROW.
+ */
+class AsyncLogHandler : public crow::ILogHandler
+{
+public:
+    // Longer messages are cut, with a note of how much was cut
+    static constexpr size_t MAX_MESSAGE = 1024;
+
+    struct Config
+    {
+        // Messages the ring holds, rounded up to a power of two
+        size_t capacity = 8192;
+        // Empty for stderr
+        std::string path;
+        std::string levels = "info";
+        // Re-read whenever it changes, overriding levels
+        std::string levels_file;
+
+        /**
+         * @brief MKM_LOG_BUFFER, MKM_LOG_FILE, MKM_LOG_LEVEL, MKM_LOG_LEVELS_FILE
+         */
+        static Config from_env();
+    };
+
+    /**
+     * @brief Collects one message on the logging thread, cutting it at MAX_MESSAGE without
+     * allocating
+     */
+    class LineBuffer : public std::streambuf
+    {
+    public:
+        LineBuffer() { reset(); }
+
+        void reset()
+        {
+            setp(data_.data(), data_.data() + data_.size());
+            cut_ = 0;
+        }
+
+        std::string_view text() const { return std::string_view(pbase(), pptr() - pbase()); }
+        size_t cut() const { return cut_; }
+
+    protected:
+        int_type overflow(int_type c) override;
+        std::streamsize xsputn(const char* s, std::streamsize count) override;
+
+    private:
+        std::array<char, MAX_MESSAGE> data_;
+        size_t cut_ = 0;
+    };
+
+    explicit AsyncLogHandler(Config config);
+
+    AsyncLogHandler(const AsyncLogHandler&) = delete;
+    AsyncLogHandler& operator=(const AsyncLogHandler&) = delete;
+
+    // From crow::logger, already filtered by Crow's level
+    void log(std::string message, crow::LogLevel level) override;
+
+    void log(LogSubsystem subsystem, crow::LogLevel level, std::string_view message, size_t cut = 0) noexcept;
+
+    bool enabled(LogSubsystem subsystem, crow::LogLevel level) const noexcept
+    {
+        return static_cast<int>(level) >= levels_[static_cast<size_t>(subsystem)].load(std::memory_order_relaxed);
+    }
+
+    void set_level(LogSubsystem subsystem, crow::LogLevel level);
+
+    /**
+     * @brief Apply a level spec such as "info,db=debug,crow=warning". A bare level applies to
+     * every subsystem, later entries override earlier ones.
+     * @return false, leaving the levels as they were, if the spec doesn't parse
+     */
+    bool apply_levels(std::string_view spec);
+
+    uint64_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Wait until every message logged so far has been written, e.g. before exiting
+     */
+    void flush();
+
+private:
+    struct Slot;
+
+    bool push(LogSubsystem subsystem, crow::LogLevel level, std::string_view message, size_t cut) noexcept;
+    bool queued() const noexcept;
+    void writer_loop();
+    // Writes everything queued, returns whether there was anything
+    bool drain();
+    void write(const std::string& text);
+    void reload_levels_file();
+
+    const Config config_;
+    std::array<std::atomic<int>, static_cast<size_t>(LogSubsystem::COUNT)> levels_;
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reported_dropped_ = 0;
+    int fd_ = -1;
+
+    std::unique_ptr<Slot[]> slots_;
+    const size_t mask_;
+    std::atomic<size_t> enqueue_position_{0};
+    // Only the writer thread dequeues, others just wait for it in flush()
+    std::atomic<size_t> dequeue_position_{0};
+
+    std::mutex writer_mutex_;
+    std::condition_variable writer_wake_;
+    std::condition_variable flushed_;
+    std::atomic<bool> writer_idle_{false};
+    int64_t levels_file_mtime_ = -1;
+    std::thread writer_;
+};
+
+/**
+ * @brief The handler Crow and the MKM_LOG_* macros log through. Lives until the process exits, so
+ * that destructors of other statics can still log.
+ */
+AsyncLogHandler& async_log();
+
+/**
+ * @brief One log message, handed over when the statement that built it ends
+ */
+class LogLine
+{
+public:
+    LogLine(LogSubsystem subsystem, crow::LogLevel level);
+    ~LogLine();
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    template<typename T>
+    LogLine& operator<<(const T& value)
+    {
+        *stream_ << value;
+        return *this;
+    }
+
+private:
+    const LogSubsystem subsystem_;
+    const crow::LogLevel level_;
+    AsyncLogHandler::LineBuffer* buffer_;
+    std::ostream* stream_;
+    // Only for a message logged while building another one on the same thread
+    std::unique_ptr<AsyncLogHandler::LineBuffer> nested_buffer_;
+    std::unique_ptr<std::ostream> nested_stream_;
+};
+}   // namespace mkm
+
+// Nothing after the macro is evaluated unless the subsystem logs at that level
+#define MKM_LOG(subsystem, level)                                                                   \
+    if (!mkm::async_log().enabled(mkm::LogSubsystem::subsystem, crow::LogLevel::level))             \
+        ;                                                                                           \
+    else                                                                                            \
+        mkm::LogLine(mkm::LogSubsystem::subsystem, crow::LogLevel::level)
+
+#define MKM_LOG_DEBUG(subsystem) MKM_LOG(subsystem, DEBUG)
+#define MKM_LOG_INFO(subsystem) MKM_LOG(subsystem, INFO)
+#define MKM_LOG_WARNING(subsystem) MKM_LOG(subsystem, WARNING)
+#define MKM_LOG_ERROR(subsystem) MKM_LOG(subsystem, ERROR)
+#define MKM_LOG_CRITICAL(subsystem) MKM_LOG(subsystem, CRITICAL)
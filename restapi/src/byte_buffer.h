@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace mkm
+{
+/**
+ * @brief Read-only bytes that either own their storage or share it with whatever produced them,
+ * e.g. a libpq result, so that image data travels to the response without being copied.
+ * Copies are cheap: they share the same storage.
+ */
+class ByteBuffer
+{
+public:
+    ByteBuffer() = default;
+
+    static ByteBuffer own(std::string data)
+    {
+        auto storage = std::make_shared<const std::string>(std::move(data));
+        const std::string_view view(*storage);
+        return ByteBuffer(std::move(storage), view);
+    }
+
+    /**
+     * @brief Refer to data inside owner's memory, keeping owner alive as long as any copy exists
+     */
+    static ByteBuffer share(std::shared_ptr<const void> owner, std::string_view data)
+    {
+        return ByteBuffer(std::move(owner), data);
+    }
+
+    std::string_view view() const { return view_; }
+    const char* data() const { return view_.data(); }
+    size_t size() const { return view_.size(); }
+    bool empty() const { return view_.empty(); }
+
+private:
+    ByteBuffer(std::shared_ptr<const void> owner, std::string_view view)
+        : owner_(std::move(owner)), view_(view)
+    {
+    }
+
+    std::shared_ptr<const void> owner_;
+    std::string_view view_;
+};
+}   // namespace mkm
@@ -0,0 +1,239 @@
+#include "compression.h"
+#include "config_env.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+
+namespace mkm
+{
+    namespace
+    {
+        bool equals_ignoring_case(std::string_view a, std::string_view b)
+        {
+            return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+            });
+        }
+
+        bool starts_with_ignoring_case(std::string_view text, std::string_view prefix)
+        {
+            return text.size() >= prefix.size() && equals_ignoring_case(text.substr(0, prefix.size()), prefix);
+        }
+
+        std::string_view trim(std::string_view text)
+        {
+            const auto first = text.find_first_not_of(" \t");
+            if (first == std::string_view::npos)
+            {
+                return {};
+            }
+            return text.substr(first, text.find_last_not_of(" \t") - first + 1);
+        }
+
+        // "gzip;q=0.8" -> 0.8, a missing or unreadable q counts as 1
+        double quality(std::string_view parameters)
+        {
+            for (size_t start = 0; start < parameters.size();)
+            {
+                const size_t end = std::min(parameters.find(';', start), parameters.size());
+                const std::string_view parameter = trim(parameters.substr(start, end - start));
+                if (parameter.size() > 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=')
+                {
+                    char* parsed_end = nullptr;
+                    const std::string value(parameter.substr(2));
+                    const double q = std::strtod(value.c_str(), &parsed_end);
+                    return parsed_end == value.c_str() ? 1.0 : q;
+                }
+                start = end + 1;
+            }
+            return 1.0;
+        }
+
+        /**
+         * A thread's deflate streams, one per encoding, set up on first use and reset in between.
+         * Each holds about 256 KiB of zlib state, far less than setting it up per response costs.
+         */
+        class ThreadStreams
+        {
+        public:
+            ThreadStreams() = default;
+            ThreadStreams(const ThreadStreams&) = delete;
+            ThreadStreams& operator=(const ThreadStreams&) = delete;
+
+            ~ThreadStreams()
+            {
+                for (size_t i = 0; i < streams_.size(); i++)
+                {
+                    if (ready_[i])
+                    {
+                        deflateEnd(&streams_[i]);
+                    }
+                }
+            }
+
+            z_stream* acquire(ContentEncoding encoding, int level)
+            {
+                const size_t i = encoding == ContentEncoding::GZIP ? 0 : 1;
+                z_stream& stream = streams_[i];
+                if (!ready_[i])
+                {
+                    // 16 added to the window bits asks zlib for a gzip wrapper instead of a zlib one
+                    const int window_bits = encoding == ContentEncoding::GZIP ? 15 + 16 : 15;
+                    stream = z_stream{};
+                    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    {
+                        return nullptr;
+                    }
+                    ready_[i] = true;
+                    levels_[i] = level;
+                    return &stream;
+                }
+                if (deflateReset(&stream) != Z_OK)
+                {
+                    return nullptr;
+                }
+                if (levels_[i] != level)
+                {
+                    if (deflateParams(&stream, level, Z_DEFAULT_STRATEGY) != Z_OK)
+                    {
+                        return nullptr;
+                    }
+                    levels_[i] = level;
+                }
+                return &stream;
+            }
+
+        private:
+            std::array<z_stream, 2> streams_{};
+            std::array<bool, 2> ready_{};
+            std::array<int, 2> levels_{};
+        };
+    }
+
+    CompressionConfig CompressionConfig::from_env()
+    {
+        CompressionConfig config;
+        config.enabled = env_or("MKM_COMPRESSION", size_t{1}) != 0;
+        config.min_bytes = env_or("MKM_COMPRESSION_MIN_BYTES", config.min_bytes);
+        config.level = static_cast<int>(std::clamp<size_t>(env_or("MKM_COMPRESSION_LEVEL", static_cast<size_t>(config.level)), 1, 9));
+        return config;
+    }
+
+    const CompressionConfig& compression_config()
+    {
+        static const CompressionConfig config = CompressionConfig::from_env();
+        return config;
+    }
+
+    ContentEncoding negotiate_encoding(std::string_view accept_encoding)
+    {
+        double gzip = -1;
+        double deflate = -1;
+        double any = -1;
+        for (size_t start = 0; start < accept_encoding.size();)
+        {
+            const size_t end = std::min(accept_encoding.find(',', start), accept_encoding.size());
+            const std::string_view entry = accept_encoding.substr(start, end - start);
+            start = end + 1;
+
+            const size_t semicolon = std::min(entry.find(';'), entry.size());
+            const std::string_view coding = trim(entry.substr(0, semicolon));
+            const double q = quality(entry.substr(semicolon));
+            if (equals_ignoring_case(coding, "gzip") || equals_ignoring_case(coding, "x-gzip"))
+            {
+                gzip = q;
+            }
+            else if (equals_ignoring_case(coding, "deflate"))
+            {
+                deflate = q;
+            }
+            else if (coding == "*")
+            {
+                any = q;
+            }
+        }
+        // Codings the client didn't name are as acceptable as "*" says
+        if (gzip < 0)
+        {
+            gzip = any;
+        }
+        if (deflate < 0)
+        {
+            deflate = any;
+        }
+
+        if (gzip > 0 && gzip >= deflate)
+        {
+            return ContentEncoding::GZIP;
+        }
+        if (deflate > 0)
+        {
+            return ContentEncoding::DEFLATE;
+        }
+        return ContentEncoding::IDENTITY;
+    }
+
+    bool compressible_type(std::string_view content_type)
+    {
+        const std::string_view media_type = trim(content_type.substr(0, std::min(content_type.find(';'), content_type.size())));
+        if (starts_with_ignoring_case(media_type, "text/"))
+        {
+            return true;
+        }
+        for (const std::string_view type : {"application/json", "application/javascript", "application/xml", "image/svg+xml"})
+        {
+            if (equals_ignoring_case(media_type, type))
+            {
+                return true;
+            }
+        }
+        // application/problem+json and the like
+        const size_t plus = media_type.rfind('+');
+        return plus != std::string_view::npos
+            && (equals_ignoring_case(media_type.substr(plus), "+json") || equals_ignoring_case(media_type.substr(plus), "+xml"));
+    }
+
+    const char* encoding_name(ContentEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case ContentEncoding::GZIP:
+            return "gzip";
+        case ContentEncoding::DEFLATE:
+            return "deflate";
+        default:
+            return "identity";
+        }
+    }
+
+    bool compress(std::string_view input, ContentEncoding encoding, int level, std::string& output)
+    {
+        if (encoding == ContentEncoding::IDENTITY)
+        {
+            return false;
+        }
+        thread_local ThreadStreams streams;
+        z_stream* stream = streams.acquire(encoding, level);
+        if (stream == nullptr)
+        {
+            return false;
+        }
+
+        // deflateBound() is enough for a single Z_FINISH call
+        output.resize(deflateBound(stream, static_cast<uLong>(input.size())));
+        stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        stream->avail_in = static_cast<uInt>(input.size());
+        stream->next_out = reinterpret_cast<Bytef*>(output.data());
+        stream->avail_out = static_cast<uInt>(output.size());
+        if (deflate(stream, Z_FINISH) != Z_STREAM_END)
+        {
+            return false;
+        }
+        output.resize(stream->total_out);
+        return output.size() < input.size();
+    }
+}
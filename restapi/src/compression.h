@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace mkm
+{
+enum class ContentEncoding
+{
+    IDENTITY,
+    GZIP,
+    DEFLATE
+};
+
+struct CompressionConfig
+{
+    bool enabled = true;
+    // Smaller bodies fit in a packet or two anyway and aren't worth the CPU
+    size_t min_bytes = 1024;
+    // zlib level, 1 (fastest) to 9 (smallest). Higher levels shave little off JSON listings for
+    // several times the CPU.
+    int level = 1;
+
+    /**
+     * @brief MKM_COMPRESSION, MKM_COMPRESSION_MIN_BYTES, MKM_COMPRESSION_LEVEL
+     */
+    static CompressionConfig from_env();
+};
+
+const CompressionConfig& compression_config();
+
+/**
+ * @brief Pick the encoding for a response from the request's Accept-Encoding, honouring q-values.
+ * gzip wins over deflate when the client rates them the same.
+ */
+ContentEncoding negotiate_encoding(std::string_view accept_encoding);
+
+/**
+ * @brief Whether bodies of this Content-Type are worth compressing: JSON and text are, images and
+ * other already compressed media are not
+ */
+bool compressible_type(std::string_view content_type);
+
+const char* encoding_name(ContentEncoding encoding);
+
+/**
+ * @brief Compress input with the calling thread's zlib stream for that encoding, which is reset
+ * and reused rather than set up for every response
+ * @return false, output unspecified, if zlib failed or the result isn't smaller than input
+ */
+bool compress(std::string_view input, ContentEncoding encoding, int level, std::string& output);
+}   // namespace mkm
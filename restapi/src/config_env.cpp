@@ -0,0 +1,54 @@
+#include "config_env.h"
+#include "async_log.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+
+namespace mkm
+{
+    namespace
+    {
+        template<typename T, typename Parse>
+        T parse_env(const char* name, T default_value, EnvWarnings warnings, Parse parse)
+        {
+            const char* value = std::getenv(name);
+            if (value == nullptr || *value == '\0')
+            {
+                return default_value;
+            }
+            try
+            {
+                return parse(value);
+            }
+            catch (const std::exception&)
+            {
+                if (warnings == EnvWarnings::STDERR)
+                {
+                    std::fprintf(stderr, "Ignoring invalid value for %s: %s\n", name, value);
+                }
+                else
+                {
+                    MKM_LOG_WARNING(CORE) << "Ignoring invalid value for " << name << ": " << value;
+                }
+                return default_value;
+            }
+        }
+    }
+
+    size_t env_or(const char* name, size_t default_value, EnvWarnings warnings)
+    {
+        return parse_env(name, default_value, warnings, [](const char* value) -> size_t { return std::stoull(value); });
+    }
+
+    double env_or(const char* name, double default_value, EnvWarnings warnings)
+    {
+        return parse_env(name, default_value, warnings, [](const char* value) { return std::stod(value); });
+    }
+
+    std::string env_or(const char* name, std::string default_value)
+    {
+        const char* value = std::getenv(name);
+        return value == nullptr || *value == '\0' ? std::move(default_value) : std::string(value);
+    }
+}
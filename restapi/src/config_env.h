@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace mkm
+{
+// Where env_or() reports a value it can't parse. The logger reads its own settings while
+// async_log() is being constructed, so it can't log through itself and writes to stderr instead.
+enum class EnvWarnings
+{
+    LOG,
+    STDERR
+};
+
+/**
+ * @brief Value of an MKM_* environment variable, or default_value if it is unset or empty. A value
+ * that doesn't parse is reported as a warning and the default used instead.
+ */
+size_t env_or(const char* name, size_t default_value, EnvWarnings warnings = EnvWarnings::LOG);
+double env_or(const char* name, double default_value, EnvWarnings warnings = EnvWarnings::LOG);
+std::string env_or(const char* name, std::string default_value);
+}   // namespace mkm
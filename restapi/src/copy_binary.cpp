@@ -0,0 +1,105 @@
+#include "copy_binary.h"
+
+namespace mkm
+{
+    namespace
+    {
+        // Signature, then flags and header extension length, both 0
+        constexpr char COPY_HEADER[] = "PGCOPY\n\377\r\n\0\0\0\0\0\0\0\0\0";
+        constexpr size_t COPY_HEADER_LENGTH = sizeof(COPY_HEADER) - 1;
+
+        // Postgres counts dates from 2000-01-01
+        constexpr EpochDays POSTGRES_EPOCH_DAYS = 10957;
+
+        constexpr int32_t TEXT_OID = 25;
+    }
+
+    void CopyBinaryWriter::header()
+    {
+        out_.append(COPY_HEADER, COPY_HEADER_LENGTH);
+    }
+
+    void CopyBinaryWriter::begin_row(int16_t values)
+    {
+        int16(values);
+    }
+
+    void CopyBinaryWriter::trailer()
+    {
+        int16(-1);
+    }
+
+    void CopyBinaryWriter::null()
+    {
+        int32(-1);
+    }
+
+    void CopyBinaryWriter::text(std::string_view value)
+    {
+        int32(static_cast<int32_t>(value.size()));
+        out_.append(value);
+    }
+
+    void CopyBinaryWriter::date(EpochDays days)
+    {
+        int32(4);
+        int32(days - POSTGRES_EPOCH_DAYS);
+    }
+
+    void CopyBinaryWriter::begin_text_array()
+    {
+        array_start_ = out_.size();
+        array_elements_ = 0;
+        int32(0);   // value length, patched by end_text_array()
+        // Dimensions, has-NULLs flag, element type, then the one dimension's size and lower bound
+        int32(1);
+        int32(0);
+        int32(TEXT_OID);
+        int32(0);   // element count, patched as well
+        int32(1);
+    }
+
+    void CopyBinaryWriter::text_array_element(std::string_view value)
+    {
+        text(value);
+        ++array_elements_;
+    }
+
+    void CopyBinaryWriter::end_text_array()
+    {
+        // An empty array is written with no dimensions at all, as array_send() does
+        if (array_elements_ == 0)
+        {
+            out_.resize(array_start_);
+            int32(12);
+            int32(0);
+            int32(0);
+            int32(TEXT_OID);
+            return;
+        }
+        patch_int32(array_start_, static_cast<int32_t>(out_.size() - array_start_ - 4));
+        patch_int32(array_start_ + 4 + 3 * 4, array_elements_);
+    }
+
+    void CopyBinaryWriter::int16(int16_t value)
+    {
+        const auto bits = static_cast<uint16_t>(value);
+        const char bytes[] = {static_cast<char>(bits >> 8), static_cast<char>(bits)};
+        out_.append(bytes, sizeof(bytes));
+    }
+
+    void CopyBinaryWriter::int32(int32_t value)
+    {
+        out_.append(4, '\0');
+        patch_int32(out_.size() - 4, value);
+    }
+
+    void CopyBinaryWriter::patch_int32(size_t at, int32_t value)
+    {
+        const auto bits = static_cast<uint32_t>(value);
+        out_[at] = static_cast<char>(bits >> 24);
+        out_[at + 1] = static_cast<char>(bits >> 16);
+        out_[at + 2] = static_cast<char>(bits >> 8);
+        out_[at + 3] = static_cast<char>(bits);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "epoch_time.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace mkm
+{
+/**
+ * @brief Encodes rows for "COPY ... FROM STDIN (FORMAT binary)", appending to a buffer that is sent
+ * to the server as it is. Every value goes in its on-disk form, so the server neither parses text
+ * nor looks up input functions per row, and text needs no escaping.
+ *
+ * Write header(), then each row as begin_row() followed by exactly that many values, then trailer().
+ * The encoder doesn't check types: values must match the columns of the COPY statement in order.
+ * References:
+ * [1] https://www.postgresql.org/docs/14/sql-copy.html#id-1.9.3.55.9.4
+ */
+class CopyBinaryWriter
+{
+public:
+    explicit CopyBinaryWriter(std::string& out) : out_(out) {}
+
+    void header();
+    void begin_row(int16_t values);
+    void trailer();
+
+    void null();
+    // text and varchar, which must be valid in the server encoding and free of NUL bytes
+    void text(std::string_view value);
+    void date(EpochDays days);
+
+    /**
+     * @brief A one-dimensional text[] without NULL elements: begin_text_array(), one
+     * text_array_element() per element, end_text_array()
+     */
+    void begin_text_array();
+    void text_array_element(std::string_view value);
+    void end_text_array();
+
+private:
+    void int16(int16_t value);
+    void int32(int32_t value);
+    void patch_int32(size_t at, int32_t value);
+
+    std::string& out_;
+    // Where the open array's length and element count go once they are known
+    size_t array_start_ = 0;
+    int32_t array_elements_ = 0;
+};
+}   // namespace mkm
@@ -0,0 +1,238 @@
+#include "db_pool.h"
+#include "async_log.h"
+#include "config_env.h"
+#include "db_statements.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace mkm
+{
+    namespace
+    {
+        PGconn* connect_raw(const std::string& conninfo)
+        {
+            PGconn* raw = PQconnectdb(conninfo.c_str());
+            if (raw == nullptr)
+            {
+                throw pqxx::broken_connection("Out of memory connecting to the database");
+            }
+            if (PQstatus(raw) != CONNECTION_OK)
+            {
+                std::string message = PQerrorMessage(raw);
+                PQfinish(raw);
+                throw pqxx::broken_connection(message);
+            }
+            return raw;
+        }
+    }
+
+    DbConnection::DbConnection(const std::string& conninfo)
+        : DbConnection(connect_raw(conninfo))
+    {
+    }
+
+    DbConnection::DbConnection(PGconn* raw)
+        : pqxx::connection(pqxx::connection::seize_raw_connection(raw))
+        , raw_(raw)
+    {
+    }
+
+    PoolConfig PoolConfig::from_env()
+    {
+        PoolConfig config;
+        config.conninfo = env_or("MKM_DB_CONNINFO", config.conninfo);
+        config.max_size = std::max<size_t>(1, env_or("MKM_DB_POOL_MAX", config.max_size));
+        config.min_size = std::min(config.max_size, env_or("MKM_DB_POOL_MIN", config.min_size));
+        config.checkout_timeout = std::chrono::milliseconds(
+            env_or("MKM_DB_POOL_TIMEOUT_MS", static_cast<size_t>(config.checkout_timeout.count())));
+        config.health_check_after = std::chrono::milliseconds(
+            env_or("MKM_DB_POOL_HEALTH_CHECK_MS", static_cast<size_t>(config.health_check_after.count())));
+        return config;
+    }
+
+    PooledConnection::PooledConnection(ConnectionPool* pool, std::unique_ptr<DbConnection> conn)
+        : pool_(pool), conn_(std::move(conn))
+    {
+    }
+
+    PooledConnection::PooledConnection(PooledConnection&& other) noexcept
+        : pool_(std::exchange(other.pool_, nullptr)), conn_(std::move(other.conn_))
+    {
+    }
+
+    PooledConnection& PooledConnection::operator=(PooledConnection&& other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            pool_ = std::exchange(other.pool_, nullptr);
+            conn_ = std::move(other.conn_);
+        }
+        return *this;
+    }
+
+    PooledConnection::~PooledConnection()
+    {
+        release();
+    }
+
+    void PooledConnection::release()
+    {
+        if (pool_ != nullptr && conn_)
+        {
+            pool_->give_back(std::move(conn_));
+        }
+        pool_ = nullptr;
+    }
+
+    ConnectionPool::ConnectionPool(PoolConfig config)
+        : config_(std::move(config))
+    {
+        idle_.reserve(config_.max_size);
+        // Pre-open min_size connections so the first requests don't pay for the handshake.
+        // The database may not be up yet - acquire() will keep retrying lazily in that case.
+        for (size_t i = 0; i < config_.min_size; i++)
+        {
+            try
+            {
+                idle_.push_back({open_connection(), std::chrono::steady_clock::now()});
+                total_++;
+            }
+            catch (const std::exception& e)
+            {
+                MKM_LOG_ERROR(DB) << "Could not pre-open database connection: " << e.what();
+                break;
+            }
+        }
+    }
+
+    PooledConnection ConnectionPool::acquire()
+    {
+        const auto started = std::chrono::steady_clock::now();
+        const auto deadline = started + config_.checkout_timeout;
+        std::unique_lock lock(mutex_);
+        while (true)
+        {
+            if (!idle_.empty())
+            {
+                // LIFO - keeps the hottest connections busy and lets the rest go stale together
+                IdleConnection candidate = std::move(idle_.back());
+                idle_.pop_back();
+                lock.unlock();
+
+                const bool needs_check =
+                    std::chrono::steady_clock::now() - candidate.last_used >= config_.health_check_after;
+                if (candidate.conn->is_open() && (!needs_check || is_healthy(*candidate.conn)))
+                {
+                    metrics().pool_checkout(std::chrono::steady_clock::now() - started, false);
+                    return PooledConnection(this, std::move(candidate.conn));
+                }
+
+                MKM_LOG_WARNING(DB) << "Dropping dead database connection from pool";
+                candidate.conn.reset();
+                lock.lock();
+                total_--;
+                continue;
+            }
+
+            if (total_ < config_.max_size)
+            {
+                total_++;
+                lock.unlock();
+                try
+                {
+                    PooledConnection conn(this, open_connection());
+                    metrics().pool_checkout(std::chrono::steady_clock::now() - started, false);
+                    return conn;
+                }
+                catch (...)
+                {
+                    lock.lock();
+                    total_--;
+                    available_.notify_one();
+                    throw;
+                }
+            }
+
+            if (available_.wait_until(lock, deadline) == std::cv_status::timeout && idle_.empty()
+                && total_ >= config_.max_size)
+            {
+                metrics().pool_checkout(std::chrono::steady_clock::now() - started, true);
+                throw pool_timeout("Timed out waiting for a database connection");
+            }
+        }
+    }
+
+    size_t ConnectionPool::size() const
+    {
+        std::lock_guard lock(mutex_);
+        return total_;
+    }
+
+    size_t ConnectionPool::idle() const
+    {
+        std::lock_guard lock(mutex_);
+        return idle_.size();
+    }
+
+    std::unique_ptr<DbConnection> ConnectionPool::open_connection()
+    {
+        auto conn = std::make_unique<DbConnection>(config_.conninfo);
+        if (config_.on_connect)
+        {
+            config_.on_connect(*conn);
+        }
+        return conn;
+    }
+
+    bool ConnectionPool::is_healthy(pqxx::connection& conn)
+    {
+        try
+        {
+            pqxx::nontransaction ping(conn);
+            ping.exec("SELECT 1");
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            MKM_LOG_WARNING(DB) << "Database connection failed health check: " << e.what();
+            return false;
+        }
+    }
+
+    void ConnectionPool::give_back(std::unique_ptr<DbConnection> conn)
+    {
+        // A connection whose backend died reports itself closed - drop it so that the
+        // next checkout reconnects instead of handing out a dead socket
+        const bool reusable = conn->is_open();
+        if (!reusable)
+        {
+            conn.reset();
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            if (reusable)
+            {
+                idle_.push_back({std::move(conn), std::chrono::steady_clock::now()});
+            }
+            else
+            {
+                total_--;
+            }
+        }
+        available_.notify_one();
+    }
+
+    ConnectionPool& db_pool()
+    {
+        static ConnectionPool pool([] {
+            auto config = PoolConfig::from_env();
+            config.on_connect = prepare_statements;
+            return config;
+        }());
+        return pool;
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <libpq-fe.h>
+#include <pqxx/pqxx>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mkm
+{
+struct PoolConfig
+{
+    std::string conninfo = "dbname=mkm_db user=mkm_user password=momentos hostaddr=127.0.0.1 port=5432";
+    size_t min_size = 2;
+    size_t max_size = 16;
+    std::chrono::milliseconds checkout_timeout{5000};
+    // Idle connections older than this are pinged before being handed out again
+    std::chrono::milliseconds health_check_after{30000};
+    // Runs once on every newly opened connection, e.g. to prepare statements
+    std::function<void(pqxx::connection&)> on_connect;
+
+    /**
+     * @brief Build a config from MKM_DB_CONNINFO, MKM_DB_POOL_MIN, MKM_DB_POOL_MAX,
+     * MKM_DB_POOL_TIMEOUT_MS and MKM_DB_POOL_HEALTH_CHECK_MS, falling back to the defaults above
+     */
+    static PoolConfig from_env();
+};
+
+/**
+ * @brief Thrown when no connection could be checked out within PoolConfig::checkout_timeout
+ */
+class pool_timeout : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class ConnectionPool;
+
+/**
+ * @brief libpqxx connection that also keeps the libpq handle underneath it, for the few queries
+ * libpqxx 7 can't express - it only ever asks for text-format results.
+ */
+class DbConnection : public pqxx::connection
+{
+public:
+    /**
+     * @throws pqxx::broken_connection if the connection cannot be established
+     */
+    explicit DbConnection(const std::string& conninfo);
+
+    // Owned by the pqxx::connection - never PQfinish() it
+    PGconn* raw() const { return raw_; }
+
+private:
+    explicit DbConnection(PGconn* raw);
+
+    PGconn* raw_;
+};
+
+/**
+ * @brief RAII handle for a checked out connection, returned to the pool on destruction.
+ * Connections whose backend went away are dropped instead of being returned.
+ */
+class PooledConnection
+{
+public:
+    PooledConnection(PooledConnection&& other) noexcept;
+    PooledConnection& operator=(PooledConnection&& other) noexcept;
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+    ~PooledConnection();
+
+    DbConnection& operator*() const { return *conn_; }
+    DbConnection* operator->() const { return conn_.get(); }
+
+private:
+    friend class ConnectionPool;
+    PooledConnection(ConnectionPool* pool, std::unique_ptr<DbConnection> conn);
+    void release();
+
+    ConnectionPool* pool_;
+    std::unique_ptr<DbConnection> conn_;
+};
+
+/**
+ * @brief Bounded, thread-safe pool of long-lived PostgreSQL connections shared by all Crow workers
+ */
+class ConnectionPool
+{
+public:
+    explicit ConnectionPool(PoolConfig config);
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * @brief Check out a connection, opening a new one if the pool is below max_size
+     * @throws pool_timeout if every connection stays busy for checkout_timeout
+     * @throws pqxx::broken_connection if a new connection cannot be established
+     */
+    PooledConnection acquire();
+
+    size_t size() const;
+    size_t idle() const;
+    const PoolConfig& config() const { return config_; }
+
+private:
+    friend class PooledConnection;
+
+    struct IdleConnection
+    {
+        std::unique_ptr<DbConnection> conn;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    std::unique_ptr<DbConnection> open_connection();
+    bool is_healthy(pqxx::connection& conn);
+    void give_back(std::unique_ptr<DbConnection> conn);
+
+    const PoolConfig config_;
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::vector<IdleConnection> idle_;
+    size_t total_ = 0;
+};
+
+/**
+ * @brief Process-wide pool, created from PoolConfig::from_env() on first use.
+ * Its connections have the statements of db_statements.h prepared.
+ */
+ConnectionPool& db_pool();
+}   // namespace mkm
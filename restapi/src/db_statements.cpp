@@ -0,0 +1,182 @@
+#include "db_statements.h"
+
+#include <memory>
+
+namespace mkm
+{
+    namespace
+    {
+// Listings carry metadata only - image bytes are served by the image endpoint. Dates come as
+// numbers (days and microseconds since the epoch) so that rows map without parsing text.
+#define MOMENT_LIST_COLUMNS \
+    "id, username, title, description, (moment_date - DATE '1970-01-01') AS moment_days, image_filename, " \
+    "image_path, thumbnail_path, preview_path, derivative_status, image_caption, feelings, " \
+    "(extract(epoch FROM created_date) * 1000000)::bigint AS created_us, " \
+    "(extract(epoch FROM last_modified_date) * 1000000)::bigint AS last_modified_us"
+
+        struct Statement
+        {
+            const char* name;
+            const char* sql;
+        };
+
+        // Parameters are always bound, never spliced into the SQL text, so each statement
+        // is parsed and planned once per connection instead of once per request.
+        // References:
+        // [1] https://libpqxx.readthedocs.io/en/stable/prepared.html
+        constexpr Statement statements[] = {
+            {stmt::USER_BY_NAME,
+                "SELECT username, password_hash, fullname, birthdate, emailid, account_creation_time "
+                "FROM users WHERE username=$1"},
+            // $5 is already a bcrypt hash - hashing happens on the hashing pool, not in Postgres
+            {stmt::USER_INSERT,
+                "INSERT INTO users(username, fullname, birthdate, emailid, password_hash, account_creation_time) "
+                "VALUES($1, $2, $3, $4, $5, now())"},
+            {stmt::MOMENT_INSERT,
+                "INSERT INTO moments(username, title, description, moment_date, image_filename, image_path, image_caption, feelings, derivative_status) "
+                "VALUES($1, $2, $3, $4, $5, $6::text, $7, $8, CASE WHEN $6::text IS NULL THEN 0 ELSE 1 END) "
+                "RETURNING id"},
+            // NULL parameters leave the corresponding column untouched
+            {stmt::MOMENT_UPDATE,
+                "UPDATE moments SET "
+                "title=COALESCE($3, title), "
+                "description=COALESCE($4, description), "
+                "moment_date=COALESCE($5::date, moment_date), "
+                "feelings=COALESCE($6, feelings), "
+                "image_path=COALESCE($7::text, image_path), "
+                // A replaced image no longer needs its pre-image-store bytea copy
+                "image_data=CASE WHEN $7::text IS NULL THEN image_data END, "
+                "thumbnail_path=CASE WHEN $7::text IS NULL THEN thumbnail_path END, "
+                "preview_path=CASE WHEN $7::text IS NULL THEN preview_path END, "
+                "derivative_status=CASE WHEN $7::text IS NULL THEN derivative_status ELSE 1 END, "
+                "image_filename=COALESCE($8, image_filename), "
+                "image_caption=COALESCE($9, image_caption), "
+                "last_modified_date=NOW() "
+                "WHERE username=$1 AND id=$2 "
+                "RETURNING id"},
+            {stmt::MOMENT_DELETE,
+                "DELETE FROM moments WHERE username=$1 AND id=$2"},
+            // Batches take their ids as one bigint[] and return those that matched, so that a
+            // batch is one statement - and one trigger run - however many moments it names.
+            // Images are only changed one moment at a time, see MOMENT_UPDATE.
+            {stmt::MOMENTS_UPDATE_BATCH,
+                "UPDATE moments SET "
+                "title=COALESCE($3, title), "
+                "description=COALESCE($4, description), "
+                "moment_date=COALESCE($5::date, moment_date), "
+                "feelings=COALESCE($6, feelings), "
+                "image_caption=COALESCE($7, image_caption), "
+                "last_modified_date=NOW() "
+                "WHERE username=$1 AND id = ANY($2::bigint[]) "
+                "RETURNING id"},
+            {stmt::MOMENTS_DELETE_BATCH,
+                "DELETE FROM moments WHERE username=$1 AND id = ANY($2::bigint[]) RETURNING id"},
+            // Maintained by triggers on moments, so this is a single-row lookup however many moments a user has
+            {stmt::MOMENT_COUNT,
+                "SELECT moment_count AS total_moments FROM users WHERE username=$1"},
+            // id breaks ties between moments created in the same instant, so that OFFSET
+            // and keyset pages agree on one total order
+            {stmt::MOMENTS_PAGE_ASC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 "
+                "ORDER BY created_date ASC, id ASC OFFSET $2 LIMIT $3"},
+            {stmt::MOMENTS_PAGE_DESC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 "
+                "ORDER BY created_date DESC, id DESC OFFSET $2 LIMIT $3"},
+            // Search terms arrive as a tsquery string built by db_utils and use the GIN index over
+            // the generated search_vector column (title, description and caption)
+            {stmt::MOMENTS_SEARCH_PAGE_ASC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND search_vector @@ to_tsquery('simple', $4) "
+                "ORDER BY created_date ASC, id ASC OFFSET $2 LIMIT $3"},
+            {stmt::MOMENTS_SEARCH_PAGE_DESC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND search_vector @@ to_tsquery('simple', $4) "
+                "ORDER BY created_date DESC, id DESC OFFSET $2 LIMIT $3"},
+            // Best matches first. The rank of the last row is the keyset position for the next page,
+            // with id breaking ties; Postgres prints real values so that they read back exactly.
+            {stmt::MOMENTS_SEARCH_RANKED_PAGE,
+                "SELECT " MOMENT_LIST_COLUMNS ", ts_rank_cd(search_vector, query) AS rank "
+                "FROM moments, to_tsquery('simple', $4) AS query WHERE username=$1 AND search_vector @@ query "
+                "ORDER BY rank DESC, id DESC OFFSET $2 LIMIT $3"},
+            {stmt::MOMENTS_SEARCH_RANKED_BEFORE,
+                "SELECT " MOMENT_LIST_COLUMNS ", ts_rank_cd(search_vector, query) AS rank "
+                "FROM moments, to_tsquery('simple', $5) AS query WHERE username=$1 AND search_vector @@ query "
+                "AND (ts_rank_cd(search_vector, query), id) < ($2::real, $3) "
+                "ORDER BY rank DESC, id DESC LIMIT $4"},
+            // Keyset pages seek past the last (created_date, id) of the previous page using
+            // the (user, created_date, id) index instead of scanning and discarding OFFSET rows
+            {stmt::MOMENTS_AFTER_ASC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND (created_date, id) > ($2::timestamptz, $3) "
+                "ORDER BY created_date ASC, id ASC LIMIT $4"},
+            {stmt::MOMENTS_BEFORE_DESC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND (created_date, id) < ($2::timestamptz, $3) "
+                "ORDER BY created_date DESC, id DESC LIMIT $4"},
+            {stmt::MOMENTS_SEARCH_AFTER_ASC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND (created_date, id) > ($2::timestamptz, $3) "
+                "AND search_vector @@ to_tsquery('simple', $5) "
+                "ORDER BY created_date ASC, id ASC LIMIT $4"},
+            {stmt::MOMENTS_SEARCH_BEFORE_DESC,
+                "SELECT " MOMENT_LIST_COLUMNS " FROM moments WHERE username=$1 AND (created_date, id) < ($2::timestamptz, $3) "
+                "AND search_vector @@ to_tsquery('simple', $5) "
+                "ORDER BY created_date DESC, id DESC LIMIT $4"},
+            // image_data is fetched separately, in binary format, and only for images that predate the store
+            {stmt::MOMENT_DETAILS,
+                "SELECT " MOMENT_LIST_COLUMNS ", image_data IS NOT NULL AS has_legacy_image "
+                "FROM moments WHERE username=$1 AND id=$2"},
+            {stmt::MOMENT_IMAGE_DATA,
+                "SELECT image_data FROM moments WHERE username=$1 AND id=$2"},
+            // Validators for conditional GETs - see validator_cache.h
+            {stmt::MOMENTS_VALIDATOR,
+                "SELECT moments_version, (extract(epoch FROM moments_modified) * 1000000)::bigint AS modified_us "
+                "FROM users WHERE username=$1"},
+            // Details change with user edits and with finished derivatives; greatest() skips a NULL derivatives_date
+            {stmt::MOMENT_VALIDATOR,
+                "SELECT (extract(epoch FROM greatest(last_modified_date, derivatives_date)) * 1000000)::bigint AS modified_us "
+                "FROM moments WHERE username=$1 AND id=$2"},
+            {stmt::MOMENT_IMAGE_INFO,
+                "SELECT image_filename, image_path, thumbnail_path, preview_path, octet_length(image_data) AS legacy_size, "
+                "(extract(epoch FROM last_modified_date) * 1000000)::bigint AS modified_us "
+                "FROM moments WHERE username=$1 AND id=$2"},
+            // Images stored before the image store existed are still read from image_data.
+            // substring() on bytea is 1-based and only detoasts the requested slice.
+            // Both image_data statements are executed with binary results - see db_utils.cpp
+            {stmt::MOMENT_IMAGE_CHUNK,
+                "SELECT substring(image_data FROM $3 FOR $4) AS image_chunk "
+                "FROM moments WHERE username=$1 AND id=$2"},
+            // Oldest first, so that a backlog drains in upload order
+            {stmt::DERIVATIVES_PENDING,
+                "SELECT username, id, image_path FROM moments "
+                "WHERE derivative_status=1 AND image_path IS NOT NULL "
+                "ORDER BY last_modified_date LIMIT $1"},
+            // Matching on image_path drops results for an image that was replaced meanwhile.
+            // Not a user edit, so last_modified_date stays as it is; derivatives_date moves the
+            // validator of the moment's details instead.
+            {stmt::DERIVATIVES_SET,
+                "UPDATE moments SET thumbnail_path=$4, preview_path=$5, derivative_status=$6, derivatives_date=NOW() "
+                "WHERE username=$1 AND id=$2 AND image_path=$3"},
+            // Interned by feeling_dictionary() at startup
+            {stmt::FEELINGS,
+                "SELECT name FROM feelings ORDER BY name"},
+        };
+
+#undef MOMENT_LIST_COLUMNS
+    }
+
+    void prepare_statements(pqxx::connection& conn)
+    {
+        for (const auto& statement : statements)
+        {
+            conn.prepare(statement.name, statement.sql);
+        }
+    }
+
+    void prepare_statements(PGconn* conn)
+    {
+        for (const auto& statement : statements)
+        {
+            std::unique_ptr<PGresult, decltype(&PQclear)> result(PQprepare(conn, statement.name, statement.sql, 0, nullptr), PQclear);
+            if (PQresultStatus(result.get()) != PGRES_COMMAND_OK)
+            {
+                throw pqxx::sql_error(PQerrorMessage(conn), statement.sql);
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <libpq-fe.h>
+#include <pqxx/pqxx>
+
+namespace mkm
+{
+/**
+ * @brief Names of the prepared statements registered on every pooled connection.
+ * The SQL for each lives in db_statements.cpp.
+ */
+namespace stmt
+{
+constexpr const char* USER_BY_NAME = "user_by_name";
+constexpr const char* USER_INSERT = "user_insert";
+constexpr const char* MOMENT_INSERT = "moment_insert";
+constexpr const char* MOMENT_UPDATE = "moment_update";
+constexpr const char* MOMENT_DELETE = "moment_delete";
+constexpr const char* MOMENTS_UPDATE_BATCH = "moments_update_batch";
+constexpr const char* MOMENTS_DELETE_BATCH = "moments_delete_batch";
+constexpr const char* MOMENT_COUNT = "moment_count";
+constexpr const char* MOMENTS_PAGE_ASC = "moments_page_asc";
+constexpr const char* MOMENTS_PAGE_DESC = "moments_page_desc";
+constexpr const char* MOMENTS_SEARCH_PAGE_ASC = "moments_search_page_asc";
+constexpr const char* MOMENTS_SEARCH_PAGE_DESC = "moments_search_page_desc";
+constexpr const char* MOMENTS_SEARCH_RANKED_PAGE = "moments_search_ranked_page";
+constexpr const char* MOMENTS_SEARCH_RANKED_BEFORE = "moments_search_ranked_before";
+constexpr const char* MOMENTS_AFTER_ASC = "moments_after_asc";
+constexpr const char* MOMENTS_BEFORE_DESC = "moments_before_desc";
+constexpr const char* MOMENTS_SEARCH_AFTER_ASC = "moments_search_after_asc";
+constexpr const char* MOMENTS_SEARCH_BEFORE_DESC = "moments_search_before_desc";
+constexpr const char* MOMENT_DETAILS = "moment_details";
+constexpr const char* MOMENT_IMAGE_DATA = "moment_image_data";
+constexpr const char* MOMENTS_VALIDATOR = "moments_validator";
+constexpr const char* MOMENT_VALIDATOR = "moment_validator";
+constexpr const char* MOMENT_IMAGE_INFO = "moment_image_info";
+constexpr const char* MOMENT_IMAGE_CHUNK = "moment_image_chunk";
+constexpr const char* DERIVATIVES_PENDING = "derivatives_pending";
+constexpr const char* DERIVATIVES_SET = "derivatives_set";
+constexpr const char* FEELINGS = "feelings";
+}   // namespace stmt
+
+/**
+ * @brief Prepare every statement of the registry on a freshly opened connection
+ */
+void prepare_statements(pqxx::connection& conn);
+
+/**
+ * @brief Same, for a bare libpq connection. Must run before the connection is made non-blocking.
+ * @throws pqxx::sql_error if a statement is rejected
+ */
+void prepare_statements(PGconn* conn);
+}   // namespace mkm
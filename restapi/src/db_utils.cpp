@@ -1,19 +1,537 @@
 #include "db_utils.h"
-#include <crow/logging.h>
+#include "async_db.h"
+#include "async_log.h"
+#include "copy_binary.h"
+#include "db_pool.h"
+#include "db_statements.h"
+#include "derivatives.h"
+#include "epoch_time.h"
+#include "image_store.h"
+#include "metrics.h"
+#include "moment_count_cache.h"
+#include "moment_detail_cache.h"
+#include "moment_rows.h"
+#include "request_arena.h"
+#include "single_flight.h"
+#include "tracing.h"
+#include <crow/utility.h>
+#include <libpq-fe.h>
 #include <pqxx/pqxx>
+#include <asio.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 namespace mkm
 {
+    namespace
+    {
+        // Empty strings mean "not provided" for optional columns - bind them as NULL
+        std::optional<std::string_view> null_if_empty(std::string_view value)
+        {
+            if (value.empty())
+            {
+                return std::nullopt;
+            }
+            return value;
+        }
+
+        // Feelings are bound by name, as the text[] column stores them
+        std::optional<std::vector<std::string>> feelings_or_null(const FeelingSet& feelings)
+        {
+            if (feelings.empty())
+            {
+                return std::nullopt;
+            }
+            return feeling_dictionary().names(feelings);
+        }
+
+        std::optional<std::string> date_or_null(EpochDays date)
+        {
+            if (date == NO_DATE)
+            {
+                return std::nullopt;
+            }
+            return format_date(date);
+        }
+
+        // Writes uploaded bytes to the image store. Returns the hash to keep in image_path, or the
+        // already stored hash the caller passed in, or NULL for moments without an image.
+        std::optional<std::string> store_image(const Moment& moment)
+        {
+            if (!moment.image_content.empty())
+            {
+                return image_store().put(moment.image_content.view()).hash;
+            }
+            if (!moment.image_path.empty())
+            {
+                return std::string(moment.image_path);
+            }
+            return std::nullopt;
+        }
+
+        using PgResult = std::shared_ptr<PGresult>;
+
+        /**
+         * Run a prepared statement inside conn's current transaction, asking libpq for binary
+         * results. libpqxx 7 only reads text results, in which a bytea travels hex-encoded at twice
+         * its size and has to be decoded again. Parameters still go as text.
+         */
+        PgResult exec_prepared_binary(DbConnection& conn, const char* statement, const std::vector<std::string>& params)
+        {
+            std::vector<const char*> values;
+            values.reserve(params.size());
+            for (const auto& param : params)
+            {
+                values.push_back(param.c_str());
+            }
+            return timed_query(statement, [&] {
+                PgResult result(PQexecPrepared(conn.raw(), statement, static_cast<int>(values.size()), values.data(),
+                                               nullptr, nullptr, 1),
+                                PQclear);
+                if (!result || PQresultStatus(result.get()) != PGRES_TUPLES_OK)
+                {
+                    throw pqxx::sql_error(result ? PQresultErrorMessage(result.get()) : PQerrorMessage(conn.raw()), statement);
+                }
+                return result;
+            });
+        }
+
+        // COPY can't be prepared, so it's named here for the query metrics
+        constexpr const char* MOMENTS_IMPORT = "moments_import";
+        // Imported moments have no image, so these columns are all they need
+        constexpr const char* MOMENTS_IMPORT_COPY =
+            "COPY moments(username, title, description, moment_date, feelings) FROM STDIN (FORMAT binary)";
+        constexpr int16_t MOMENTS_IMPORT_COLUMNS = 5;
+        // Data handed to libpq per PQputCopyData() call
+        constexpr size_t COPY_CHUNK_BYTES = 256 * 1024;
+
+        /**
+         * Run "COPY ... FROM STDIN" inside conn's current transaction and send it data, already in
+         * the COPY's format. libpqxx 7 streams text-format COPY only.
+         */
+        void copy_in(DbConnection& conn, const char* statement, std::string_view data)
+        {
+            PGconn* raw = conn.raw();
+            {
+                std::unique_ptr<PGresult, decltype(&PQclear)> result(PQexec(raw, statement), PQclear);
+                if (PQresultStatus(result.get()) != PGRES_COPY_IN)
+                {
+                    throw pqxx::sql_error(result ? PQresultErrorMessage(result.get()) : PQerrorMessage(raw), statement);
+                }
+            }
+            bool sent = true;
+            for (size_t offset = 0; sent && offset < data.size(); offset += COPY_CHUNK_BYTES)
+            {
+                const size_t length = std::min(COPY_CHUNK_BYTES, data.size() - offset);
+                sent = PQputCopyData(raw, data.data() + offset, static_cast<int>(length)) == 1;
+            }
+            std::string error = sent ? std::string() : PQerrorMessage(raw);
+            // A COPY that couldn't be sent whole is ended as failed, which leaves the transaction aborted
+            if (PQputCopyEnd(raw, sent ? nullptr : "incomplete data") != 1 && error.empty())
+            {
+                error = PQerrorMessage(raw);
+            }
+            // The COPY's outcome, read to the end so that the connection is usable again
+            while (PGresult* result = PQgetResult(raw))
+            {
+                if (PQresultStatus(result) != PGRES_COMMAND_OK && error.empty())
+                {
+                    error = PQresultErrorMessage(result);
+                }
+                PQclear(result);
+            }
+            if (!error.empty())
+            {
+                throw pqxx::sql_error(error, statement);
+            }
+        }
+
+        /**
+         * First column of the first row of a binary result, sharing the result's memory
+         * @return std::nullopt if there is no row or the value is NULL
+         */
+        std::optional<ByteBuffer> bytea_value(const PgResult& result)
+        {
+            if (PQntuples(result.get()) == 0 || PQgetisnull(result.get(), 0, 0))
+            {
+                return std::nullopt;
+            }
+            return ByteBuffer::share(result, std::string_view(PQgetvalue(result.get(), 0, 0),
+                                                              PQgetlength(result.get(), 0, 0)));
+        }
+
+        constexpr char ORDER_ASC = 'a';
+        constexpr char ORDER_DESC = 'd';
+        constexpr char ORDER_RELEVANCE = 'r';
+        // More words than that rarely narrow a search further but make the query more expensive
+        constexpr size_t MAX_SEARCH_TERMS = 8;
+
+        char order_from_sort_by(const std::optional<std::string>& sort_by, bool searching)
+        {
+            if (sort_by.has_value() && sort_by.value() == "date-desc")
+            {
+                return ORDER_DESC;
+            }
+            // Relevance needs search terms to rank by
+            if (searching && sort_by.has_value() && sort_by.value() == "relevance")
+            {
+                return ORDER_RELEVANCE;
+            }
+            return ORDER_ASC;
+        }
+
+        /**
+         * Turn free text typed into the search box into a tsquery matching moments that contain
+         * every word, each as a prefix so that results show up while the user is still typing:
+         * "beach sun" -> "'beach':* & 'sun':*". Anything but letters, digits and non-ASCII
+         * characters separates words, which also keeps tsquery operators out of the result.
+         * @return std::nullopt if there is no word to search for
+         */
+        std::optional<std::string> to_prefix_tsquery(const std::string& search)
+        {
+            std::string query;
+            size_t terms = 0;
+            size_t pos = 0;
+            const auto is_word_char = [](unsigned char c) { return std::isalnum(c) || c >= 0x80; };
+            while (pos < search.size() && terms < MAX_SEARCH_TERMS)
+            {
+                while (pos < search.size() && !is_word_char(search[pos]))
+                {
+                    pos++;
+                }
+                const size_t start = pos;
+                while (pos < search.size() && is_word_char(search[pos]))
+                {
+                    pos++;
+                }
+                if (pos == start)
+                {
+                    break;
+                }
+                if (terms++ > 0)
+                {
+                    query += " & ";
+                }
+                query += '\'';
+                query.append(search, start, pos - start);
+                query += "':*";
+            }
+            if (terms == 0)
+            {
+                return std::nullopt;
+            }
+            return query;
+        }
+
+        // Keyset position of a moment within a listing, handed to clients as an opaque token:
+        // base64url("<a|d|r>\n<sort key>\n<id>"). The sort key is the created_date for date
+        // ordered listings, as format_timestamp() writes it, and the search rank for relevance
+        // ordered ones.
+        struct PageCursor
+        {
+            char order;
+            std::string sort_key;
+            uint64_t id;
+        };
+
+        std::string encode_cursor(const PageCursor& cursor)
+        {
+            std::string raw;
+            raw.reserve(cursor.sort_key.size() + 24);
+            raw += cursor.order;
+            raw += '\n';
+            raw += cursor.sort_key;
+            raw += '\n';
+            raw += std::to_string(cursor.id);
+            return crow::utility::base64encode_urlsafe(raw, raw.size());
+        }
+
+        std::optional<PageCursor> decode_cursor(const std::string& token)
+        {
+            const std::string raw = crow::utility::base64decode(token, token.size());
+            const size_t first = raw.find('\n');
+            const size_t second = raw.rfind('\n');
+            if (first != 1 || second == first || (raw[0] != ORDER_ASC && raw[0] != ORDER_DESC && raw[0] != ORDER_RELEVANCE))
+            {
+                return std::nullopt;
+            }
+            // Ids are bigint: plain digits, no sign, at most INT64_MAX
+            const std::string id_str = raw.substr(second + 1);
+            if (id_str.empty() || id_str.size() > 19
+                || !std::all_of(id_str.begin(), id_str.end(), [](char c) { return c >= '0' && c <= '9'; }))
+            {
+                return std::nullopt;
+            }
+            const uint64_t id = std::stoull(id_str);
+            if (id > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+            {
+                return std::nullopt;
+            }
+            // The key is cast to timestamptz or real by the statements; anything that wouldn't
+            // parse must be refused here rather than fail the query
+            std::string sort_key = raw.substr(first + 1, second - first - 1);
+            if (raw[0] == ORDER_RELEVANCE)
+            {
+                char* end = nullptr;
+                const float rank = std::strtof(sort_key.c_str(), &end);
+                if (sort_key.empty() || end != sort_key.c_str() + sort_key.size() || !std::isfinite(rank))
+                {
+                    return std::nullopt;
+                }
+            }
+            else if (!parse_timestamp(sort_key).has_value())
+            {
+                return std::nullopt;
+            }
+            return PageCursor{raw[0], std::move(sort_key), id};
+        }
+
+        // Statement and text parameters of one page of a listing, shared by the pooled and the
+        // asynchronous paths so both run exactly the same queries
+        struct ListingQuery
+        {
+            const char* statement;
+            std::vector<std::string> params;
+            char order;
+        };
+
+        ListingQuery plan_moments_list(const std::string& username, uint32_t page_size, uint64_t current_page, const std::optional<std::string>& sort_by, const std::optional<std::string>& search)
+        {
+            const auto query = search.has_value() ? to_prefix_tsquery(search.value()) : std::nullopt;
+            const char order = order_from_sort_by(sort_by, query.has_value());
+            const std::string offset = std::to_string((current_page - 1) * page_size);
+            const std::string limit = std::to_string(page_size);
+
+            if (order == ORDER_RELEVANCE)
+            {
+                return {stmt::MOMENTS_SEARCH_RANKED_PAGE, {username, offset, limit, query.value()}, order};
+            }
+            if (query.has_value())
+            {
+                return {order == ORDER_DESC ? stmt::MOMENTS_SEARCH_PAGE_DESC : stmt::MOMENTS_SEARCH_PAGE_ASC,
+                    {username, offset, limit, query.value()}, order};
+            }
+            return {order == ORDER_DESC ? stmt::MOMENTS_PAGE_DESC : stmt::MOMENTS_PAGE_ASC,
+                {username, offset, limit}, order};
+        }
+
+        std::variant<ListingQuery, ErrorCode> plan_moments_page(const std::string& username, uint32_t page_size, const std::optional<std::string>& cursor, const std::optional<std::string>& sort_by, const std::optional<std::string>& search)
+        {
+            std::optional<PageCursor> position;
+            if (cursor.has_value())
+            {
+                position = decode_cursor(cursor.value());
+                if (!position.has_value())
+                {
+                    return ErrorCode::INVALID_CURSOR;
+                }
+            }
+            const auto query = search.has_value() ? to_prefix_tsquery(search.value()) : std::nullopt;
+            // A cursor keeps the order it was issued for
+            const char order = position.has_value() ? position->order : order_from_sort_by(sort_by, query.has_value());
+            if (order == ORDER_RELEVANCE && !query.has_value())
+            {
+                return ErrorCode::INVALID_CURSOR;
+            }
+            const bool descending = order == ORDER_DESC;
+            // One extra row tells whether there is a page after this one
+            const std::string limit = std::to_string(uint64_t{page_size} + 1);
+
+            if (order == ORDER_RELEVANCE)
+            {
+                return !position.has_value()
+                    ? ListingQuery{stmt::MOMENTS_SEARCH_RANKED_PAGE, {username, "0", limit, query.value()}, order}
+                    : ListingQuery{stmt::MOMENTS_SEARCH_RANKED_BEFORE,
+                        {username, position->sort_key, std::to_string(position->id), limit, query.value()}, order};
+            }
+            if (!position.has_value())
+            {
+                return query.has_value()
+                    ? ListingQuery{descending ? stmt::MOMENTS_SEARCH_PAGE_DESC : stmt::MOMENTS_SEARCH_PAGE_ASC,
+                        {username, "0", limit, query.value()}, order}
+                    : ListingQuery{descending ? stmt::MOMENTS_PAGE_DESC : stmt::MOMENTS_PAGE_ASC,
+                        {username, "0", limit}, order};
+            }
+            return query.has_value()
+                ? ListingQuery{descending ? stmt::MOMENTS_SEARCH_BEFORE_DESC : stmt::MOMENTS_SEARCH_AFTER_ASC,
+                    {username, position->sort_key, std::to_string(position->id), limit, query.value()}, order}
+                : ListingQuery{descending ? stmt::MOMENTS_BEFORE_DESC : stmt::MOMENTS_AFTER_ASC,
+                    {username, position->sort_key, std::to_string(position->id), limit}, order};
+        }
+
+        pqxx::result exec_listing(pqxx::transaction_base& transaction, const ListingQuery& listing)
+        {
+            pqxx::params params;
+            params.reserve(listing.params.size());
+            for (const auto& param : listing.params)
+            {
+                params.append(param);
+            }
+            return timed_query(listing.statement, [&] { return transaction.exec_prepared(listing.statement, params); });
+        }
+
+        // pqxx::result is a shared, immutable handle, so every waiter can map the rows itself
+        pqxx::result exec_listing_coalesced(const std::string& username, const ListingQuery& listing);
+
+        template<typename Result>
+        std::vector<Moment> moments_from_result(const Result& result)
+        {
+            Span span("map", "moments_from_result");
+            std::vector<Moment> moments;
+            moments.reserve(result.size());
+            for (size_t i = 0; i < result.size(); i++)
+            {
+                moments.push_back(moment_from_list_row(result[i]));
+            }
+            return moments;
+        }
+
+        // result holds up to page_size + 1 rows, the extra one only signalling a following page
+        template<typename Result>
+        MomentsPage page_from_result(const Result& result, uint32_t page_size, char order)
+        {
+            Span span("map", "page_from_result");
+            MomentsPage page;
+            const size_t rows = std::min<size_t>(result.size(), page_size);
+            page.moments.reserve(rows);
+            for (size_t i = 0; i < rows; i++)
+            {
+                page.moments.push_back(moment_from_list_row(result[i]));
+            }
+            if (result.size() > page_size && !page.moments.empty())
+            {
+                const Moment& last = page.moments.back();
+                page.next_cursor = encode_cursor({order,
+                    order == ORDER_RELEVANCE ? std::string(result[rows - 1]["rank"].c_str()) : format_timestamp(last.created_date),
+                    last.id});
+            }
+            return page;
+        }
+
+        // Strong validators: the id and the modification time identify a moment's details, the latter
+        // counting finished derivatives too. Listing tags carry the user as well, so a client
+        // switching accounts never matches the old one's.
+        std::string moment_etag(uint64_t id, int64_t modified_us)
+        {
+            return "\"" + std::to_string(id) + '-' + std::to_string(modified_us) + '"';
+        }
+
+        std::string moments_etag(const std::string& username, uint64_t version)
+        {
+            char user_hash[17];
+            std::snprintf(user_hash, sizeof(user_hash), "%016zx", std::hash<std::string>{}(username));
+            return "\"" + std::string(user_hash) + '-' + std::to_string(version) + '"';
+        }
+
+        ErrorCode async_error(const AsyncResult& outcome)
+        {
+            if (outcome.busy)
+            {
+                return ErrorCode::DATABASE_BUSY;
+            }
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << outcome.error;
+            return ErrorCode::INTERNAL_ERROR;
+        }
+
+        // Identical reads running at the same time share one query. Keys name the statement, its
+        // parameters and the generation of the cache the result would be stored in: a write bumps
+        // the generation, so reads starting after it never join a query that started before it.
+        SingleFlight<uint64_t>& count_flights()
+        {
+            static SingleFlight<uint64_t> flights;
+            return flights;
+        }
+
+        SingleFlight<pqxx::result>& listing_flights()
+        {
+            static SingleFlight<pqxx::result> flights;
+            return flights;
+        }
+
+        SingleFlight<std::variant<Moment, ErrorCode>>& detail_flights()
+        {
+            static SingleFlight<std::variant<Moment, ErrorCode>> flights;
+            return flights;
+        }
+
+        // Shared across I/O threads: waiters on other threads get the result posted to their loop
+        AsyncSingleFlight<AsyncResult>& async_flights()
+        {
+            static AsyncSingleFlight<AsyncResult> flights(AsyncResult{nullptr, "Query could not be started"});
+            return flights;
+        }
+
+        std::string listing_key(const ListingQuery& listing, uint64_t generation)
+        {
+            std::string key = flight_key({listing.statement, std::to_string(generation)});
+            for (const auto& param : listing.params)
+            {
+                append_flight_key(key, param);
+            }
+            return key;
+        }
+
+        pqxx::result exec_listing_coalesced(const std::string& username, const ListingQuery& listing)
+        {
+            const uint64_t generation = validator_cache().generation(username);
+            return listing_flights().run(listing_key(listing, generation), [&] {
+                auto c = db_pool().acquire();
+
+                pqxx::read_transaction transaction(*c);
+                pqxx::result result = exec_listing(transaction, listing);
+                transaction.commit();
+                return result;
+            });
+        }
+
+        /**
+         * Run a read on the calling thread's AsyncDb unless the same read is already in flight
+         * anywhere in the process. callback runs on io's thread either way.
+         */
+        void exec_coalesced(asio::io_context& io, const std::string& key, const char* statement, std::vector<std::string> params, AsyncDb::Callback callback)
+        {
+            async_flights().run(key,
+                [&io](std::function<void()> completion) {
+                    if (io.get_executor().running_in_this_thread())
+                    {
+                        completion();
+                    }
+                    else
+                    {
+                        asio::post(io, std::move(completion));
+                    }
+                },
+                // Completions run in the trace of their own request, not the one of the flight's leader
+                [callback = std::move(callback), trace = current_trace()](const AsyncResult& outcome) {
+                    TraceScope scope(trace);
+                    callback(outcome);
+                },
+                [&io, statement, params = std::move(params)](AsyncSingleFlight<AsyncResult>::Done done) mutable {
+                    AsyncDb::for_context(io).exec_prepared(statement, std::move(params), std::move(done));
+                });
+        }
+    }
+
     std::variant<User, ErrorCode> get_user_details(const std::string &username)
     {
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos hostaddr=127.0.0.1 port=5432");
+        Span span("db", "get_user_details");
+        auto c = db_pool().acquire();
 
-        pqxx::read_transaction transaction(c);
+        pqxx::read_transaction transaction(*c);
 
         try
         {
-            auto row = transaction.exec1("SELECT * FROM users WHERE username=" + transaction.quote(username));
+            auto row = timed_query(stmt::USER_BY_NAME, [&] { return transaction.exec_prepared1(stmt::USER_BY_NAME, username); });
             transaction.commit();
             return User{
                 .username = row["username"].c_str(),
@@ -26,396 +544,701 @@ namespace mkm
         }
         catch (const pqxx::unexpected_rows &e)
         {
-            CROW_LOG_ERROR << "Number of rows returned is not equal to 1: " << e.what();
+            MKM_LOG_ERROR(DB) << "Number of rows returned is not equal to 1: " << e.what();
             return ErrorCode::INTERNAL_ERROR;
         }
     }
 
-    bool is_password_valid(const std::string &input_password, const std::string &stored_password_hash)
+    bool create_new_account(const User& user_details)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos hostaddr=127.0.0.1 port=5432");
+        Span span("db", "create_new_account");
+        auto c = db_pool().acquire();
 
-        pqxx::read_transaction transaction(c);
+        pqxx::work transaction(*c);
 
         try
         {
-            // References:
-            // [1] https://stackoverflow.com/a/18687445
-            // [2] https://www.postgresql.org/docs/current/pgcrypto.html
-
-            std::stringstream s;
-            s << "SELECT (CASE WHEN crypt(" << transaction.quote(input_password) << ',' << transaction.quote(stored_password_hash)
-              << ") = " << transaction.quote(stored_password_hash) << " THEN true ELSE false END) as is_equal";
-            const std::string query = s.str();
-            CROW_LOG_DEBUG << "Query: " << query;
-            bool is_password_match = transaction.query_value<bool>(query);
+            auto result = timed_query(stmt::USER_INSERT, [&] {
+                return transaction.exec_prepared0(stmt::USER_INSERT,
+                    user_details.username,
+                    user_details.full_name,
+                    user_details.birth_date,
+                    user_details.email_id,
+                    user_details.password_hash);
+            });
+            if (result.affected_rows() != 1)
+            {
+                MKM_LOG_ERROR(DB) << "Something went wrong - couldn't insert data into database table";
+                return false;
+            }
             transaction.commit();
-            return is_password_match;
+            return true;
         }
-        catch (const pqxx::unexpected_rows &e)
+        catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Number of rows returned is not equal to 1: " << e.what();
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
             return false;
         }
-        catch (const pqxx::usage_error &e)
+    }
+
+    bool add_new_moment(const Moment& moment)
+    {
+        Span span("db", "add_new_moment");
+        // Disk I/O happens before a connection is checked out. If the insert fails the file stays
+        // behind unreferenced, which is harmless for a content-addressed store.
+        const auto image_path = store_image(moment);
+
+        auto c = db_pool().acquire();
+
+        pqxx::work transaction(*c);
+
+        try
         {
-            CROW_LOG_ERROR << "Number of columns returned is not equal to 1: " << e.what();
-            return false;
+            // Filename and caption only make sense together with an image
+            const auto image_filename = image_path ? null_if_empty(moment.image_filename) : std::nullopt;
+            const auto image_caption = image_path ? null_if_empty(moment.image_caption) : std::nullopt;
+
+            // The id comes from the identity column of moments and is returned by the insert
+            auto result = timed_query(stmt::MOMENT_INSERT, [&] {
+                return transaction.exec_prepared(stmt::MOMENT_INSERT,
+                    moment.username,
+                    std::string_view(moment.title),
+                    std::string_view(moment.description),
+                    format_date(moment.date),
+                    image_filename,
+                    image_path,
+                    image_caption,
+                    feelings_or_null(moment.feelings));
+            });
+            if (result.affected_rows() != 1)
+            {
+                MKM_LOG_ERROR(DB) << "Something went wrong - couldn't insert data into database table";
+                return false;
+            }
+            transaction.commit();
+            moment_count_cache().invalidate(moment.username);
+            validator_cache().invalidate(moment.username);
+            if (image_path)
+            {
+                derivative_pipeline().enqueue({moment.username, result[0]["id"].as<uint64_t>(), *image_path});
+            }
+            return true;
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
             return false;
         }
     }
 
-    bool create_new_account(const User& user_details, const std::string& password)
+    bool update_moment(const Moment& moment)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "update_moment");
+        const auto image_path = store_image(moment);
+
+        auto c = db_pool().acquire();
 
-        pqxx::work transaction(c);
+        pqxx::work transaction(*c);
 
         try
         {
-            std::stringstream s;
-            s << "INSERT INTO users(username, fullname, birthdate, emailid, password_hash, account_creation_time) "
-                "VALUES("
-                << transaction.quote(user_details.username) <<  ','
-                << transaction.quote(user_details.full_name) << ','
-                << transaction.quote(user_details.birth_date) << ','
-                << transaction.quote(user_details.email_id) << ", crypt("
-                << transaction.quote(password) << ", gen_salt('bf', 8)), now())";
-            const std::string query = s.str();
-            CROW_LOG_DEBUG << "Query: " << query;
-            auto result = transaction.exec(query);
+            // NULL leaves a column as it is - see stmt::MOMENT_UPDATE
+            auto result = timed_query(stmt::MOMENT_UPDATE, [&] {
+                return transaction.exec_prepared(stmt::MOMENT_UPDATE,
+                    moment.username,
+                    moment.id,
+                    null_if_empty(moment.title),
+                    null_if_empty(moment.description),
+                    date_or_null(moment.date),
+                    feelings_or_null(moment.feelings),
+                    image_path,
+                    image_path ? std::optional<std::string_view>(moment.image_filename) : std::nullopt,
+                    null_if_empty(moment.image_caption));
+            });
             if (result.affected_rows() != 1)
             {
-                CROW_LOG_ERROR << "Something went wrong - couldn't insert data into database table";
+                MKM_LOG_ERROR(DB) << "Something went wrong - couldn't update data into database table";
                 return false;
             }
             transaction.commit();
+            validator_cache().invalidate(moment.username, moment.id);
+            moment_detail_cache().invalidate(moment.username, moment.id);
+            if (image_path)
+            {
+                derivative_pipeline().enqueue({moment.username, moment.id, *image_path});
+            }
             return true;
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
             return false;
         }
     }
 
-    bool add_new_moment(const Moment& moment)
+    bool delete_moment(const std::string& username, uint64_t moment_id)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "delete_moment");
+        auto c = db_pool().acquire();
 
-        pqxx::work transaction(c);
+        pqxx::work transaction(*c);
 
         try
         {
-            std::basic_string_view<std::byte> image_content_bytes{
-                std::data(moment.image_content),
-                std::size(moment.image_content)
-            };
-            std::string image_content;
-            std::string image_filename;
-            std::string image_caption;
-
-            // In case of no data, set the image_data to NULL
-            image_content = image_content_bytes.empty() ? "NULL" : 
-                transaction.quote_raw(
-                    reinterpret_cast<const unsigned char*>(image_content_bytes.data()),
-                    image_content_bytes.size()
-                );
-            image_filename = image_content_bytes.empty() ? "NULL" : transaction.quote(moment.image_filename);
-            image_caption = image_content_bytes.empty() ? "NULL" : transaction.quote(moment.image_caption);
-
-            // Will use a SQL trigger / function which will get triggered before insert
-            // new_id = select count(*) + 1 from moments where username=<username>
-            // https://stackoverflow.com/q/61917751
-            std::stringstream s;
-            s << "INSERT INTO moments(username, title, description, moment_date, image_filename, image_data, image_caption, feelings) "
-                "VALUES("
-                << transaction.quote(moment.username) <<  ','
-                << transaction.quote(moment.title) << ','
-                << transaction.quote(moment.description) << ','
-                << transaction.quote(moment.date) << ','
-                << image_filename << ','
-                << image_content << ','
-                << image_caption << ',';
+            auto result = timed_query(stmt::MOMENT_DELETE, [&] { return transaction.exec_prepared0(stmt::MOMENT_DELETE, username, moment_id); });
+            if (result.affected_rows() != 1)
+            {
+                MKM_LOG_ERROR(DB) << "Something went wrong - couldn't delete moment from database table";
+                return false;
+            }
+            transaction.commit();
+            moment_count_cache().invalidate(username);
+            validator_cache().invalidate(username, moment_id);
+            moment_detail_cache().invalidate(username, moment_id);
+            return true;
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return false;
+        }
+    }
+
+    std::variant<uint64_t, ErrorCode> import_moments(const std::string& username, const std::pmr::vector<Moment>& moments)
+    {
+        Span span("db", "import_moments");
+        // Encoded before a connection is checked out, which is then held for the COPY alone
+        std::string data;
+        CopyBinaryWriter copy(data);
+        copy.header();
+        const auto& dictionary = feeling_dictionary();
+        for (const auto& moment : moments)
+        {
+            copy.begin_row(MOMENTS_IMPORT_COLUMNS);
+            copy.text(username);
+            copy.text(moment.title);
+            copy.text(moment.description);
+            copy.date(moment.date);
             if (moment.feelings.empty())
             {
-                s << "NULL";
+                copy.null();
             }
             else
             {
-                s << "'{";
-                for (size_t i = 0; i < moment.feelings.size(); i++)
-                {
-                    s << '"' << transaction.esc(moment.feelings[i]) << '"';
-                    if (i != moment.feelings.size() - 1)
-                    {
-                        s << ',';
-                    }
-                }
-                s << "}'";
+                copy.begin_text_array();
+                moment.feelings.for_each([&](uint8_t id) { copy.text_array_element(dictionary.name(id)); });
+                copy.end_text_array();
             }
-            s << ')';
+        }
+        copy.trailer();
 
-            auto result = transaction.exec(s.str());
-            if (result.affected_rows() != 1)
+        auto c = db_pool().acquire();
+
+        pqxx::work transaction(*c);
+
+        try
+        {
+            timed_query(MOMENTS_IMPORT, [&] {
+                copy_in(*c, MOMENTS_IMPORT_COPY, data);
+                return true;
+            });
+            transaction.commit();
+            moment_count_cache().invalidate(username);
+            validator_cache().invalidate(username);
+            return static_cast<uint64_t>(moments.size());
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
+        }
+    }
+
+    std::variant<std::vector<uint64_t>, ErrorCode> update_moments(const Moment& changes, const std::vector<uint64_t>& ids)
+    {
+        Span span("db", "update_moments");
+        auto c = db_pool().acquire();
+
+        pqxx::work transaction(*c);
+
+        try
+        {
+            // NULL leaves a column as it is - see stmt::MOMENTS_UPDATE_BATCH
+            auto result = timed_query(stmt::MOMENTS_UPDATE_BATCH, [&] {
+                return transaction.exec_prepared(stmt::MOMENTS_UPDATE_BATCH,
+                    changes.username,
+                    ids,
+                    null_if_empty(changes.title),
+                    null_if_empty(changes.description),
+                    date_or_null(changes.date),
+                    feelings_or_null(changes.feelings),
+                    null_if_empty(changes.image_caption));
+            });
+            transaction.commit();
+
+            std::vector<uint64_t> updated;
+            updated.reserve(result.size());
+            for (const auto& row : result)
             {
-                CROW_LOG_ERROR << "Something went wrong - couldn't insert data into database table";
-                return false;
+                const auto id = row["id"].as<uint64_t>();
+                validator_cache().invalidate(changes.username, id);
+                moment_detail_cache().invalidate(changes.username, id);
+                updated.push_back(id);
             }
-            transaction.commit();
-            return true;
+            return updated;
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
-            return false;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
         }
     }
 
-    bool update_moment(const Moment& moment)
+    std::variant<std::vector<uint64_t>, ErrorCode> delete_moments(const std::string& username, const std::vector<uint64_t>& ids)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-         pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "delete_moments");
+        auto c = db_pool().acquire();
 
-        pqxx::work transaction(c);
+        pqxx::work transaction(*c);
 
         try
         {
-            std::basic_string_view<std::byte> image_content_bytes{
-                std::data(moment.image_content),
-                std::size(moment.image_content)
-            };
+            auto result = timed_query(stmt::MOMENTS_DELETE_BATCH, [&] {
+                return transaction.exec_prepared(stmt::MOMENTS_DELETE_BATCH, username, ids);
+            });
+            transaction.commit();
+            moment_count_cache().invalidate(username);
 
-            std::stringstream s;
-            s << "UPDATE moments SET ";
-            if (!moment.title.empty())
+            std::vector<uint64_t> deleted;
+            deleted.reserve(result.size());
+            for (const auto& row : result)
             {
-                s << "title=" << transaction.quote(moment.title) << ',';
+                const auto id = row["id"].as<uint64_t>();
+                validator_cache().invalidate(username, id);
+                moment_detail_cache().invalidate(username, id);
+                deleted.push_back(id);
             }
-            if (!moment.description.empty())
+            return deleted;
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
+        }
+    }
+
+    uint64_t get_moment_count(const std::string& username)
+    {
+        Span span("db", "get_moment_count");
+        auto& cache = moment_count_cache();
+        if (auto count = cache.get(username))
+        {
+            return *count;
+        }
+        const uint64_t generation = cache.generation(username);
+
+        return count_flights().run(flight_key({stmt::MOMENT_COUNT, std::to_string(generation), username}), [&] {
+            auto c = db_pool().acquire();
+
+            pqxx::read_transaction transaction(*c);
+
+            try
             {
-                s << "description=" << transaction.quote(moment.description) << ',';
+                auto row = timed_query(stmt::MOMENT_COUNT, [&] { return transaction.exec_prepared1(stmt::MOMENT_COUNT, username); });
+                transaction.commit();
+                const auto count = row["total_moments"].as<uint64_t>();
+                cache.put(username, count, generation);
+                return count;
             }
-            if (!moment.date.empty())
+            catch (const pqxx::unexpected_rows &e)
             {
-                s << "moment_date=" << transaction.quote(moment.date) << ',';
+                MKM_LOG_ERROR(DB) << "Number of rows returned is not equal to 1: " << e.what();
+                return uint64_t{0};
             }
-            if (!moment.feelings.empty())
+        });
+    }
+
+    std::variant< std::vector<Moment>, ErrorCode > get_moments_list(const std::string& username, uint32_t page_size, uint64_t current_page, std::optional<std::string> sort_by, std::optional<std::string> search)
+    {
+        Span span("db", "get_moments_list");
+        const ListingQuery listing = plan_moments_list(username, page_size, current_page, sort_by, search);
+
+        try
+        {
+            const pqxx::result result = exec_listing_coalesced(username, listing);
+            return moments_from_result(result);
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
+        }
+        
+    }
+
+    std::variant<MomentsPage, ErrorCode> get_moments_page(const std::string& username, uint32_t page_size, std::optional<std::string> cursor, std::optional<std::string> sort_by, std::optional<std::string> search)
+    {
+        Span span("db", "get_moments_page");
+        auto planned = plan_moments_page(username, page_size, cursor, sort_by, search);
+        if (std::holds_alternative<ErrorCode>(planned))
+        {
+            return std::get<ErrorCode>(planned);
+        }
+        const ListingQuery& listing = std::get<ListingQuery>(planned);
+
+        try
+        {
+            const pqxx::result result = exec_listing_coalesced(username, listing);
+            return page_from_result(result, page_size, listing.order);
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
+        }
+    }
+
+    void get_moment_count_async(asio::io_context& io, const std::string& username, DbCallback<uint64_t> callback)
+    {
+        auto& cache = moment_count_cache();
+        if (auto count = cache.get(username))
+        {
+            return callback(*count);
+        }
+        const uint64_t generation = cache.generation(username);
+        exec_coalesced(io, flight_key({stmt::MOMENT_COUNT, std::to_string(generation), username}),
+            stmt::MOMENT_COUNT, {username},
+            [username, generation, callback = std::move(callback)](AsyncResult outcome) {
+                if (!outcome.ok())
+                {
+                    return callback(async_error(outcome));
+                }
+                // Same as the pooled version: an unknown user has no moments
+                const uint64_t count = outcome.size() == 1 ? outcome[0]["total_moments"].as<uint64_t>() : 0;
+                if (outcome.size() == 1)
+                {
+                    moment_count_cache().put(username, count, generation);
+                }
+                callback(count);
+            });
+    }
+
+    void get_moments_list_async(asio::io_context& io, const std::string& username, uint32_t page_size, uint64_t current_page, std::optional<std::string> sort_by, std::optional<std::string> search, DbCallback<std::vector<Moment>> callback)
+    {
+        ListingQuery listing = plan_moments_list(username, page_size, current_page, sort_by, search);
+        const std::string key = listing_key(listing, validator_cache().generation(username));
+        exec_coalesced(io, key, listing.statement, std::move(listing.params),
+            [callback = std::move(callback)](AsyncResult outcome) {
+                if (!outcome.ok())
+                {
+                    return callback(async_error(outcome));
+                }
+                // The moments only live until callback returns
+                RequestArena arena;
+                callback(moments_from_result(outcome));
+            });
+    }
+
+    void get_moments_page_async(asio::io_context& io, const std::string& username, uint32_t page_size, std::optional<std::string> cursor, std::optional<std::string> sort_by, std::optional<std::string> search, DbCallback<MomentsPage> callback)
+    {
+        auto planned = plan_moments_page(username, page_size, cursor, sort_by, search);
+        if (std::holds_alternative<ErrorCode>(planned))
+        {
+            return callback(std::get<ErrorCode>(planned));
+        }
+        ListingQuery& listing = std::get<ListingQuery>(planned);
+        const std::string key = listing_key(listing, validator_cache().generation(username));
+        exec_coalesced(io, key, listing.statement, std::move(listing.params),
+            [page_size, order = listing.order, callback = std::move(callback)](AsyncResult outcome) {
+                if (!outcome.ok())
+                {
+                    return callback(async_error(outcome));
+                }
+                // The page only lives until callback returns
+                RequestArena arena;
+                callback(page_from_result(outcome, page_size, order));
+            });
+    }
+
+    void get_moments_validator_async(asio::io_context& io, const std::string& username, DbCallback<Validator> callback)
+    {
+        auto& cache = validator_cache();
+        if (auto validator = cache.get_list(username))
+        {
+            return callback(std::move(*validator));
+        }
+        const uint64_t generation = cache.generation(username);
+        exec_coalesced(io, flight_key({stmt::MOMENTS_VALIDATOR, std::to_string(generation), username}),
+            stmt::MOMENTS_VALIDATOR, {username},
+            [username, generation, callback = std::move(callback)](AsyncResult outcome) {
+                if (!outcome.ok())
+                {
+                    return callback(async_error(outcome));
+                }
+                if (outcome.size() != 1)
+                {
+                    return callback(ErrorCode::USER_NOT_FOUND);
+                }
+                Validator validator{
+                    .etag = moments_etag(username, outcome[0]["moments_version"].as<uint64_t>()),
+                    .modified_us = outcome[0]["modified_us"].as<int64_t>()
+                };
+                validator_cache().put_list(username, validator, generation);
+                callback(std::move(validator));
+            });
+    }
+
+    std::variant<Validator, ErrorCode> get_moment_validator(const std::string& username, uint64_t id)
+    {
+        Span span("db", "get_moment_validator");
+        auto& cache = validator_cache();
+        if (auto validator = cache.get_moment(username, id))
+        {
+            return std::move(*validator);
+        }
+        const uint64_t generation = cache.generation(username);
+
+        auto c = db_pool().acquire();
+
+        pqxx::read_transaction transaction(*c);
+
+        try
+        {
+            auto result = timed_query(stmt::MOMENT_VALIDATOR, [&] { return transaction.exec_prepared(stmt::MOMENT_VALIDATOR, username, id); });
+            transaction.commit();
+            if (result.empty())
+            {
+                return ErrorCode::MOMENT_NOT_FOUND;
+            }
+            const int64_t modified_us = result[0]["modified_us"].as<int64_t>();
+            Validator validator{.etag = moment_etag(id, modified_us), .modified_us = modified_us};
+            cache.put_moment(username, id, validator, generation);
+            return validator;
+        }
+        catch(const pqxx::sql_error& e)
+        {
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
+        }
+    }
+
+    std::variant<Moment, ErrorCode> get_moment_details(const std::string& username, uint64_t id)
+    {
+        Span span("db", "get_moment_details");
+        auto& cache = moment_detail_cache();
+        if (auto cached = cache.get(username, id))
+        {
+            return *cached;
+        }
+        const uint64_t generation = cache.generation(username, id);
+
+        const std::string key = flight_key({stmt::MOMENT_DETAILS, std::to_string(generation), username, std::to_string(id)});
+        return detail_flights().run(key, [&]() -> std::variant<Moment, ErrorCode> {
+            auto c = db_pool().acquire();
+
+            pqxx::read_transaction transaction(*c);
+
+            try
             {
-                s << "feelings='{";
-                for (size_t i = 0; i < moment.feelings.size(); i++)
+                auto row = timed_query(stmt::MOMENT_DETAILS, [&] { return transaction.exec_prepared1(stmt::MOMENT_DETAILS, username, id); });
+
+                // Text goes into the request's arena; the cache keeps a heap copy
+                Moment moment = moment_from_list_row(row);
+                if (row["image_path"].is_null())
                 {
-                    s << '"' << transaction.esc(moment.feelings[i]) << '"';
-                    if (i != moment.feelings.size() - 1)
+                    // Only images that predate the store, and only while their bytes are still there
+                    moment.image_filename.clear();
+                    if (row["has_legacy_image"].as<bool>())
                     {
-                        s << ',';
+                        // Same transaction, so the bytes belong to the row read above
+                        const auto image = exec_prepared_binary(*c, stmt::MOMENT_IMAGE_DATA, {username, std::to_string(id)});
+                        if (auto content = bytea_value(image))
+                        {
+                            moment.image_content = std::move(*content);
+                            moment.image_filename = row["image_filename"].c_str();
+                        }
                     }
                 }
-                s << "}',";
+                transaction.commit();
+
+                cache.put(username, id, std::make_shared<const Moment>(moment), generation);
+                return moment;
             }
-            if (!image_content_bytes.empty())
+            catch (const pqxx::unexpected_rows&)
             {
-                s << "image_data=" << 
-                    transaction.quote_raw(
-                        reinterpret_cast<const unsigned char*>(image_content_bytes.data()),
-                        image_content_bytes.size()
-                    ) << ",image_filename=" << transaction.quote(moment.image_filename) << ',';
+                // Deleted since the caller checked its validator
+                return ErrorCode::MOMENT_NOT_FOUND;
             }
-            if (!moment.image_caption.empty())
+        });
+    }
+
+    std::variant<MomentImageInfo, ErrorCode> get_moment_image_info(const std::string& username, uint64_t id)
+    {
+        Span span("db", "get_moment_image_info");
+        auto c = db_pool().acquire();
+
+        pqxx::read_transaction transaction(*c);
+
+        try
+        {
+            auto result = timed_query(stmt::MOMENT_IMAGE_INFO, [&] { return transaction.exec_prepared(stmt::MOMENT_IMAGE_INFO, username, id); });
+            transaction.commit();
+            if (result.empty())
             {
-                s << "image_caption=" << transaction.quote(moment.image_caption) << ',';
+                return ErrorCode::MOMENT_NOT_FOUND;
             }
-            s << "last_modified_date=NOW() WHERE username=" << transaction.quote(moment.username) << " AND id=" << moment.id;
-
-            auto result = transaction.exec(s.str());
-            if (result.affected_rows() != 1)
+            const auto row = result[0];
+            MomentImageInfo info{
+                .filename = row["image_filename"].c_str(),
+                .hash = {},
+                .size = 0,
+                .modified_us = row["modified_us"].as<int64_t>()
+            };
+            if (!row["image_path"].is_null())
             {
-                CROW_LOG_ERROR << "Something went wrong - couldn't update data into database table";
-                return false;
+                info.hash = row["image_path"].c_str();
+                info.thumbnail_hash = row["thumbnail_path"].c_str();
+                info.preview_hash = row["preview_path"].c_str();
+                std::error_code error;
+                info.size = std::filesystem::file_size(image_store().path_for(info.hash), error);
+                if (error)
+                {
+                    MKM_LOG_WARNING(IMAGES) << "Image " << info.hash << " of moment " << id << " is missing from the store: " << error.message();
+                    return ErrorCode::IMAGE_NOT_FOUND;
+                }
             }
-            transaction.commit();
-            return true;
+            else if (!row["legacy_size"].is_null())
+            {
+                info.size = row["legacy_size"].as<uint64_t>();
+            }
+            else
+            {
+                return ErrorCode::IMAGE_NOT_FOUND;
+            }
+            return info;
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
-            return false;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
         }
     }
 
-    bool delete_moment(const std::string& username, uint64_t moment_id)
+    std::variant<std::string, ErrorCode> get_moment_image_chunk(const std::string& username, uint64_t id, uint64_t offset, uint64_t length)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "get_moment_image_chunk");
+        auto c = db_pool().acquire();
 
-        pqxx::work transaction(c);
+        pqxx::read_transaction transaction(*c);
 
         try
         {
-            std::stringstream s;
-            s << "DELETE FROM moments WHERE username=" << transaction.quote(username) << " AND id=" << moment_id;
-
-            auto result = transaction.exec(s.str());
-            if (result.affected_rows() != 1)
+            const auto result = exec_prepared_binary(*c, stmt::MOMENT_IMAGE_CHUNK,
+                {username, std::to_string(id), std::to_string(offset + 1), std::to_string(length)});
+            transaction.commit();
+            if (PQntuples(result.get()) == 0)
             {
-                CROW_LOG_ERROR << "Something went wrong - couldn't delete moment from database table";
-                return false;
+                return ErrorCode::MOMENT_NOT_FOUND;
             }
-            transaction.commit();
-            return true;
+            const auto chunk = bytea_value(result);
+            if (!chunk.has_value())
+            {
+                return ErrorCode::IMAGE_NOT_FOUND;
+            }
+            // The one copy left: from the libpq result into the response body
+            return std::string(chunk->view());
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
-            return false;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return ErrorCode::INTERNAL_ERROR;
         }
     }
 
-    uint64_t get_moment_count(const std::string& username)
+    std::vector<MomentImageRef> get_pending_derivatives(size_t limit)
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-         pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "get_pending_derivatives");
+        auto c = db_pool().acquire();
 
-        pqxx::read_transaction transaction(c);
+        pqxx::read_transaction transaction(*c);
 
         try
         {
-            auto row = transaction.exec1("SELECT COUNT(*) as total_moments FROM moments WHERE username=" + transaction.quote(username));
+            auto result = timed_query(stmt::DERIVATIVES_PENDING, [&] { return transaction.exec_prepared(stmt::DERIVATIVES_PENDING, limit); });
             transaction.commit();
-            return row["total_moments"].as<uint64_t>();
+
+            std::vector<MomentImageRef> images;
+            images.reserve(result.size());
+            for (const auto& row : result)
+            {
+                images.push_back({row["username"].c_str(), row["id"].as<uint64_t>(), row["image_path"].c_str()});
+            }
+            return images;
         }
-        catch (const pqxx::unexpected_rows &e)
+        catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Number of rows returned is not equal to 1: " << e.what();
-            return 0;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return {};
         }
     }
 
-    std::variant< std::vector<Moment>, ErrorCode > get_moments_list(const std::string& username, uint32_t page_size, uint64_t current_page, std::optional<std::string> sort_by, std::optional<std::string> search)
+    bool load_feelings()
     {
-        // TODO: replace hardcoded string with values from some environment/properties file
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "load_feelings");
+        auto c = db_pool().acquire();
+
+        pqxx::read_transaction transaction(*c);
 
-        pqxx::read_transaction transaction(c);
         try
         {
-            std::stringstream s;
-            s << "SELECT * FROM moments WHERE username=" << transaction.quote(username);
-            if (search.has_value())
-            {
-                s << " AND title like '%" << transaction.esc(search.value()) << "%'";
-            }
-            std::string sort_by_val = "asc";
-            if (sort_by.has_value() && sort_by.value() == "date-desc")
-            {
-                sort_by_val = "desc";
-            }
-            s << " ORDER BY created_date " << sort_by_val;
-            s << " OFFSET " << (current_page - 1) * page_size;
-            s << " LIMIT " << page_size;
-
-            std::string query = s.str();
-            CROW_LOG_DEBUG << "Query: " << query;
-
-            auto result = transaction.exec(query);
+            auto result = timed_query(stmt::FEELINGS, [&] { return transaction.exec_prepared(stmt::FEELINGS); });
             transaction.commit();
 
-            std::vector<Moment> moments;
-            for (size_t i = 0; i < result.size(); i++)
+            auto& dictionary = feeling_dictionary();
+            for (const auto& row : result)
             {
-                auto row = result[i];
-
-                Moment moment{
-                    .id = row["id"].as<uint64_t>(),
-                    .username = row["username"].c_str(),
-                    .title = row["title"].c_str(),
-                    .description = row["description"].c_str(),
-                    .date = row["moment_date"].c_str(),
-                    .created_date = row["created_date"].c_str(),
-                    .last_modified_date = row["last_modified_date"].c_str()
-                };
-
-                if (!row["image_data"].is_null())
+                if (!dictionary.intern(row["name"].c_str()))
                 {
-                    std::basic_string<std::byte> byte_image_content = transaction.unesc_bin(row["image_data"].c_str());
-                    moment.image_content = std::vector<std::byte>(byte_image_content.begin(), byte_image_content.end());
-                    moment.image_filename = row["image_filename"].c_str();
+                    MKM_LOG_ERROR(DB) << "More than " << FeelingSet::CAPACITY << " feelings, ignoring '" << row["name"].c_str() << "'";
                 }
-
-                moments.push_back(std::move(moment));
             }
-            return moments;
+            MKM_LOG_INFO(DB) << "Loaded " << dictionary.size() << " feelings";
+            return true;
         }
         catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Internal exception was thrown: " << e.what();
-            return ErrorCode::INTERNAL_ERROR;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return false;
         }
-        
     }
 
-    std::variant<Moment, ErrorCode> get_moment_details(const std::string& username, uint64_t id)
+    bool set_moment_derivatives(const MomentImageRef& image, const std::string& thumbnail_hash, const std::string& preview_hash, DerivativeStatus status)
     {
-        pqxx::connection c("dbname=mkm_db user=mkm_user password=momentos");
+        Span span("db", "set_moment_derivatives");
+        auto c = db_pool().acquire();
 
-        pqxx::read_transaction transaction(c);
+        pqxx::work transaction(*c);
 
         try
         {
-            std::stringstream s;
-            s << "SELECT * FROM moments WHERE username=" << transaction.quote(username) << " AND id=" << id;
-            std::string query = s.str();
-            CROW_LOG_DEBUG << "Query: " << query;
-
-            auto row = transaction.exec1(query);
+            timed_query(stmt::DERIVATIVES_SET, [&] {
+                return transaction.exec_prepared0(stmt::DERIVATIVES_SET,
+                    image.username,
+                    image.id,
+                    image.image_hash,
+                    null_if_empty(thumbnail_hash),
+                    null_if_empty(preview_hash),
+                    static_cast<int>(status));
+            });
             transaction.commit();
-
-            Moment moment{
-                .id = row["id"].as<uint64_t>(),
-                .username = row["username"].c_str(),
-                .title = row["title"].c_str(),
-                .description = row["description"].c_str(),
-                .date = row["moment_date"].c_str(),
-                .image_caption = row["image_caption"].c_str(),
-                .created_date = row["created_date"].c_str(),
-                .last_modified_date = row["last_modified_date"].c_str()
-            };
-
-            if (!row["image_data"].is_null())
-            {
-                std::basic_string<std::byte> byte_image_content = transaction.unesc_bin(row["image_data"].c_str());
-                moment.image_content = std::vector<std::byte>(byte_image_content.begin(), byte_image_content.end());
-                moment.image_filename = row["image_filename"].c_str();
-            }
-            if (!row["feelings"].is_null())
-            {
-                auto array_parser_obj = row["feelings"].as_array();
-                while (true)
-                {
-                    const auto& [juncture_val, array_val] = array_parser_obj.get_next();
-                    if (juncture_val == pqxx::array_parser::juncture::done)
-                    {
-                        break;
-                    }
-                    if (juncture_val == pqxx::array_parser::juncture::string_value)
-                    {
-                        moment.feelings.push_back(array_val);
-                    }
-                }
-            }
-            return moment;
+            validator_cache().invalidate(image.username, image.id);
+            moment_detail_cache().invalidate(image.username, image.id);
+            return true;
         }
-        catch (const pqxx::unexpected_rows &e)
+        catch(const pqxx::sql_error& e)
         {
-            CROW_LOG_ERROR << "Number of rows returned is not equal to 1: " << e.what();
-            return ErrorCode::INTERNAL_ERROR;
+            MKM_LOG_ERROR(DB) << "Internal exception was thrown: " << e.what();
+            return false;
         }
     }
-} 
\ No newline at end of file
+}
\ No newline at end of file
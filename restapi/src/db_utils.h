@@ -3,17 +3,55 @@
 #include "User.h"
 #include "Error.h"
 #include "Moment.h"
+#include "validator_cache.h"
 
+#include <functional>
+#include <memory_resource>
+#include <vector>
 #include <variant>
 #include <optional>
 
+namespace asio
+{
+class io_context;
+}
+
 namespace mkm
 {
-std::variant<User, ErrorCode> get_user_details(const std::string& username);
+struct MomentsPage
+{
+    std::vector<Moment> moments;
+    // Opaque continuation token for the following page, empty on the last page
+    std::optional<std::string> next_cursor;
+};
+
+struct MomentImageInfo
+{
+    std::string filename;
+    // Image store hash, empty for images still kept in the image_data column
+    std::string hash;
+    // Hashes of the downscaled variants, empty while they are not available
+    std::string thumbnail_hash;
+    std::string preview_hash;
+    uint64_t size;
+    // last_modified_date in microseconds since the epoch, for validators
+    int64_t modified_us;
+};
 
-bool is_password_valid(const std::string& input_password, const std::string& stored_password_hash);
+// One stored image of a moment, as handed to background processing
+struct MomentImageRef
+{
+    std::string username;
+    uint64_t id;
+    std::string image_hash;
+};
+
+std::variant<User, ErrorCode> get_user_details(const std::string& username);
 
-bool create_new_account(const User& user_details, const std::string& password);
+/**
+ * @brief Insert a new user. user_details.password_hash must already be hashed - see hash_password()
+ */
+bool create_new_account(const User& user_details);
 
 bool add_new_moment(const Moment& moment);
 
@@ -21,9 +59,88 @@ bool update_moment(const Moment& moment);
 
 bool delete_moment(const std::string& username, uint64_t moment_id);
 
+/**
+ * Bulk insert of a user's moments, all in one transaction through a binary COPY - either all of
+ * them are imported or none. Only the title, description, date and feelings are stored.
+ * @return how many moments were imported
+ */
+std::variant<uint64_t, ErrorCode> import_moments(const std::string& username, const std::pmr::vector<Moment>& moments);
+
+/**
+ * Apply the fields given in changes - title, description, date, feelings and image caption - to
+ * each of changes.username's moments in ids, in one statement. Images are left as they are.
+ * @return ids of the moments that were found and updated
+ */
+std::variant<std::vector<uint64_t>, ErrorCode> update_moments(const Moment& changes, const std::vector<uint64_t>& ids);
+
+/**
+ * @return ids of the moments that were found and deleted
+ */
+std::variant<std::vector<uint64_t>, ErrorCode> delete_moments(const std::string& username, const std::vector<uint64_t>& ids);
+
 uint64_t get_moment_count(const std::string& username);
 
+/**
+ * Offset pagination. sort_by is "date-asc" (default), "date-desc" or, together with search,
+ * "relevance". search matches words in the title, description and caption, each as a prefix.
+ */
 std::variant< std::vector<Moment>, ErrorCode > get_moments_list(const std::string& username, uint32_t page_size, uint64_t current_page, std::optional<std::string> sort_by, std::optional<std::string> search);
 
+/**
+ * Keyset pagination over (created_date, id) - pass the next_cursor of the previous page, or
+ * std::nullopt for the first one. Unlike get_moments_list the cost doesn't grow with page depth
+ * and pages don't shift when moments get added.
+ */
+std::variant<MomentsPage, ErrorCode> get_moments_page(const std::string& username, uint32_t page_size, std::optional<std::string> cursor, std::optional<std::string> sort_by, std::optional<std::string> search);
+
+/**
+ * Completion of an asynchronous query. Runs on the thread of the io_context the query was started
+ * from; DATABASE_BUSY means the query was shed without reaching the database.
+ */
+template<typename T>
+using DbCallback = std::function<void(std::variant<T, ErrorCode>)>;
+
+/**
+ * Non-blocking versions of the dashboard queries, for handlers running on a Crow I/O thread - io is
+ * that thread's io_context, see AsyncDb. The count may be answered from the cache before returning.
+ * Listed moments are mapped into a RequestArena that closes when the callback returns, so the
+ * callback must be done with them by then, or copy them.
+ */
+void get_moment_count_async(asio::io_context& io, const std::string& username, DbCallback<uint64_t> callback);
+
+void get_moments_list_async(asio::io_context& io, const std::string& username, uint32_t page_size, uint64_t current_page, std::optional<std::string> sort_by, std::optional<std::string> search, DbCallback<std::vector<Moment>> callback);
+
+void get_moments_page_async(asio::io_context& io, const std::string& username, uint32_t page_size, std::optional<std::string> cursor, std::optional<std::string> sort_by, std::optional<std::string> search, DbCallback<MomentsPage> callback);
+
+/**
+ * Validator of a user's moment listings, whichever page, order or search. Answered from the
+ * validator cache when possible, and before reading the listing itself otherwise.
+ */
+void get_moments_validator_async(asio::io_context& io, const std::string& username, DbCallback<Validator> callback);
+
+/**
+ * Validator of one moment's details, from the validator cache when possible
+ */
+std::variant<Validator, ErrorCode> get_moment_validator(const std::string& username, uint64_t id);
+
 std::variant<Moment, ErrorCode> get_moment_details(const std::string& username, uint64_t id);
+
+std::variant<MomentImageInfo, ErrorCode> get_moment_image_info(const std::string& username, uint64_t id);
+
+/**
+ * Read length bytes of a moment's image starting at offset, without fetching the rest of it
+ */
+std::variant<std::string, ErrorCode> get_moment_image_chunk(const std::string& username, uint64_t id, uint64_t offset, uint64_t length);
+
+std::vector<MomentImageRef> get_pending_derivatives(size_t limit);
+
+/**
+ * Intern the feelings table into feeling_dictionary(). Runs once at startup, before requests are served.
+ */
+bool load_feelings();
+
+/**
+ * Record the generated variants of an image. Ignored if the moment's image was replaced meanwhile.
+ */
+bool set_moment_derivatives(const MomentImageRef& image, const std::string& thumbnail_hash, const std::string& preview_hash, DerivativeStatus status);
 }   // namespace mkm
\ No newline at end of file
@@ -0,0 +1,314 @@
+#include "derivatives.h"
+#include "async_log.h"
+#include "config_env.h"
+#include "image_store.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_ONLY_JPEG
+#define STBI_ONLY_PNG
+#define STBI_ONLY_GIF
+#define STBI_ONLY_BMP
+#include <stb_image.h>
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include <stb_image_resize2.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace mkm
+{
+    namespace
+    {
+        constexpr int JPEG_QUALITY = 82;
+        // Refuse to decode anything bigger - protects the workers from decompression bombs
+        constexpr uint64_t MAX_SOURCE_PIXELS = 50'000'000;
+
+        // The image can never be processed - retrying won't help
+        class unsupported_image : public std::runtime_error
+        {
+        public:
+            using std::runtime_error::runtime_error;
+        };
+
+        struct DecodedImage
+        {
+            std::unique_ptr<unsigned char, void (*)(void*)> pixels{nullptr, stbi_image_free};
+            int width = 0;
+            int height = 0;
+        };
+
+        DecodedImage decode(const std::string& path)
+        {
+            DecodedImage image;
+            int channels = 0;
+            if (!stbi_info(path.c_str(), &image.width, &image.height, &channels))
+            {
+                throw unsupported_image(std::string("Unsupported image format: ") + stbi_failure_reason());
+            }
+            if (static_cast<uint64_t>(image.width) * static_cast<uint64_t>(image.height) > MAX_SOURCE_PIXELS)
+            {
+                throw unsupported_image("Image dimensions too large");
+            }
+            image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height, &channels, 3));
+            if (!image.pixels)
+            {
+                throw unsupported_image(std::string("Could not decode image: ") + stbi_failure_reason());
+            }
+            return image;
+        }
+
+        /**
+         * Downscale to fit max_side and store as JPEG, returning the store hash. Images that already
+         * fit are never upscaled or re-encoded - the original is the smallest variant then.
+         */
+        std::string make_variant(const DecodedImage& image, const std::string& original_hash, int max_side)
+        {
+            const int longest = std::max(image.width, image.height);
+            if (longest <= max_side)
+            {
+                return original_hash;
+            }
+            const double scale = static_cast<double>(max_side) / longest;
+            const int width = std::max(1, static_cast<int>(std::lround(image.width * scale)));
+            const int height = std::max(1, static_cast<int>(std::lround(image.height * scale)));
+
+            std::vector<unsigned char> resized(static_cast<size_t>(width) * height * 3);
+            if (stbir_resize_uint8_srgb(image.pixels.get(), image.width, image.height, 0,
+                                        resized.data(), width, height, 0, STBIR_RGB) == nullptr)
+            {
+                throw std::runtime_error("Resizing image failed");
+            }
+
+            std::string encoded;
+            const auto append = [](void* context, void* data, int size) {
+                static_cast<std::string*>(context)->append(static_cast<const char*>(data), size);
+            };
+            if (!stbi_write_jpg_to_func(append, &encoded, width, height, 3, resized.data(), JPEG_QUALITY))
+            {
+                throw std::runtime_error("Encoding JPEG failed");
+            }
+            return image_store().put(encoded).hash;
+        }
+    }
+
+    DerivativePipeline::Config DerivativePipeline::Config::from_env()
+    {
+        Config config;
+        config.workers = std::max<size_t>(1, env_or("MKM_DERIVATIVE_WORKERS", config.workers));
+        config.queue_capacity = std::max<size_t>(1, env_or("MKM_DERIVATIVE_QUEUE", config.queue_capacity));
+        return config;
+    }
+
+    DerivativePipeline::DerivativePipeline(Config config)
+        : config_(config)
+    {
+        workers_.reserve(config_.workers);
+        for (size_t i = 0; i < config_.workers; i++)
+        {
+            workers_.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    DerivativePipeline::~DerivativePipeline()
+    {
+        stop();
+    }
+
+    bool DerivativePipeline::enqueue(MomentImageRef image)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            if (stopping_)
+            {
+                return false;
+            }
+            if (in_flight_.count({image.id, image.image_hash}) != 0)
+            {
+                return true;
+            }
+            if (queue_.size() >= config_.queue_capacity)
+            {
+                overflowed_ = true;
+                return false;
+            }
+            in_flight_.emplace(image.id, image.image_hash);
+            queue_.push_back(std::move(image));
+        }
+        wake_.notify_one();
+        return true;
+    }
+
+    void DerivativePipeline::requeue_pending()
+    {
+        size_t free_slots;
+        size_t in_flight;
+        {
+            std::lock_guard lock(mutex_);
+            free_slots = config_.queue_capacity - std::min(queue_.size(), config_.queue_capacity);
+            in_flight = in_flight_.size();
+            if (free_slots == 0)
+            {
+                // Sweep again once the queue has room
+                overflowed_ = true;
+                return;
+            }
+        }
+        // The oldest pending rows are likely the ones in flight; read past them to fill the free slots
+        const size_t limit = free_slots + in_flight;
+        const auto pending = get_pending_derivatives(limit);
+        size_t queued = 0;
+        {
+            std::lock_guard lock(mutex_);
+            // A full read may have left more rows behind, so the backlog is swept again each time
+            // the queue runs dry until a read comes back short
+            bool more = pending.size() >= limit;
+            for (const auto& image : pending)
+            {
+                if (stopping_)
+                {
+                    break;
+                }
+                if (queue_.size() >= config_.queue_capacity)
+                {
+                    more = true;
+                    break;
+                }
+                if (in_flight_.emplace(image.id, image.image_hash).second)
+                {
+                    queue_.push_back(image);
+                    queued++;
+                }
+            }
+            if (more)
+            {
+                overflowed_ = true;
+            }
+        }
+        if (queued > 0)
+        {
+            wake_.notify_all();
+            MKM_LOG_INFO(IMAGES) << "Queued " << queued << " pending image derivative job(s)";
+        }
+    }
+
+    void DerivativePipeline::stop()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            if (stopping_)
+            {
+                return;
+            }
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        stopped_.notify_all();
+        for (auto& worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    void DerivativePipeline::worker_loop()
+    {
+        while (true)
+        {
+            MomentImageRef image;
+            bool sweep = false;
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !queue_.empty() || overflowed_; });
+                if (stopping_)
+                {
+                    return;
+                }
+                if (queue_.empty())
+                {
+                    // Everything queued is done - fetch what didn't fit earlier
+                    overflowed_ = false;
+                    sweep = true;
+                }
+                else
+                {
+                    image = std::move(queue_.front());
+                    queue_.pop_front();
+                }
+            }
+
+            try
+            {
+                if (sweep)
+                {
+                    requeue_pending();
+                }
+                else
+                {
+                    process(image);
+                }
+            }
+            catch (const std::exception& e)
+            {
+                MKM_LOG_ERROR(IMAGES) << "Image derivative worker error: " << e.what();
+            }
+            if (!sweep)
+            {
+                std::lock_guard lock(mutex_);
+                in_flight_.erase({image.id, image.image_hash});
+            }
+        }
+    }
+
+    void DerivativePipeline::process(const MomentImageRef& image)
+    {
+        for (unsigned attempt = 1; ; attempt++)
+        {
+            try
+            {
+                const DecodedImage decoded = decode(image_store().path_for(image.image_hash).string());
+                const std::string thumbnail = make_variant(decoded, image.image_hash, THUMBNAIL_MAX_SIDE);
+                const std::string preview = make_variant(decoded, image.image_hash, PREVIEW_MAX_SIDE);
+                if (!set_moment_derivatives(image, thumbnail, preview, DerivativeStatus::READY))
+                {
+                    throw std::runtime_error("Could not record derivatives");
+                }
+                return;
+            }
+            catch (const unsupported_image& e)
+            {
+                MKM_LOG_WARNING(IMAGES) << "No derivatives for moment " << image.id << ": " << e.what();
+                set_moment_derivatives(image, {}, {}, DerivativeStatus::FAILED);
+                return;
+            }
+            catch (const std::exception& e)
+            {
+                if (attempt >= config_.max_attempts)
+                {
+                    MKM_LOG_ERROR(IMAGES) << "Giving up on derivatives for moment " << image.id << ": " << e.what();
+                    set_moment_derivatives(image, {}, {}, DerivativeStatus::FAILED);
+                    return;
+                }
+                MKM_LOG_WARNING(IMAGES) << "Derivatives for moment " << image.id << " failed (attempt " << attempt
+                                        << "), retrying: " << e.what();
+                std::unique_lock lock(mutex_);
+                // Back off 250ms, 500ms, ... but wake up immediately on shutdown
+                if (stopped_.wait_for(lock, std::chrono::milliseconds(250) * (1u << (attempt - 1)),
+                                   [this] { return stopping_; }))
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    DerivativePipeline& derivative_pipeline()
+    {
+        static DerivativePipeline pipeline(DerivativePipeline::Config::from_env());
+        return pipeline;
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "db_utils.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace mkm
+{
+// Longest side in pixels of each generated variant. Images already smaller than that are used as is.
+constexpr int THUMBNAIL_MAX_SIDE = 256;
+constexpr int PREVIEW_MAX_SIDE = 1024;
+
+/**
+ * @brief Background workers producing the thumbnail and preview of uploaded images.
+ *
+ * Uploads only enqueue a job once their transaction has committed; the moment stays
+ * DerivativeStatus::PENDING in the database until a worker stores the variants and marks it READY
+ * (or FAILED once the retries are used up). Jobs that don't fit into the bounded queue are not lost:
+ * they are picked up again from the database the next time the queue runs dry.
+ */
+class DerivativePipeline
+{
+public:
+    struct Config
+    {
+        size_t workers = 2;
+        size_t queue_capacity = 256;
+        unsigned max_attempts = 3;
+
+        /**
+         * @brief Read MKM_DERIVATIVE_WORKERS and MKM_DERIVATIVE_QUEUE, keeping the defaults above otherwise
+         */
+        static Config from_env();
+    };
+
+    explicit DerivativePipeline(Config config);
+    DerivativePipeline(const DerivativePipeline&) = delete;
+    DerivativePipeline& operator=(const DerivativePipeline&) = delete;
+    ~DerivativePipeline();
+
+    /**
+     * @brief Queue an image without blocking
+     * @return false if the queue is full - the job will be recovered by a later database sweep.
+     * An image that is already queued or being processed is not queued twice.
+     */
+    bool enqueue(MomentImageRef image);
+
+    /**
+     * @brief Queue moments left pending by a restart or an overflowing queue
+     */
+    void requeue_pending();
+
+    void stop();
+
+private:
+    void worker_loop();
+    void process(const MomentImageRef& image);
+
+    const Config config_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable stopped_;
+    std::deque<MomentImageRef> queue_;
+    // Moment id and image hash of the jobs queued or being processed. They are still pending in
+    // the database, so a sweep finds them again and must leave them alone. A replaced image has
+    // another hash and gets a job of its own.
+    std::set<std::pair<uint64_t, std::string>> in_flight_;
+    bool overflowed_ = false;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+DerivativePipeline& derivative_pipeline();
+}   // namespace mkm
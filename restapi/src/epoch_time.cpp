@@ -0,0 +1,206 @@
+#include "epoch_time.h"
+
+namespace mkm
+{
+    namespace
+    {
+        struct CivilDate
+        {
+            int64_t year;
+            unsigned month;
+            unsigned day;
+        };
+
+        // Howard Hinnant's days_from_civil / civil_from_days, proleptic Gregorian calendar
+        // References:
+        // [1] https://howardhinnant.github.io/date_algorithms.html
+        int64_t days_from_civil(int64_t year, unsigned month, unsigned day)
+        {
+            year -= month <= 2;
+            const int64_t era = (year >= 0 ? year : year - 399) / 400;
+            const auto year_of_era = static_cast<unsigned>(year - era * 400);
+            const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+            const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+            return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+        }
+
+        CivilDate civil_from_days(int64_t days)
+        {
+            days += 719468;
+            const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+            const auto day_of_era = static_cast<unsigned>(days - era * 146097);
+            const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+            const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+            const unsigned shifted_month = (5 * day_of_year + 2) / 153;
+            const unsigned day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+            const unsigned month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+            return {static_cast<int64_t>(year_of_era) + era * 400 + (month <= 2), month, day};
+        }
+
+        unsigned days_in_month(int64_t year, unsigned month)
+        {
+            static constexpr unsigned DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+            const bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+            return month == 2 && leap ? 29 : DAYS[month - 1];
+        }
+
+        void write_digits(char* out, uint64_t value, size_t width)
+        {
+            for (size_t i = width; i > 0; i--)
+            {
+                out[i - 1] = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+        }
+
+        size_t write_civil_date(const CivilDate& date, char* out)
+        {
+            // Years outside 0-9999 can't be stored by the forms; keep the layout regardless
+            write_digits(out, static_cast<uint64_t>(date.year < 0 ? 0 : date.year % 10000), 4);
+            out[4] = '-';
+            write_digits(out + 5, date.month, 2);
+            out[7] = '-';
+            write_digits(out + 8, date.day, 2);
+            return 10;
+        }
+
+        int64_t floor_div(int64_t value, int64_t divisor)
+        {
+            const int64_t quotient = value / divisor;
+            return quotient * divisor > value ? quotient - 1 : quotient;
+        }
+
+        // Exactly count decimal digits at text[start], or std::nullopt
+        std::optional<unsigned> read_digits(std::string_view text, size_t start, size_t count)
+        {
+            unsigned value = 0;
+            for (size_t i = start; i < start + count; i++)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                {
+                    return std::nullopt;
+                }
+                value = value * 10 + static_cast<unsigned>(text[i] - '0');
+            }
+            return value;
+        }
+    }
+
+    std::optional<EpochDays> parse_date(std::string_view text)
+    {
+        if (text.size() != 10 || text[4] != '-' || text[7] != '-')
+        {
+            return std::nullopt;
+        }
+        unsigned fields[3] = {0, 0, 0};
+        const size_t starts[3] = {0, 5, 8};
+        const size_t lengths[3] = {4, 2, 2};
+        for (size_t field = 0; field < 3; field++)
+        {
+            for (size_t i = starts[field]; i < starts[field] + lengths[field]; i++)
+            {
+                if (text[i] < '0' || text[i] > '9')
+                {
+                    return std::nullopt;
+                }
+                fields[field] = fields[field] * 10 + static_cast<unsigned>(text[i] - '0');
+            }
+        }
+        const auto [year, month, day] = fields;
+        if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month))
+        {
+            return std::nullopt;
+        }
+        return static_cast<EpochDays>(days_from_civil(year, month, day));
+    }
+
+    size_t format_date(EpochDays days, char* out)
+    {
+        if (days == NO_DATE)
+        {
+            return 0;
+        }
+        return write_civil_date(civil_from_days(days), out);
+    }
+
+    std::string format_date(EpochDays days)
+    {
+        char text[10];
+        return std::string(text, format_date(days, text));
+    }
+
+    size_t format_timestamp(EpochMicros micros, char* out)
+    {
+        constexpr int64_t MICROS_PER_DAY = 86400LL * 1000000;
+        const int64_t days = floor_div(micros, MICROS_PER_DAY);
+        auto of_day = static_cast<uint64_t>(micros - days * MICROS_PER_DAY);
+
+        size_t length = write_civil_date(civil_from_days(days), out);
+        const uint64_t fraction = of_day % 1000000;
+        of_day /= 1000000;
+        out[length++] = ' ';
+        write_digits(out + length, of_day / 3600, 2);
+        out[length + 2] = ':';
+        write_digits(out + length + 3, of_day / 60 % 60, 2);
+        out[length + 5] = ':';
+        write_digits(out + length + 6, of_day % 60, 2);
+        length += 8;
+        if (fraction != 0)
+        {
+            out[length++] = '.';
+            write_digits(out + length, fraction, 6);
+            size_t digits = 6;
+            while (out[length + digits - 1] == '0')
+            {
+                digits--;
+            }
+            length += digits;
+        }
+        out[length++] = '+';
+        out[length++] = '0';
+        out[length++] = '0';
+        return length;
+    }
+
+    std::string format_timestamp(EpochMicros micros)
+    {
+        char text[MAX_TIMESTAMP_LENGTH];
+        return std::string(text, format_timestamp(micros, text));
+    }
+
+    std::optional<EpochMicros> parse_timestamp(std::string_view text)
+    {
+        // "YYYY-MM-DD HH:MM:SS" "+00", with an optional ".f" to ".ffffff" in between
+        if (text.size() < 22 || text.size() > MAX_TIMESTAMP_LENGTH || text[10] != ' ' || text[13] != ':'
+            || text[16] != ':' || text.substr(text.size() - 3) != "+00")
+        {
+            return std::nullopt;
+        }
+        const auto days = parse_date(text.substr(0, 10));
+        const auto hours = read_digits(text, 11, 2);
+        const auto minutes = read_digits(text, 14, 2);
+        const auto seconds = read_digits(text, 17, 2);
+        if (!days || !hours || !minutes || !seconds || *hours > 23 || *minutes > 59 || *seconds > 59)
+        {
+            return std::nullopt;
+        }
+        int64_t fraction = 0;
+        const size_t fraction_digits = text.size() - 22;
+        if (fraction_digits > 0)
+        {
+            // A fraction has at least one digit after the point
+            const auto digits = fraction_digits > 1 ? read_digits(text, 20, fraction_digits - 1) : std::nullopt;
+            if (text[19] != '.' || !digits)
+            {
+                return std::nullopt;
+            }
+            fraction = *digits;
+            for (size_t i = fraction_digits - 1; i < 6; i++)
+            {
+                fraction *= 10;
+            }
+        }
+        const int64_t of_day = (static_cast<int64_t>(*hours) * 3600 + *minutes * 60 + *seconds) * 1000000 + fraction;
+        return static_cast<EpochMicros>(*days) * 86400LL * 1000000 + of_day;
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mkm
+{
+// Days since 1970-01-01
+using EpochDays = int32_t;
+// Microseconds since 1970-01-01 00:00:00 UTC, the resolution of a Postgres timestamptz
+using EpochMicros = int64_t;
+
+// No date given, e.g. by an update that leaves a moment's date as it is
+constexpr EpochDays NO_DATE = INT32_MIN;
+
+// Longest format_timestamp() result, "YYYY-MM-DD HH:MM:SS.ffffff+00"
+constexpr size_t MAX_TIMESTAMP_LENGTH = 29;
+
+/**
+ * @brief Parse a "YYYY-MM-DD" date, as the moment forms send it
+ * @return std::nullopt unless it is exactly that format and a real calendar day
+ */
+std::optional<EpochDays> parse_date(std::string_view text);
+
+/**
+ * @brief Write days as "YYYY-MM-DD" to out, which must hold 10 characters. NO_DATE writes nothing.
+ * @return characters written
+ */
+size_t format_date(EpochDays days, char* out);
+std::string format_date(EpochDays days);
+
+/**
+ * @brief Write a timestamp the way Postgres prints a timestamptz in UTC: "YYYY-MM-DD HH:MM:SS",
+ * then the fraction of a second without trailing zeros if there is one, then "+00".
+ * out must hold MAX_TIMESTAMP_LENGTH characters.
+ * @return characters written
+ */
+size_t format_timestamp(EpochMicros micros, char* out);
+std::string format_timestamp(EpochMicros micros);
+
+/**
+ * @brief Parse a timestamp as format_timestamp() writes it, e.g. from a pagination cursor
+ * @return std::nullopt unless it is exactly that format and a real point in time
+ */
+std::optional<EpochMicros> parse_timestamp(std::string_view text);
+}   // namespace mkm
@@ -0,0 +1,53 @@
+#include "feelings.h"
+
+namespace mkm
+{
+    std::optional<uint8_t> FeelingDictionary::find(std::string_view name) const
+    {
+        const size_t size = size_.load(std::memory_order_acquire);
+        for (size_t id = 0; id < size; id++)
+        {
+            if (names_[id] == name)
+            {
+                return static_cast<uint8_t>(id);
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::optional<uint8_t> FeelingDictionary::intern(std::string_view name)
+    {
+        if (auto id = find(name))
+        {
+            return id;
+        }
+        std::lock_guard lock(intern_mutex_);
+        // Someone else may have added it meanwhile
+        if (auto id = find(name))
+        {
+            return id;
+        }
+        const size_t id = size_.load(std::memory_order_relaxed);
+        if (id == names_.size())
+        {
+            return std::nullopt;
+        }
+        names_[id] = std::string(name);
+        size_.store(id + 1, std::memory_order_release);
+        return static_cast<uint8_t>(id);
+    }
+
+    std::vector<std::string> FeelingDictionary::names(const FeelingSet& feelings) const
+    {
+        std::vector<std::string> result;
+        result.reserve(feelings.size());
+        feelings.for_each([&](uint8_t id) { result.emplace_back(name(id)); });
+        return result;
+    }
+
+    FeelingDictionary& feeling_dictionary()
+    {
+        static FeelingDictionary dictionary;
+        return dictionary;
+    }
+}
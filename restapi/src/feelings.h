@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mkm
+{
+/**
+ * @brief The feelings of a moment, as a bitset over FeelingDictionary ids. Feelings are a set:
+ * each one counts once and they are listed in id order.
+ */
+class FeelingSet
+{
+public:
+    static constexpr size_t CAPACITY = 64;
+
+    void add(uint8_t id) { bits_ |= uint64_t{1} << id; }
+    bool contains(uint8_t id) const { return (bits_ >> id) & 1; }
+    bool empty() const { return bits_ == 0; }
+    size_t size() const { return static_cast<size_t>(__builtin_popcountll(bits_)); }
+
+    template<typename Visit>
+    void for_each(Visit&& visit) const
+    {
+        for (uint64_t bits = bits_; bits != 0; bits &= bits - 1)
+        {
+            visit(static_cast<uint8_t>(__builtin_ctzll(bits)));
+        }
+    }
+
+    bool operator==(const FeelingSet& other) const { return bits_ == other.bits_; }
+    bool operator!=(const FeelingSet& other) const { return bits_ != other.bits_; }
+
+private:
+    uint64_t bits_ = 0;
+};
+
+/**
+ * @brief Feeling names interned as small integers, so that moments don't carry strings for them.
+ * Filled from the feelings table at startup (see load_feelings()), in name order. Names found in
+ * stored moments but missing from the table are added as they are read, while there is room.
+ * Names are never removed or changed, so lookups take no lock and name() views stay valid.
+ */
+class FeelingDictionary
+{
+public:
+    std::optional<uint8_t> find(std::string_view name) const;
+
+    /**
+     * @brief find(), adding name if it isn't known yet
+     * @return std::nullopt if it isn't known and the dictionary is full
+     */
+    std::optional<uint8_t> intern(std::string_view name);
+
+    std::string_view name(uint8_t id) const { return names_[id]; }
+
+    size_t size() const { return size_.load(std::memory_order_acquire); }
+
+    std::vector<std::string> names(const FeelingSet& feelings) const;
+
+private:
+    std::array<std::string, FeelingSet::CAPACITY> names_;
+    std::atomic<size_t> size_{0};
+    // Serializes intern(), readers go by size_ alone
+    std::mutex intern_mutex_;
+};
+
+FeelingDictionary& feeling_dictionary();
+}   // namespace mkm
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace mkm
+{
+/**
+ * @brief Keeps a cache filled by readers from storing values that a concurrent write already made
+ * stale. Writers call invalidate() after committing and then erase the entry. Readers take a
+ * generation() before querying and store through put(), which drops the value if a write to the
+ * same key happened meanwhile - otherwise a slow reader could cache something older than the write.
+ *
+ * Keys hash onto a fixed set of counters; a collision only costs an occasional skipped put().
+ */
+template<typename Key, typename Hash = std::hash<Key>, size_t Slots = 256>
+class GenerationGuard
+{
+public:
+    uint64_t generation(const Key& key) const
+    {
+        return slot(key).load(std::memory_order_acquire);
+    }
+
+    void invalidate(const Key& key)
+    {
+        slot(key).fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    /**
+     * @brief Put value into a ShardedLruCache under cache_key, unless key moved past generation
+     */
+    template<typename Cache, typename CacheKey, typename Value>
+    void put(Cache& cache, const Key& key, uint64_t generation, const CacheKey& cache_key, Value value,
+             typename Cache::Clock::time_point expires_at)
+    {
+        if (this->generation(key) != generation)
+        {
+            return;
+        }
+        cache.put(cache_key, std::move(value), expires_at);
+        // An invalidate() that slipped in between the check and the put must still win
+        if (this->generation(key) != generation)
+        {
+            cache.erase(cache_key);
+        }
+    }
+
+private:
+    std::atomic<uint64_t>& slot(const Key& key)
+    {
+        return generations_[Hash{}(key) % Slots];
+    }
+
+    const std::atomic<uint64_t>& slot(const Key& key) const
+    {
+        return generations_[Hash{}(key) % Slots];
+    }
+
+    std::array<std::atomic<uint64_t>, Slots> generations_{};
+};
+}   // namespace mkm
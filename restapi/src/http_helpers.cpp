@@ -0,0 +1,132 @@
+#include "http_helpers.h"
+#include "async_log.h"
+#include "token_cache.h"
+#include "tracing.h"
+
+#include <jwt-cpp/jwt.h>
+
+#include <cstdio>
+#include <string_view>
+#include <utility>
+
+namespace mkm
+{
+    std::optional<std::string> validate_string(std::string_view str, size_t max_length, const std::string& field_name)
+    {
+        if (str.empty())
+        {
+            return field_name + " cannot be empty";
+        }
+        if (str.length() > max_length)
+        {
+            return field_name + " exceeds maximum length of " + std::to_string(max_length);
+        }
+        if (str.find_first_of("\0\n\r") != std::string::npos)
+        {
+            return field_name + " contains invalid characters";
+        }
+        return std::nullopt;
+    }
+
+    bool verify_authorization_header(const crow::request& req, std::string& username)
+    {
+        Span span("auth", "verify_authorization_header");
+        const auto& headers_it = req.headers.find("Authorization");
+        if (headers_it == req.headers.end())
+        {
+            MKM_LOG_ERROR(AUTH) << "Missing Authorization header";
+            return false;
+        }
+
+        const std::string_view token = extract_bearer_token(headers_it->second);
+        if (token.empty())
+        {
+            MKM_LOG_ERROR(AUTH) << "Invalid Authorization header format";
+            return false;
+        }
+
+        const auto digest = TokenCache::digest(token);
+        if (auto cached_username = token_cache().lookup(digest))
+        {
+            username = std::move(*cached_username);
+            return true;
+        }
+
+        try
+        {
+            auto decoded_token = jwt::decode(std::string(token));
+            auto verifier = jwt::verify()
+                               .allow_algorithm(jwt::algorithm::hs512{JWT_SECRET})
+                               .with_issuer("MKM");
+            verifier.verify(decoded_token);
+
+            username = decoded_token.get_payload_claim("username").as_string();
+            if (username.empty())
+            {
+                MKM_LOG_ERROR(AUTH) << "Empty username in token";
+                return false;
+            }
+            // Only tokens with an expiry are cached, so that an entry can never outlive its token
+            if (decoded_token.has_expires_at())
+            {
+                token_cache().remember(digest, username, decoded_token.get_expires_at());
+            }
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            MKM_LOG_ERROR(AUTH) << "Token verification error: " << e.what();
+            return false;
+        }
+    }
+
+    void write_moment_json(JsonWriter& json, const Moment& moment)
+    {
+        json.begin_object();
+        json.field("id", moment.id);
+        json.field("title", moment.title);
+        json.field("description", moment.description);
+        char date[MAX_TIMESTAMP_LENGTH];
+        json.field("date", std::string_view(date, format_date(moment.date, date)));
+        json.field("image_filename", moment.image_filename);
+        json.field("image_caption", moment.image_caption);
+        json.field("created_date", std::string_view(date, format_timestamp(moment.created_date, date)));
+        json.field("last_modified_date", std::string_view(date, format_timestamp(moment.last_modified_date, date)));
+        json.key("feelings");
+        json.begin_array();
+        const auto& dictionary = feeling_dictionary();
+        moment.feelings.for_each([&](uint8_t id) { json.value(dictionary.name(id)); });
+        json.end_array();
+        if (!moment.image_filename.empty())
+        {
+            constexpr std::string_view thumbnail_query = "?size=thumb";
+            char thumbnail_url[64];
+            const int length = std::snprintf(thumbnail_url, sizeof(thumbnail_url), "/moments/%llu/image?size=thumb",
+                                             static_cast<unsigned long long>(moment.id));
+            const std::string_view url(thumbnail_url, static_cast<size_t>(length));
+            json.field("image_url", url.substr(0, url.size() - thumbnail_query.size()));
+            // Until the thumbnail exists the image endpoint falls back to the original
+            json.field("thumbnail_url", url);
+            json.field("thumbnail_ready", moment.derivative_status == DerivativeStatus::READY);
+        }
+        else
+        {
+            json.key("image_url");
+            json.null();
+            json.key("thumbnail_url");
+            json.null();
+            json.field("thumbnail_ready", false);
+        }
+        json.end_object();
+    }
+
+    void write_moments_json(JsonWriter& json, const std::vector<Moment>& moments)
+    {
+        json.begin_array();
+        for (const auto& moment : moments)
+        {
+            write_moment_json(json, moment);
+        }
+        json.end_array();
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Moment.h"
+#include "json_writer.h"
+#include "tracing.h"
+
+#include <crow/http_request.h>
+#include <crow/http_response.h>
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mkm
+{
+constexpr const char* JWT_SECRET = "secret";           // Should be loaded from config
+constexpr int JWT_EXPIRY_SECONDS = 3600;               // 1 hour
+
+/**
+ * @brief Validates string length and content
+ * @param str String to validate
+ * @param max_length Maximum allowed length
+ * @param field_name Field name for error messages
+ * @return std::optional<std::string> Error message if invalid, empty if valid
+ */
+std::optional<std::string> validate_string(std::string_view str, size_t max_length, const std::string& field_name);
+
+/**
+ * @brief Verify the authorization header and extract username.
+ * Tokens that verified before are answered from the token cache until they expire.
+ */
+bool verify_authorization_header(const crow::request& req, std::string& username);
+
+/**
+ * @brief Write a moment's JSON representation. The image itself is referenced by image_url rather
+ * than inlined.
+ */
+void write_moment_json(JsonWriter& json, const Moment& moment);
+
+/**
+ * @brief Write moments as a JSON array
+ */
+void write_moments_json(JsonWriter& json, const std::vector<Moment>& moments);
+
+/**
+ * @brief 200 response with the JSON write produces as its body. It is written into a buffer
+ * the thread keeps reusing, so only the body itself is allocated.
+ */
+template<typename Write>
+crow::response json_response(Write&& write)
+{
+    Span span("json", "serialize");
+    thread_local std::string buffer;
+    buffer.clear();
+    JsonWriter json(buffer);
+    write(json);
+    crow::response response(crow::status::OK, buffer);
+    response.set_header("Content-Type", "application/json");
+    return response;
+}
+}   // namespace mkm
@@ -0,0 +1,215 @@
+#include "image_store.h"
+#include "config_env.h"
+
+#include <openssl/evp.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mkm
+{
+    namespace
+    {
+        [[noreturn]] void throw_errno(const std::string& what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+        std::string to_hex(const unsigned char* data, size_t size)
+        {
+            static constexpr char digits[] = "0123456789abcdef";
+            std::string hex;
+            hex.reserve(size * 2);
+            for (size_t i = 0; i < size; i++)
+            {
+                hex += digits[data[i] >> 4];
+                hex += digits[data[i] & 0x0f];
+            }
+            return hex;
+        }
+    }
+
+    ImageStore::Writer::Writer(const ImageStore& store, int fd, std::filesystem::path temp_path)
+        : store_(&store), fd_(fd), temp_path_(std::move(temp_path)), digest_ctx_(EVP_MD_CTX_new())
+    {
+        if (digest_ctx_ == nullptr || EVP_DigestInit_ex(digest_ctx_, EVP_sha256(), nullptr) != 1)
+        {
+            EVP_MD_CTX_free(digest_ctx_);
+            ::close(fd_);
+            ::unlink(temp_path_.c_str());
+            throw std::runtime_error("Could not initialise SHA-256 context");
+        }
+    }
+
+    ImageStore::Writer::Writer(Writer&& other) noexcept
+        : store_(other.store_),
+          fd_(std::exchange(other.fd_, -1)),
+          temp_path_(std::move(other.temp_path_)),
+          digest_ctx_(std::exchange(other.digest_ctx_, nullptr)),
+          size_(other.size_)
+    {
+    }
+
+    ImageStore::Writer::~Writer()
+    {
+        // Not committed - throw away the partial file
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            ::unlink(temp_path_.c_str());
+        }
+        EVP_MD_CTX_free(digest_ctx_);
+    }
+
+    void ImageStore::Writer::write(const void* data, size_t size)
+    {
+        if (EVP_DigestUpdate(digest_ctx_, data, size) != 1)
+        {
+            throw std::runtime_error("SHA-256 update failed");
+        }
+        const char* cursor = static_cast<const char*>(data);
+        size_t remaining = size;
+        while (remaining > 0)
+        {
+            const ssize_t written = ::write(fd_, cursor, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw_errno("Writing image to " + temp_path_.string());
+            }
+            cursor += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        size_ += size;
+    }
+
+    StoredImage ImageStore::Writer::commit()
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_size = 0;
+        if (EVP_DigestFinal_ex(digest_ctx_, digest, &digest_size) != 1)
+        {
+            throw std::runtime_error("SHA-256 finalisation failed");
+        }
+        StoredImage stored{to_hex(digest, digest_size), size_};
+
+        const std::filesystem::path target = store_->path_for(stored.hash);
+        std::error_code ec;
+        if (std::filesystem::exists(target, ec))
+        {
+            // Same bytes are already stored - keep the existing file
+            ::close(std::exchange(fd_, -1));
+            ::unlink(temp_path_.c_str());
+            return stored;
+        }
+
+        if (::fsync(fd_) != 0)
+        {
+            throw_errno("Syncing " + temp_path_.string());
+        }
+        ::close(std::exchange(fd_, -1));
+
+        std::filesystem::create_directories(target.parent_path());
+        // rename() is atomic - concurrent uploads of the same image just replace identical bytes
+        if (::rename(temp_path_.c_str(), target.c_str()) != 0)
+        {
+            const int rename_errno = errno;
+            ::unlink(temp_path_.c_str());
+            errno = rename_errno;
+            throw_errno("Moving image into " + target.string());
+        }
+        return stored;
+    }
+
+    ImageStore::ImageStore(std::filesystem::path root)
+        : root_(std::move(root))
+    {
+        std::filesystem::create_directories(root_ / "tmp");
+    }
+
+    ImageStore::Writer ImageStore::begin() const
+    {
+        // Temporary files live inside the store so that the final rename never crosses filesystems
+        std::string temp_path = (root_ / "tmp" / "upload-XXXXXX").string();
+        const int fd = ::mkstemp(temp_path.data());
+        if (fd < 0)
+        {
+            throw_errno("Creating temporary image file");
+        }
+        return Writer(*this, fd, temp_path);
+    }
+
+    StoredImage ImageStore::put(std::string_view content) const
+    {
+        Writer writer = begin();
+        writer.write(content.data(), content.size());
+        return writer.commit();
+    }
+
+    std::filesystem::path ImageStore::path_for(std::string_view hash) const
+    {
+        if (!is_valid_hash(hash))
+        {
+            throw std::invalid_argument("Invalid image hash");
+        }
+        return root_ / hash.substr(0, 2) / hash.substr(2, 2) / hash;
+    }
+
+    std::string ImageStore::read_range(std::string_view hash, uint64_t offset, uint64_t length) const
+    {
+        const std::filesystem::path path = path_for(hash);
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            throw_errno("Opening " + path.string());
+        }
+
+        std::string content(length, '\0');
+        size_t read_total = 0;
+        while (read_total < length)
+        {
+            const ssize_t n = ::pread(fd, content.data() + read_total, length - read_total,
+                                      static_cast<off_t>(offset + read_total));
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                const int read_errno = errno;
+                ::close(fd);
+                if (n == 0)
+                {
+                    throw std::runtime_error("Image " + path.string() + " is shorter than expected");
+                }
+                errno = read_errno;
+                throw_errno("Reading " + path.string());
+            }
+            read_total += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        return content;
+    }
+
+    bool ImageStore::is_valid_hash(std::string_view hash)
+    {
+        return hash.size() == 64 && hash.find_first_not_of("0123456789abcdef") == std::string_view::npos;
+    }
+
+    const ImageStore& image_store()
+    {
+        static const ImageStore store(std::filesystem::path(env_or("MKM_IMAGE_STORE_DIR", "image_store")));
+        return store;
+    }
+}
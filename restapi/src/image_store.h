@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// OpenSSL's EVP_MD_CTX
+struct evp_md_ctx_st;
+
+namespace mkm
+{
+struct StoredImage
+{
+    // Lower-case hex SHA-256 of the content, also its name inside the store
+    std::string hash;
+    uint64_t size;
+};
+
+/**
+ * @brief Content-addressed store for uploaded images.
+ *
+ * Every image lives once under <root>/<hash[0:2]>/<hash[2:4]>/<hash>, so identical uploads share
+ * a single file and only the hash needs to be kept in Postgres. Files are written to a temporary
+ * name first and renamed into place, so readers never see a partial image.
+ */
+class ImageStore
+{
+public:
+    /**
+     * @brief Incrementally hashes and writes one image, e.g. while an upload is being parsed
+     */
+    class Writer
+    {
+    public:
+        Writer(Writer&& other) noexcept;
+        Writer& operator=(Writer&&) = delete;
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+        ~Writer();
+
+        void write(const void* data, size_t size);
+
+        /**
+         * @brief Finish the file and move it to its content address. If the store already held the
+         * same content the new copy is discarded.
+         */
+        StoredImage commit();
+
+    private:
+        friend class ImageStore;
+        Writer(const ImageStore& store, int fd, std::filesystem::path temp_path);
+
+        const ImageStore* store_;
+        int fd_;
+        std::filesystem::path temp_path_;
+        evp_md_ctx_st* digest_ctx_;
+        uint64_t size_ = 0;
+    };
+
+    explicit ImageStore(std::filesystem::path root);
+
+    Writer begin() const;
+
+    StoredImage put(std::string_view content) const;
+
+    std::filesystem::path path_for(std::string_view hash) const;
+
+    /**
+     * @brief Read length bytes at offset straight from the stored file, for range requests
+     */
+    std::string read_range(std::string_view hash, uint64_t offset, uint64_t length) const;
+
+    static bool is_valid_hash(std::string_view hash);
+
+    const std::filesystem::path& root() const { return root_; }
+
+private:
+    std::filesystem::path root_;
+};
+
+/**
+ * @brief Process-wide store rooted at MKM_IMAGE_STORE_DIR (default "image_store")
+ */
+const ImageStore& image_store();
+}   // namespace mkm
@@ -0,0 +1,104 @@
+#include "json_writer.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace mkm
+{
+    namespace
+    {
+        constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+        bool needs_escape(unsigned char c)
+        {
+            return c == '"' || c == '\\' || c < 0x20;
+        }
+
+        void append_escaped(std::string& out, unsigned char c)
+        {
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\b':
+                out += "\\b";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                {
+                    const char escaped[] = {'\\', 'u', '0', '0', HEX_DIGITS[c >> 4], HEX_DIGITS[c & 0xf]};
+                    out.append(escaped, sizeof(escaped));
+                }
+            }
+        }
+
+        /**
+         * Offset of the first character at or after from that needs escaping, value.size() if none.
+         * Text rarely needs any, so this checks 16 bytes at a time where SSE2 is available.
+         */
+        size_t find_escape(std::string_view value, size_t from)
+        {
+            size_t i = from;
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i last_control = _mm_set1_epi8(0x1f);
+            for (; i + 16 <= value.size(); i += 16)
+            {
+                const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(value.data() + i));
+                // Unsigned c <= 0x1f is the same as min(c, 0x1f) == c
+                const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(chunk, last_control), chunk);
+                const __m128i special = _mm_or_si128(
+                    _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)), control);
+                const int mask = _mm_movemask_epi8(special);
+                if (mask != 0)
+                {
+                    return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+                }
+            }
+#endif
+            for (; i < value.size(); i++)
+            {
+                if (needs_escape(static_cast<unsigned char>(value[i])))
+                {
+                    return i;
+                }
+            }
+            return value.size();
+        }
+    }
+
+    void append_json_string(std::string& out, std::string_view value)
+    {
+        out += '"';
+        size_t start = 0;
+        while (start < value.size())
+        {
+            const size_t special = find_escape(value, start);
+            out.append(value.data() + start, special - start);
+            if (special == value.size())
+            {
+                break;
+            }
+            append_escaped(out, static_cast<unsigned char>(value[special]));
+            start = special + 1;
+        }
+        out += '"';
+    }
+}
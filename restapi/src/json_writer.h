@@ -0,0 +1,122 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace mkm
+{
+/**
+ * @brief Append value to out as a JSON string, quotes included
+ */
+void append_json_string(std::string& out, std::string_view value);
+
+/**
+ * @brief Writes JSON straight into a string, without building a document first. Callers are
+ * trusted to nest objects and arrays properly and to name every object member with key().
+ */
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::string& out)
+        : out_(out)
+    {
+    }
+
+    void begin_object()
+    {
+        separate();
+        out_ += '{';
+        need_comma_ = false;
+    }
+
+    void end_object()
+    {
+        out_ += '}';
+        need_comma_ = true;
+    }
+
+    void begin_array()
+    {
+        separate();
+        out_ += '[';
+        need_comma_ = false;
+    }
+
+    void end_array()
+    {
+        out_ += ']';
+        need_comma_ = true;
+    }
+
+    // Keys are written as they are, they must not need escaping
+    void key(std::string_view name)
+    {
+        separate();
+        out_ += '"';
+        out_ += name;
+        out_ += "\":";
+        need_comma_ = false;
+    }
+
+    void value(std::string_view text)
+    {
+        separate();
+        append_json_string(out_, text);
+        need_comma_ = true;
+    }
+
+    void value(const char* text) { value(std::string_view(text)); }
+    void value(const std::string& text) { value(std::string_view(text)); }
+
+    void value(bool flag)
+    {
+        separate();
+        out_ += flag ? "true" : "false";
+        need_comma_ = true;
+    }
+
+    void value(uint64_t number) { integer(number); }
+    void value(int64_t number) { integer(number); }
+    void value(int number) { integer(number); }
+
+    void null()
+    {
+        separate();
+        out_ += "null";
+        need_comma_ = true;
+    }
+
+    template<typename T>
+    void field(std::string_view name, const T& field_value)
+    {
+        key(name);
+        value(field_value);
+    }
+
+private:
+    void separate()
+    {
+        if (need_comma_)
+        {
+            out_ += ',';
+        }
+    }
+
+    template<typename Integer>
+    void integer(Integer number)
+    {
+        separate();
+        char digits[24];
+        const auto result = std::to_chars(digits, digits + sizeof(digits), number);
+        out_.append(digits, result.ptr);
+        need_comma_ = true;
+    }
+
+    std::string& out_;
+    // Whether something was written at this level since the last '{', '[' or key
+    bool need_comma_ = false;
+};
+}   // namespace mkm
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace mkm
+{
+// Every entry counts as one, making the capacity of a ShardedLruCache a number of entries
+struct UnitWeight
+{
+    template<typename Key, typename Value>
+    size_t operator()(const Key&, const Value&) const noexcept { return 1; }
+};
+
+/**
+ * @brief Thread-safe LRU cache split into independently locked shards, so that concurrent
+ * requests rarely contend on the same mutex. Each shard holds capacity / Shards worth of entries,
+ * as measured by Weigh - by default their number. Entries may carry an expiry time after which
+ * they are treated as absent.
+ */
+template<typename Key, typename Value, typename Hash = std::hash<Key>, size_t Shards = 16, typename Weigh = UnitWeight>
+class ShardedLruCache
+{
+public:
+    using Clock = std::chrono::system_clock;
+
+    // Counted since construction; relaxed, so only consistent with each other over time
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t weight;
+    };
+
+    explicit ShardedLruCache(size_t capacity)
+        : shard_capacity_(std::max<size_t>(1, capacity / Shards))
+    {
+    }
+
+    std::optional<Value> get(const Key& key)
+    {
+        Shard& shard = shard_for(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+        {
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        if (it->second->expires_at <= Clock::now())
+        {
+            remove(shard, it);
+            misses_.fetch_add(1, std::memory_order_relaxed);
+            return std::nullopt;
+        }
+        // Most recently used entries live at the front
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return it->second->value;
+    }
+
+    void put(const Key& key, Value value, Clock::time_point expires_at = Clock::time_point::max())
+    {
+        const size_t weight = Weigh{}(key, value);
+        Shard& shard = shard_for(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            remove(shard, it);
+        }
+        // Something that alone outweighs a shard would only flush everything else out
+        if (weight > shard_capacity_)
+        {
+            return;
+        }
+        while (!shard.entries.empty() && shard.weight + weight > shard_capacity_)
+        {
+            remove(shard, shard.index.find(shard.entries.back().key));
+            evictions_.fetch_add(1, std::memory_order_relaxed);
+        }
+        shard.entries.push_front(Entry{key, std::move(value), expires_at, weight});
+        shard.index.emplace(key, shard.entries.begin());
+        shard.weight += weight;
+        weight_.fetch_add(weight, std::memory_order_relaxed);
+    }
+
+    void erase(const Key& key)
+    {
+        Shard& shard = shard_for(key);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+        {
+            remove(shard, it);
+        }
+    }
+
+    Stats stats() const
+    {
+        return {hits_.load(std::memory_order_relaxed),
+                misses_.load(std::memory_order_relaxed),
+                evictions_.load(std::memory_order_relaxed),
+                weight_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        Value value;
+        Clock::time_point expires_at;
+        size_t weight;
+    };
+
+    using Index = std::unordered_map<Key, typename std::list<Entry>::iterator, Hash>;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> entries;
+        Index index;
+        size_t weight = 0;
+    };
+
+    // Caller holds shard.mutex
+    void remove(Shard& shard, typename Index::iterator it)
+    {
+        const size_t weight = it->second->weight;
+        shard.weight -= weight;
+        weight_.fetch_sub(weight, std::memory_order_relaxed);
+        shard.entries.erase(it->second);
+        shard.index.erase(it);
+    }
+
+    Shard& shard_for(const Key& key)
+    {
+        // Mix the bits so that hashes which only differ in the low bits still spread out
+        const size_t hash = Hash{}(key);
+        return shards_[(hash ^ (hash >> 17)) % Shards];
+    }
+
+    const size_t shard_capacity_;
+    std::array<Shard, Shards> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+    std::atomic<size_t> weight_{0};
+};
+}   // namespace mkm
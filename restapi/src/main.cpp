@@ -1,16 +1,37 @@
 #include "db_utils.h"
+#include "db_pool.h"
+#include "image_store.h"
+#include "derivatives.h"
+#include "password_hashing.h"
+#include "multipart_stream.h"
+#include "http_helpers.h"
+#include "metrics.h"
+#include "tracing.h"
+#include "async_log.h"
+#include "compression.h"
+#include "moment_detail_cache.h"
+#include "moment_import.h"
+#include "request_arena.h"
 #include <iostream>
 #include <iomanip>
 #include <string>
 #include <tuple>
-#include <regex>
 #include <optional>
 #include <cstddef>
 #include <variant>
 #include <vector>
 #include <sstream>
 #include <chrono>
+#include <ctime>
 #include <limits>
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <csignal>
+#include <memory_resource>
+#include <stdexcept>
 #include "crow.h"
 #include "crow/middlewares/cors.h"
 #include <pqxx/pqxx>
@@ -21,161 +42,701 @@
 // Constants
 constexpr size_t MAX_REQUEST_SIZE = 10 * 1024 * 1024;  // 10MB
 constexpr size_t MAX_FIELD_LENGTH = 1024;              // 1KB
-constexpr const char* JWT_SECRET = "secret";           // Should be loaded from config
-constexpr int JWT_EXPIRY_SECONDS = 3600;              // 1 hour
+constexpr size_t MAX_DESCRIPTION_LENGTH = 2000;        // moments.description
+constexpr size_t MAX_IMPORT_REQUEST_SIZE = 64 * 1024 * 1024;  // 64MB, a full import of long moments
+constexpr uint64_t DEFAULT_PAGE_SIZE = 20;
+constexpr uint64_t MAX_PAGE_SIZE = 100;
+
+/**
+ * @brief Method name for logs and metric labels
+ */
+static std::string method_name(crow::HTTPMethod method) {
+    switch (method) {
+        case crow::HTTPMethod::GET: return "GET";
+        case crow::HTTPMethod::POST: return "POST";
+        case crow::HTTPMethod::PUT: return "PUT";
+        case crow::HTTPMethod::DELETE: return "DELETE";
+        case crow::HTTPMethod::OPTIONS: return "OPTIONS";
+        default: return "UNKNOWN";
+    }
+}
+
+/**
+ * @brief Route label for metrics and traces: the template of one of the routes below, or "unmatched"
+ * for paths no route serves. Those are answered 404 before authentication, so folding them keeps
+ * arbitrary URLs from adding series. Keep the list in step with the CROW_ROUTEs in main().
+ */
+static std::string route_label(const crow::request& req) {
+    static const std::unordered_set<std::string> routes = {
+        "/", "/metrics", "/create-account", "/login", "/moments/total", "/moments", "/addmoment",
+        "/update/<uint>", "/moments/import", "/moments/batch/update", "/moments/batch/delete",
+        "/moments/<uint>", "/moments/<uint>/image",
+    };
+    std::string route = mkm::metrics_route(req.url);
+    return routes.count(route) != 0 ? route : "unmatched";
+}
 
 struct RequestLogger {
     struct context {};
 
     void before_handle(crow::request& req, crow::response&, context&) {
-        CROW_LOG_DEBUG << "Before request handle: " << req.url 
-                      << " [Method: " << method_name(req.method) << "]";
+        MKM_LOG_DEBUG(HTTP) << "Before request handle: " << req.url 
+                           << " [Method: " << method_name(req.method) << "]";
     }
 
     void after_handle(crow::request& req, crow::response& res, context&) {
-        CROW_LOG_DEBUG << "After request handle: " << req.url 
-                      << " [Status: " << res.code << "]";
-    }
-
-private:
-    static std::string method_name(crow::HTTPMethod method) {
-        switch (method) {
-            case crow::HTTPMethod::GET: return "GET";
-            case crow::HTTPMethod::POST: return "POST";
-            case crow::HTTPMethod::PUT: return "PUT";
-            case crow::HTTPMethod::DELETE: return "DELETE";
-            default: return "UNKNOWN";
+        MKM_LOG_DEBUG(HTTP) << "After request handle: " << req.url 
+                           << " [Status: " << res.code << "]";
+    }
+};
+
+/**
+ * @brief Decides whether a request is traced and records its whole span. Handlers that continue
+ * on another thread carry the trace along, see run_on_io_thread().
+ */
+struct RequestTracer {
+    struct context {
+        uint64_t trace = 0;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    void before_handle(crow::request&, crow::response&, context& ctx) {
+        ctx.trace = mkm::tracer().sample();
+        // Also ends whatever trace the previous request left on this thread
+        mkm::set_current_trace(ctx.trace);
+        if (ctx.trace != 0) {
+            ctx.started = std::chrono::steady_clock::now();
+        }
+    }
+
+    void after_handle(crow::request& req, crow::response& res, context& ctx) {
+        if (ctx.trace == 0) {
+            return;
+        }
+        const std::string name = method_name(req.method) + " " + route_label(req) + " "
+            + std::to_string(res.code);
+        mkm::tracer().record(ctx.trace, "http", name, ctx.started, std::chrono::steady_clock::now());
+        if (mkm::current_trace() == ctx.trace) {
+            mkm::set_current_trace(0);
         }
     }
 };
 
 /**
- * @brief Validates string length and content
- * @param str String to validate
- * @param max_length Maximum allowed length
- * @param field_name Field name for error messages
- * @return std::optional<std::string> Error message if invalid, empty if valid
+ * @brief Records request counts, latencies and sizes for /metrics.
+ * Crow runs after_handle once the response is complete, so asynchronous handlers are timed up to
+ * their res.end() as well.
  */
-static std::optional<std::string> validate_string(const std::string& str, 
-                                                size_t max_length,
-                                                const std::string& field_name) {
-    if (str.empty()) {
-        return field_name + " cannot be empty";
+struct RequestMetrics {
+    struct context {
+        std::chrono::steady_clock::time_point started;
+        std::string route;
+    };
+
+    void before_handle(crow::request& req, crow::response&, context& ctx) {
+        ctx.started = std::chrono::steady_clock::now();
+        ctx.route = route_label(req);
+        mkm::metrics().request_started(ctx.route, method_name(req.method));
     }
-    if (str.length() > max_length) {
-        return field_name + " exceeds maximum length of " + std::to_string(max_length);
+
+    void after_handle(crow::request& req, crow::response& res, context& ctx) {
+        // Static files are sent from disk after this point, their body is still empty here
+        const size_t response_bytes = !res.file_info.path.empty() && res.file_info.statResultGood
+            ? static_cast<size_t>(res.file_info.statResult.st_size)
+            : res.body.size();
+        mkm::metrics().request_finished(ctx.route, method_name(req.method), res.code,
+                                        std::chrono::steady_clock::now() - ctx.started,
+                                        req.body.size(), response_bytes);
     }
-    if (str.find_first_of("\0\n\r") != std::string::npos) {
-        return field_name + " contains invalid characters";
+};
+
+/**
+ * @brief Compresses JSON and text bodies for clients that accept gzip or deflate. Images and small
+ * bodies go out as they are. Listed last, so that its after_handle runs first and the others,
+ * metrics included, see the response as sent.
+ */
+struct ResponseCompression {
+    struct context {};
+
+    void before_handle(crow::request&, crow::response&, context&) {}
+
+    void after_handle(crow::request& req, crow::response& res, context&) {
+        const auto& config = mkm::compression_config();
+        if (!config.enabled || res.body.size() < config.min_bytes || !res.file_info.path.empty()
+            || !res.get_header_value("Content-Encoding").empty()
+            || !mkm::compressible_type(res.get_header_value("Content-Type"))) {
+            return;
+        }
+        // Whatever is decided here depended on Accept-Encoding
+        const auto& vary = res.get_header_value("Vary");
+        res.set_header("Vary", vary.empty() ? std::string("Accept-Encoding") : vary + ", Accept-Encoding");
+
+        const auto encoding = mkm::negotiate_encoding(req.get_header_value("Accept-Encoding"));
+        if (encoding == mkm::ContentEncoding::IDENTITY) {
+            return;
+        }
+        mkm::Span span("http", "compress");
+        // Swapped with the body, so each thread keeps reusing the capacity of earlier responses
+        thread_local std::string compressed;
+        if (!mkm::compress(res.body, encoding, config.level, compressed)) {
+            return;
+        }
+        res.body.swap(compressed);
+        res.set_header("Content-Encoding", mkm::encoding_name(encoding));
+        // A strong tag promises the same bytes for every encoding. etag_matches() compares weakly,
+        // so the W/ form a client sends back still matches.
+        const auto& etag = res.get_header_value("ETag");
+        if (!etag.empty() && etag.rfind("W/", 0) != 0) {
+            res.set_header("ETag", "W/" + etag);
+        }
     }
-    return std::nullopt;
+};
+
+/**
+ * @brief Run callback on the I/O thread that owns the request's connection. Crow responses are not
+ * thread-safe, so work finished on another thread must hand its result back this way.
+ */
+template<typename Callback>
+static void run_on_io_thread(const crow::request& req, crow::response& res, Callback callback) {
+    asio::post(*req.io_service, [&res, callback = std::move(callback), trace = mkm::current_trace()]() mutable {
+        if (!res.is_alive()) {
+            return;   // The client went away meanwhile
+        }
+        mkm::TraceScope scope(trace);
+        callback();
+    });
 }
 
 /**
- * @brief Verify the authorization header and extract username
+ * @brief Finish an asynchronous handler's response, unless the client went away meanwhile
  */
-static bool verify_authorization_header(const crow::request& req, std::string& username) {
-    const auto& headers_it = req.headers.find("Authorization");
-    if (headers_it == req.headers.end()) {
-        CROW_LOG_ERROR << "Missing Authorization header";
-        return false;
+static void complete_async(crow::response& res, crow::response response) {
+    if (!res.is_alive()) {
+        return;
     }
+    res = std::move(response);
+    res.end();
+}
 
-    const std::string& authorization_value = headers_it->second;
-    std::regex bearer_scheme_regex("Bearer +([A-Za-z0-9_\\-.~+]+[=]*)");
-    std::smatch m;
-    if (!std::regex_match(authorization_value, m, bearer_scheme_regex)) {
-        CROW_LOG_ERROR << "Invalid Authorization header format";
-        return false;
+/**
+ * @brief Status for a failed asynchronous query: shed queries ask the client to retry shortly
+ */
+static crow::response db_error_response(mkm::ErrorCode error) {
+    switch (error) {
+    case mkm::ErrorCode::DATABASE_BUSY: {
+        crow::response response(crow::status::SERVICE_UNAVAILABLE, mkm::error_str(error));
+        response.set_header("Retry-After", "1");
+        return response;
     }
+    case mkm::ErrorCode::INVALID_CURSOR:
+        return crow::response(crow::status::BAD_REQUEST, mkm::error_str(error));
+    case mkm::ErrorCode::USER_NOT_FOUND:
+    case mkm::ErrorCode::MOMENT_NOT_FOUND:
+        return crow::response(crow::status::NOT_FOUND, mkm::error_str(error));
+    default:
+        return crow::response(crow::status::INTERNAL_SERVER_ERROR, mkm::error_str(error));
+    }
+}
 
+/**
+ * @brief Response for requests shed because the password hashing pool is saturated
+ */
+static crow::response hashing_busy_response() {
+    crow::response response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+    response.set_header("Retry-After", "1");
+    return response;
+}
+
+/**
+ * @brief Store a validated account whose password has already been hashed
+ */
+static crow::response insert_account(const mkm::User& user_details) {
     try {
-        auto decoded_token = jwt::decode(m[1].str());
-        auto verifier = jwt::verify()
-                           .allow_algorithm(jwt::algorithm::hs512{JWT_SECRET})
-                           .with_issuer("MKM");
-        verifier.verify(decoded_token);
-        
-        username = decoded_token.get_payload_claim("username").as_string();
-        if (username.empty()) {
-            CROW_LOG_ERROR << "Empty username in token";
-            return false;
+        MKM_LOG_DEBUG(HTTP) << "Creating new account...";
+        if (!mkm::create_new_account(user_details)) {
+            return crow::response(crow::status::INTERNAL_SERVER_ERROR,
+                mkm::error_str(mkm::ErrorCode::INTERNAL_ERROR));
         }
-        return true;
+        MKM_LOG_INFO(HTTP) << "Account created successfully for user: " << user_details.username;
+        return crow::response(crow::status::OK);
+    } catch (const mkm::pool_timeout& e) {
+        MKM_LOG_ERROR(HTTP) << "Database pool exhausted in create-account: " << e.what();
+        return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+    } catch (const std::exception& e) {
+        MKM_LOG_ERROR(HTTP) << "Exception in create-account: " << e.what();
+        return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
     }
-    catch(const std::exception& e) {
-        CROW_LOG_ERROR << "Token verification error: " << e.what();
-        return false;
+}
+
+/**
+ * @brief Check the password and issue a token. Runs on the hashing pool.
+ */
+static crow::response login_response(const mkm::User& user, const std::string& password) {
+    if (!mkm::verify_password(password, user.password_hash)) {
+        return crow::response(crow::status::UNAUTHORIZED,
+            mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
     }
+
+    mkm::Span span("auth", "jwt_sign");
+    auto current_time = std::chrono::system_clock::now();
+    auto token = jwt::create()
+                .set_issuer("MKM")
+                .set_type("JWS")
+                .set_issued_at(current_time)
+                .set_expires_at(current_time + std::chrono::seconds{mkm::JWT_EXPIRY_SECONDS})
+                .set_payload_claim("username", jwt::claim(user.username))
+                .sign(jwt::algorithm::hs512{mkm::JWT_SECRET});
+
+    return mkm::json_response([&](mkm::JsonWriter& json) {
+        json.begin_object();
+        json.field("access_token", token);
+        json.field("username", user.username);
+        json.field("expires_in", mkm::JWT_EXPIRY_SECONDS);
+        json.end_object();
+    });
 }
 
 /**
- * @brief Get string value from multipart message
+ * @brief Get string value of a submitted form field
+ * @param part_value a std::string, or a std::pmr::string to keep the value in the request's arena
  */
+template<typename String>
 static bool get_part_value_string_if_present(
-    const crow::multipart::message& multi_part_message,
+    const mkm::StreamedForm& form,
     const char* part_name,
-    std::string& part_value) {
-    
-    auto it = multi_part_message.part_map.find(part_name);
-    if (it == multi_part_message.part_map.end() || it->second.body.empty()) {
+    String& part_value) {
+
+    const std::string* value = form.field(part_name);
+    if (value == nullptr || value->empty()) {
         return false;
     }
-    
-    if (it->second.body.length() > MAX_FIELD_LENGTH) {
-        throw std::runtime_error(std::string(part_name) + " exceeds maximum length");
-    }
-    
-    part_value = it->second.body;
+
+    part_value = *value;
     return true;
 }
 
 /**
- * @brief Extract file from multipart message
+ * @brief Parse a multipart/form-data request into form. The body is scanned in place and a file
+ * part goes straight to the image store, so the only full copy of an upload is the one on disk.
+ * @return std::optional<std::string> Error message for a 400 response, empty if the form was parsed
  */
-static bool create_file_from_part_value_if_present(
-    const crow::multipart::message& multi_part_message,
-    const char* part_name,
-    std::string& file_name,
-    std::vector<std::byte>& file_contents) {
-    
-    auto it = multi_part_message.part_map.find(part_name);
-    if (it == multi_part_message.part_map.end() || it->second.body.empty()) {
-        return false;
+static std::optional<std::string> parse_form(const crow::request& req, mkm::StreamedForm& form) {
+    const auto boundary = mkm::multipart_boundary(req.get_header_value("Content-Type"));
+    if (!boundary) {
+        return std::string("Invalid Content-Type");
+    }
+
+    const auto& content_length_str = req.get_header_value("Content-Length");
+    if (content_length_str.empty()) {
+        return std::string("Missing Content-Length");
+    }
+    try {
+        if (std::stoull(content_length_str) > MAX_REQUEST_SIZE) {
+            return std::string("Request too large");
+        }
+    } catch (const std::exception& e) {
+        return std::string("Invalid Content-Length");
     }
 
-    auto headers_it = it->second.headers.find("Content-Disposition");
-    if (headers_it == it->second.headers.end()) {
-        throw std::runtime_error("No Content-Disposition found");
+    try {
+        mkm::Span span("parse", "multipart");
+        mkm::MultipartParser parser(*boundary, form);
+        parser.feed(req.body);
+        parser.finish();
+    } catch (const mkm::multipart_error& e) {
+        return std::string(e.what());
     }
+    return std::nullopt;
+}
 
-    auto params_it = headers_it->second.params.find("filename");
-    if (params_it == headers_it->second.params.end()) {
-        throw std::runtime_error(std::string("Part '") + part_name + "' missing filename");
+/**
+ * @brief Split the comma separated feelings field of the moment forms
+ */
+static std::pmr::vector<std::string_view> split_feelings(std::string_view value) {
+    std::pmr::vector<std::string_view> feelings(mkm::request_memory());
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string_view::npos) {
+            end = value.size();
+        }
+        std::string_view feeling = value.substr(start, end - start);
+        const size_t first = feeling.find_first_not_of(' ');
+        if (first != std::string_view::npos) {
+            feeling = feeling.substr(first, feeling.find_last_not_of(' ') - first + 1);
+            feelings.push_back(feeling);
+        }
+        start = end + 1;
     }
+    return feelings;
+}
 
-    file_name = params_it->second;
-    if (file_name.length() > MAX_FIELD_LENGTH) {
-        throw std::runtime_error("Filename too long");
+/**
+ * @brief Copy the fields of an add/update moment form into moment. Fields left out stay empty.
+ * @return std::optional<std::string> Error message if a field is invalid
+ */
+static std::optional<std::string> moment_from_form(const mkm::StreamedForm& form, mkm::Moment& moment) {
+    get_part_value_string_if_present(form, "moment-title", moment.title);
+    // Scratch fields, in the request's arena like the moment's own
+    std::pmr::string date(mkm::request_memory());
+    get_part_value_string_if_present(form, "moment-date", date);
+    get_part_value_string_if_present(form, "moment-description", moment.description);
+    get_part_value_string_if_present(form, "moment-image-caption", moment.image_caption);
+    std::pmr::string feelings(mkm::request_memory());
+    get_part_value_string_if_present(form, "moment-feelings", feelings);
+    if (form.file()) {
+        moment.image_path = form.file()->hash;
+        moment.image_filename = form.file_name();
     }
 
-    if (it->second.body.length() > MAX_REQUEST_SIZE) {
-        throw std::runtime_error("File size too large");
+    for (const auto& [field, value] : {
+        std::make_pair("title", &moment.title),
+        std::make_pair("date", &date),
+        std::make_pair("image caption", &moment.image_caption),
+        std::make_pair("feelings", &feelings)
+    }) {
+        if (!value->empty()) {
+            if (auto error = mkm::validate_string(*value, MAX_FIELD_LENGTH, field)) {
+                return error;
+            }
+        }
     }
 
-    file_contents.clear();
-    std::transform(it->second.body.begin(),
-                  it->second.body.end(),
-                  std::back_inserter(file_contents),
-                  [](char c) { return std::byte(c); });
-    return true;
+    if (!date.empty()) {
+        const auto days = mkm::parse_date(date);
+        if (!days) {
+            return "Invalid date, expected YYYY-MM-DD";
+        }
+        moment.date = *days;
+    }
+    for (const std::string_view feeling : split_feelings(feelings)) {
+        const auto id = mkm::feeling_dictionary().find(feeling);
+        if (!id) {
+            return "Unknown feeling: " + std::string(feeling);
+        }
+        moment.feelings.add(*id);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Feed a bulk import request into import: an NDJSON body, or a multipart form whose
+ * "moments" part is the NDJSON
+ * @return std::optional<std::string> Error message for a 400 response, empty if the import was read
+ */
+static std::optional<std::string> parse_import(const crow::request& req, mkm::MomentImport& import) {
+    if (req.body.size() > MAX_IMPORT_REQUEST_SIZE) {
+        return std::string("Request too large");
+    }
+    try {
+        mkm::Span span("parse", "import");
+        const auto& content_type = req.get_header_value("Content-Type");
+        if (const auto boundary = mkm::multipart_boundary(content_type)) {
+            mkm::MultipartParser parser(*boundary, import);
+            parser.feed(req.body);
+            parser.finish();
+        } else if (content_type.rfind("application/x-ndjson", 0) == 0) {
+            import.feed(req.body);
+            import.finish();
+        } else {
+            return std::string("Invalid Content-Type");
+        }
+    } catch (const mkm::multipart_error& e) {
+        return std::string(e.what());
+    } catch (const mkm::import_error& e) {
+        return std::string(e.what());
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Read the "ids" array of a batch request, sorted and without duplicates
+ * @return std::optional<std::string> Error message if it is missing, malformed or too long
+ */
+static std::optional<std::string> batch_ids_from_json(const crow::json::rvalue& body, std::vector<uint64_t>& ids) {
+    if (body.t() != crow::json::type::Object || !body.has("ids") || body["ids"].t() != crow::json::type::List) {
+        return std::string("Missing ids");
+    }
+    const auto& list = body["ids"];
+    const size_t max_ids = mkm::moment_import_config().max_batch_ids;
+    if (list.size() == 0 || list.size() > max_ids) {
+        return "A batch takes between 1 and " + std::to_string(max_ids) + " ids";
+    }
+    ids.reserve(list.size());
+    for (const auto& item : list) {
+        if (item.t() != crow::json::type::Number || item.nt() != crow::json::num_type::Unsigned_integer) {
+            return std::string("ids must be moment ids");
+        }
+        ids.push_back(item.u());
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    return std::nullopt;
+}
+
+/**
+ * @brief Answer to a batch request: the ids it changed, under done_key, and those it didn't find
+ * @param requested sorted and without duplicates, see batch_ids_from_json()
+ */
+static crow::response batch_response(const char* done_key, const std::vector<uint64_t>& requested, std::vector<uint64_t> done) {
+    std::sort(done.begin(), done.end());
+    return mkm::json_response([&](mkm::JsonWriter& json) {
+        json.begin_object();
+        json.key(done_key);
+        json.begin_array();
+        for (const uint64_t id : done) {
+            json.value(id);
+        }
+        json.end_array();
+        json.key("not_found");
+        json.begin_array();
+        for (const uint64_t id : requested) {
+            if (!std::binary_search(done.begin(), done.end(), id)) {
+                json.value(id);
+            }
+        }
+        json.end_array();
+        json.end_object();
+    });
+}
+
+/**
+ * @brief Parse an unsigned integer query parameter
+ * @return default_value if the parameter is absent, std::nullopt if it is malformed or out of range
+ */
+static std::optional<uint64_t> get_url_param_uint(const crow::request& req,
+                                                  const char* name,
+                                                  uint64_t default_value,
+                                                  uint64_t min_value,
+                                                  uint64_t max_value) {
+    const char* value = req.url_params.get(name);
+    if (value == nullptr) {
+        return default_value;
+    }
+    try {
+        size_t parsed = 0;
+        const uint64_t number = std::stoull(value, &parsed);
+        if (value[parsed] != '\0' || number < min_value || number > max_value) {
+            return std::nullopt;
+        }
+        return number;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+struct ByteRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+/**
+ * @brief Resolve a single "bytes=" range against a body of total_size bytes
+ * @return std::nullopt if the header should be ignored (absent, malformed or multi-range),
+ * a zero length range if it cannot be satisfied
+ */
+static std::optional<ByteRange> parse_range_header(const std::string& value, uint64_t total_size) {
+    constexpr std::string_view prefix = "bytes=";
+    if (value.compare(0, prefix.size(), prefix) != 0 || value.find(',') != std::string::npos) {
+        return std::nullopt;
+    }
+    const std::string spec = value.substr(prefix.size());
+    const size_t dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return std::nullopt;
+    }
+    const std::string first = spec.substr(0, dash);
+    const std::string last = spec.substr(dash + 1);
+    const auto all_digits = [](const std::string& s) {
+        return !s.empty() && s.find_first_not_of("0123456789") == std::string::npos;
+    };
+    try {
+        if (first.empty()) {
+            // Suffix range - the last N bytes
+            if (!all_digits(last)) {
+                return std::nullopt;
+            }
+            const uint64_t suffix = std::min<uint64_t>(std::stoull(last), total_size);
+            return ByteRange{total_size - suffix, suffix};
+        }
+        if (!all_digits(first) || (!last.empty() && !all_digits(last))) {
+            return std::nullopt;
+        }
+        const uint64_t start = std::stoull(first);
+        if (start >= total_size) {
+            return ByteRange{total_size, 0};
+        }
+        uint64_t end = last.empty() ? total_size - 1 : std::min<uint64_t>(std::stoull(last), total_size - 1);
+        if (end < start) {
+            return std::nullopt;
+        }
+        return ByteRange{start, end - start + 1};
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+/**
+ * @brief Check an If-None-Match header value - "*" or a comma-separated list of entity tags -
+ * against an entity tag. Tags are compared weakly, as RFC 9110 13.1.2 asks for If-None-Match:
+ * W/"x" matches "x" either way round. A malformed list matches nothing.
+ */
+static bool etag_matches(const std::string& if_none_match, const std::string& etag) {
+    const auto opaque = [](std::string_view tag) {
+        return tag.substr(0, 2) == "W/" ? tag.substr(2) : tag;
+    };
+    const std::string_view wanted = opaque(etag);
+    std::string_view list = if_none_match;
+    const auto skip_separators = [&list] {
+        while (!list.empty() && (list.front() == ' ' || list.front() == '\t' || list.front() == ',')) {
+            list.remove_prefix(1);
+        }
+    };
+    skip_separators();
+    if (list == "*") {
+        return true;
+    }
+    while (!list.empty()) {
+        if (list.substr(0, 2) == "W/") {
+            list.remove_prefix(2);
+        }
+        // The opaque tag may itself contain commas, so it runs to its closing quote
+        const size_t close = list.empty() || list.front() != '"' ? std::string_view::npos : list.find('"', 1);
+        if (close == std::string_view::npos) {
+            return false;
+        }
+        if (list.substr(0, close + 1) == wanted) {
+            return true;
+        }
+        list.remove_prefix(close + 1);
+        skip_separators();
+    }
+    return false;
+}
+
+/**
+ * @brief IMF-fixdate for Last-Modified, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+ */
+static std::string http_date(int64_t epoch_us) {
+    const std::time_t seconds = static_cast<std::time_t>(epoch_us / 1000000);
+    std::tm parts{};
+    gmtime_r(&seconds, &parts);
+    char buffer[32];
+    const size_t length = std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    return std::string(buffer, length);
+}
+
+/**
+ * @brief Parse an IMF-fixdate If-Modified-Since value into seconds since the epoch
+ * @return std::nullopt for anything else - the header is then ignored, as RFC 9110 asks
+ */
+static std::optional<int64_t> parse_http_date(const std::string& value) {
+    std::tm parts{};
+    const char* end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parts);
+    if (end == nullptr || *end != '\0') {
+        return std::nullopt;
+    }
+    return static_cast<int64_t>(timegm(&parts));
+}
+
+/**
+ * @brief Whether the client's copy is still current. If-None-Match wins over If-Modified-Since,
+ * whose one second resolution can miss changes made within the same second.
+ */
+static bool is_not_modified(const crow::request& req, const mkm::Validator& validator) {
+    const auto& if_none_match = req.get_header_value("If-None-Match");
+    if (!if_none_match.empty()) {
+        return etag_matches(if_none_match, validator.etag);
+    }
+    const auto& if_modified_since = req.get_header_value("If-Modified-Since");
+    if (!if_modified_since.empty()) {
+        const auto since = parse_http_date(if_modified_since);
+        return since.has_value() && validator.modified_us / 1000000 <= *since;
+    }
+    return false;
+}
+
+/**
+ * @brief Validator headers for a 200 or 304 answer. Responses differ per user, so shared caches
+ * must not keep them and private ones have to revalidate.
+ */
+static void set_validator_headers(crow::response& response, const mkm::Validator& validator) {
+    response.set_header("ETag", validator.etag);
+    response.set_header("Last-Modified", http_date(validator.modified_us));
+    response.set_header("Cache-Control", "private, no-cache");
+    response.set_header("Vary", "Authorization");
+}
+
+static crow::response not_modified_response(const mkm::Validator& validator) {
+    crow::response response(crow::status::NOT_MODIFIED);
+    set_validator_headers(response, validator);
+    return response;
+}
+
+/**
+ * @brief Content-Type for an uploaded file, based on its extension
+ */
+static std::string content_type_for(const std::string& file_name) {
+    const size_t dot = file_name.rfind('.');
+    if (dot != std::string::npos) {
+        std::string extension = file_name.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        const auto it = crow::mime_types.find(extension);
+        if (it != crow::mime_types.end()) {
+            return it->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+/**
+ * @brief Adds the state of the database pool, the moment details cache, tracing and logging to /metrics
+ */
+static void register_metric_collectors() {
+    mkm::metrics().add_collector([](std::string& out) {
+        const auto& pool = mkm::db_pool();
+        mkm::append_metric_header(out, "mkm_db_pool_connections", "gauge", "Open pooled database connections");
+        mkm::append_metric_sample(out, "mkm_db_pool_connections", "", static_cast<double>(pool.size()));
+        mkm::append_metric_header(out, "mkm_db_pool_idle_connections", "gauge", "Pooled connections not checked out");
+        mkm::append_metric_sample(out, "mkm_db_pool_idle_connections", "", static_cast<double>(pool.idle()));
+        mkm::append_metric_header(out, "mkm_db_pool_max_connections", "gauge", "Upper bound of the pool");
+        mkm::append_metric_sample(out, "mkm_db_pool_max_connections", "", static_cast<double>(pool.config().max_size));
+    });
+    mkm::metrics().add_collector([](std::string& out) {
+        const auto stats = mkm::moment_detail_cache().stats();
+        mkm::append_metric_header(out, "mkm_detail_cache_requests_total", "counter", "Moment details cache lookups");
+        mkm::append_metric_sample(out, "mkm_detail_cache_requests_total", "result=\"hit\"", static_cast<double>(stats.hits));
+        mkm::append_metric_sample(out, "mkm_detail_cache_requests_total", "result=\"miss\"", static_cast<double>(stats.misses));
+        mkm::append_metric_header(out, "mkm_detail_cache_evictions_total", "counter", "Moment details evicted for space");
+        mkm::append_metric_sample(out, "mkm_detail_cache_evictions_total", "", static_cast<double>(stats.evictions));
+        mkm::append_metric_header(out, "mkm_detail_cache_bytes", "gauge", "Approximate memory held by cached moment details");
+        mkm::append_metric_sample(out, "mkm_detail_cache_bytes", "", static_cast<double>(stats.weight));
+    });
+    mkm::metrics().add_collector([](std::string& out) {
+        mkm::append_metric_header(out, "mkm_trace_events_dropped_total", "counter", "Trace events lost to full buffers");
+        mkm::append_metric_sample(out, "mkm_trace_events_dropped_total", "", static_cast<double>(mkm::tracer().dropped()));
+    });
+    mkm::metrics().add_collector([](std::string& out) {
+        mkm::append_metric_header(out, "mkm_log_messages_dropped_total", "counter", "Log messages lost to a full log buffer");
+        mkm::append_metric_sample(out, "mkm_log_messages_dropped_total", "", static_cast<double>(mkm::async_log().dropped()));
+    });
+    mkm::metrics().add_collector([](std::string& out) {
+        const auto stats = mkm::RequestArena::stats();
+        mkm::append_metric_header(out, "mkm_request_arenas_total", "counter", "Request arenas opened");
+        mkm::append_metric_sample(out, "mkm_request_arenas_total", "", static_cast<double>(stats.arenas));
+        mkm::append_metric_header(out, "mkm_request_arena_overflow_bytes_total", "counter", "Bytes request arenas took from the heap beyond their block");
+        mkm::append_metric_sample(out, "mkm_request_arena_overflow_bytes_total", "", static_cast<double>(stats.overflow_bytes));
+    });
 }
 
 int main() {
+    // Before anything logs: Crow and our own messages go through the background writer from here on
+    crow::logger::setHandler(&mkm::async_log());
     try {
-        crow::App<crow::CORSHandler, RequestLogger> app;
+        crow::App<crow::CORSHandler, RequestLogger, RequestMetrics, RequestTracer, ResponseCompression> app;
         
-        CROW_LOG_INFO << "Starting server on port 5000...";
+        MKM_LOG_INFO(HTTP) << "Starting server on port 5000...";
 
         // Configure CORS
         auto& cors = app.get_middleware<crow::CORSHandler>();
@@ -193,6 +754,16 @@ int main() {
             return crow::response("Momentos API Server v1.0");
         });
 
+        // Metrics Route
+        // Prometheus text format; meant to be scraped from inside the deployment, not exposed publicly
+        CROW_ROUTE(app, "/metrics")
+        .methods(crow::HTTPMethod::GET)
+        ([](const crow::request&) {
+            crow::response response(crow::status::OK, mkm::metrics().render());
+            response.set_header("Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+            return response;
+        });
+
         // CORS OPTIONS handler
         CROW_ROUTE(app, "/<path>")
         .methods(crow::HTTPMethod::OPTIONS)
@@ -207,55 +778,42 @@ int main() {
         // Create Account Route
         CROW_ROUTE(app, "/create-account")
         .methods(crow::HTTPMethod::POST)
-        ([](const crow::request& req) {
+        ([](const crow::request& req, crow::response& res) {
+            const auto finish = [&res](crow::response response) {
+                res = std::move(response);
+                res.end();
+            };
             try {
-                // Validate Content-Type
-                const auto& content_type = req.get_header_value("Content-Type");
-                if (content_type.find("multipart/form-data") != 0) {
-                    return crow::response(crow::status::BAD_REQUEST, "Invalid Content-Type");
-                }
-
-                // Validate Content-Length
-                const auto& content_length_str = req.get_header_value("Content-Length");
-                if (content_length_str.empty()) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing Content-Length");
+                MKM_LOG_DEBUG(HTTP) << "Parsing multipart message...";
+                // Account forms carry no file
+                mkm::StreamedForm multi_part_message(mkm::image_store(), {}, MAX_FIELD_LENGTH, 0);
+                if (auto error = parse_form(req, multi_part_message)) {
+                    return finish(crow::response(crow::status::BAD_REQUEST, *error));
                 }
                 
-                try {
-                    size_t content_length = std::stoull(content_length_str);
-                    if (content_length > MAX_REQUEST_SIZE) {
-                        return crow::response(crow::status::BAD_REQUEST, "Request too large");
-                    }
-                } catch (const std::exception& e) {
-                    return crow::response(crow::status::BAD_REQUEST, "Invalid Content-Length");
-                }
-
-                CROW_LOG_DEBUG << "Parsing multipart message...";
-                crow::multipart::message multi_part_message(req);
-                
-                CROW_LOG_DEBUG << "Creating user details object...";
+                MKM_LOG_DEBUG(HTTP) << "Creating user details object...";
                 mkm::User user_details;
                 std::string password;
                 
                 // Validate and extract required fields
                 if (!get_part_value_string_if_present(multi_part_message, "fullname", user_details.full_name)) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing fullname");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Missing fullname"));
                 }
                 
                 if (!get_part_value_string_if_present(multi_part_message, "birthdate", user_details.birth_date)) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing birthdate");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Missing birthdate"));
                 }
                 
                 if (!get_part_value_string_if_present(multi_part_message, "emailid", user_details.email_id)) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing emailid");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Missing emailid"));
                 }
                 
                 if (!get_part_value_string_if_present(multi_part_message, "username", user_details.username)) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing username");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Missing username"));
                 }
                 
                 if (!get_part_value_string_if_present(multi_part_message, "password", password)) {
-                    return crow::response(crow::status::BAD_REQUEST, "Missing password");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Missing password"));
                 }
 
                 // Validate field contents
@@ -265,108 +823,629 @@ int main() {
                     std::make_pair("emailid", user_details.email_id),
                     std::make_pair("password", password)
                 }) {
-                    if (auto error = validate_string(value, MAX_FIELD_LENGTH, field)) {
-                        return crow::response(crow::status::BAD_REQUEST, *error);
+                    if (auto error = mkm::validate_string(value, MAX_FIELD_LENGTH, field)) {
+                        return finish(crow::response(crow::status::BAD_REQUEST, *error));
                     }
                 }
 
-                CROW_LOG_DEBUG << "Creating new account...";
-                if (!mkm::create_new_account(user_details, password)) {
-                    return crow::response(crow::status::INTERNAL_SERVER_ERROR, 
-                        mkm::error_str(mkm::ErrorCode::INTERNAL_ERROR));
+                // bcrypt runs on the hashing pool; the insert happens back on this connection's I/O thread
+                const bool queued = mkm::hashing_pool().submit(
+                    [&req, &res, user_details = std::move(user_details), password = std::move(password)]() mutable {
+                        bool hashed = false;
+                        try {
+                            user_details.password_hash = mkm::hash_password(password);
+                            hashed = true;
+                        } catch (const std::exception& e) {
+                            MKM_LOG_ERROR(HTTP) << "Password hashing failed in create-account: " << e.what();
+                        }
+                        run_on_io_thread(req, res, [&res, user_details = std::move(user_details), hashed] {
+                            res = hashed ? insert_account(user_details)
+                                         : crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+                            res.end();
+                        });
+                    });
+                if (!queued) {
+                    MKM_LOG_WARNING(HTTP) << "Password hashing pool saturated, rejecting create-account";
+                    return finish(hashing_busy_response());
                 }
-
-                CROW_LOG_INFO << "Account created successfully for user: " << user_details.username;
-                return crow::response(crow::status::OK);
-                
             } catch (const std::exception& e) {
-                CROW_LOG_ERROR << "Exception in create-account: " << e.what();
-                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+                MKM_LOG_ERROR(HTTP) << "Exception in create-account: " << e.what();
+                return finish(crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error"));
             }
         });
 
         // Login Route
         CROW_ROUTE(app, "/login")
         .methods(crow::HTTPMethod::POST)
-        ([](const crow::request& req) {
+        ([](const crow::request& req, crow::response& res) {
+            const auto finish = [&res](crow::response response) {
+                res = std::move(response);
+                res.end();
+            };
             try {
                 auto x = crow::json::load(req.body);
                 if (!x || !x.has("username") || !x.has("password")) {
-                    return crow::response(crow::status::BAD_REQUEST, "Invalid request format");
+                    return finish(crow::response(crow::status::BAD_REQUEST, "Invalid request format"));
                 }
 
                 std::string username = x["username"].s();
                 std::string password = x["password"].s();
 
                 // Validate inputs
-                if (auto error = validate_string(username, MAX_FIELD_LENGTH, "username")) {
+                if (auto error = mkm::validate_string(username, MAX_FIELD_LENGTH, "username")) {
+                    return finish(crow::response(crow::status::BAD_REQUEST, *error));
+                }
+                if (auto error = mkm::validate_string(password, MAX_FIELD_LENGTH, "password")) {
+                    return finish(crow::response(crow::status::BAD_REQUEST, *error));
+                }
+
+                auto result = mkm::get_user_details(username);
+                if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                    return finish(crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(std::get<mkm::ErrorCode>(result))));
+                }
+
+                // The bcrypt comparison runs on the hashing pool instead of in Postgres
+                const bool queued = mkm::hashing_pool().submit(
+                    [&req, &res, user = std::get<mkm::User>(std::move(result)), password = std::move(password)] {
+                        crow::response response;
+                        try {
+                            response = login_response(user, password);
+                        } catch (const std::exception& e) {
+                            MKM_LOG_ERROR(HTTP) << "Exception in login: " << e.what();
+                            response = crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+                        }
+                        run_on_io_thread(req, res, [&res, response = std::move(response)]() mutable {
+                            res = std::move(response);
+                            res.end();
+                        });
+                    });
+                if (!queued) {
+                    MKM_LOG_WARNING(HTTP) << "Password hashing pool saturated, rejecting login";
+                    return finish(hashing_busy_response());
+                }
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in login: " << e.what();
+                return finish(crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy"));
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in login: " << e.what();
+                return finish(crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error"));
+            }
+        });
+
+        // Get Total Moments Route
+        CROW_ROUTE(app, "/moments/total")
+        .methods(crow::HTTPMethod::GET)
+        ([](const crow::request& req, crow::response& res) {
+            try {
+                std::string username;
+                if (!mkm::verify_authorization_header(req, username)) {
+                    return complete_async(res, crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR)));
+                }
+
+                // Served from the I/O thread: no pooled connection is held while the query runs
+                mkm::get_moment_count_async(*req.io_service, username,
+                    [&res](std::variant<uint64_t, mkm::ErrorCode> result) {
+                        if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                            return complete_async(res, db_error_response(std::get<mkm::ErrorCode>(result)));
+                        }
+                        complete_async(res, mkm::json_response([&](mkm::JsonWriter& json) {
+                            json.begin_object();
+                            json.field("total_moments", std::get<uint64_t>(result));
+                            json.end_object();
+                        }));
+                    });
+
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/total: " << e.what();
+                return complete_async(res, crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error"));
+            }
+        });
+
+        // Moments List Route
+        // current_page selects OFFSET pages (kept for compatibility). Passing cursor instead -
+        // empty for the first page - switches to keyset pagination and returns next_cursor.
+        CROW_ROUTE(app, "/moments")
+        .methods(crow::HTTPMethod::GET)
+        ([](const crow::request& req, crow::response& res) {
+            try {
+                std::string username;
+                if (!mkm::verify_authorization_header(req, username)) {
+                    return complete_async(res, crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR)));
+                }
+
+                const auto page_size = get_url_param_uint(req, "page_size", DEFAULT_PAGE_SIZE, 1, MAX_PAGE_SIZE);
+                if (!page_size) {
+                    return complete_async(res, crow::response(crow::status::BAD_REQUEST, "Invalid page_size"));
+                }
+
+                std::optional<std::string> sort_by;
+                if (const char* value = req.url_params.get("sort_by")) {
+                    sort_by = value;
+                }
+                std::optional<std::string> search;
+                if (const char* value = req.url_params.get("search"); value != nullptr && *value != '\0') {
+                    search = value;
+                    if (auto error = mkm::validate_string(*search, MAX_FIELD_LENGTH, "search")) {
+                        return complete_async(res, crow::response(crow::status::BAD_REQUEST, *error));
+                    }
+                }
+
+                std::optional<std::string> cursor;
+                std::optional<uint64_t> current_page;
+                if (const char* value = req.url_params.get("cursor")) {
+                    cursor = value;
+                } else {
+                    current_page = get_url_param_uint(req, "current_page", 1, 1,
+                        std::numeric_limits<uint32_t>::max());
+                    if (!current_page) {
+                        return complete_async(res, crow::response(crow::status::BAD_REQUEST, "Invalid current_page"));
+                    }
+                }
+
+                // One validator covers every page, order and search of the user's moments. It is
+                // known before the listing is read, so an unchanged listing is never read at all.
+                auto& io = *req.io_service;
+                mkm::get_moments_validator_async(io, username,
+                    [&req, &res, &io, username, page_size = static_cast<uint32_t>(*page_size),
+                     cursor = std::move(cursor), current_page, sort_by = std::move(sort_by),
+                     search = std::move(search)](std::variant<mkm::Validator, mkm::ErrorCode> validated) {
+                        if (!res.is_alive()) {
+                            return;
+                        }
+                        if (std::holds_alternative<mkm::ErrorCode>(validated)) {
+                            return complete_async(res, db_error_response(std::get<mkm::ErrorCode>(validated)));
+                        }
+                        mkm::Validator validator = std::move(std::get<mkm::Validator>(validated));
+                        if (is_not_modified(req, validator)) {
+                            return complete_async(res, not_modified_response(validator));
+                        }
+
+                        if (cursor) {
+                            mkm::get_moments_page_async(io, username, page_size,
+                                cursor->empty() ? std::nullopt : cursor, sort_by, search,
+                                [&res, validator](std::variant<mkm::MomentsPage, mkm::ErrorCode> result) {
+                                    if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                                        return complete_async(res, db_error_response(std::get<mkm::ErrorCode>(result)));
+                                    }
+                                    const auto& page = std::get<mkm::MomentsPage>(result);
+                                    crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+                                        json.begin_object();
+                                        json.key("moments");
+                                        mkm::write_moments_json(json, page.moments);
+                                        json.key("next_cursor");
+                                        if (page.next_cursor) {
+                                            json.value(*page.next_cursor);
+                                        } else {
+                                            json.null();
+                                        }
+                                        json.end_object();
+                                    });
+                                    set_validator_headers(response, validator);
+                                    complete_async(res, std::move(response));
+                                });
+                        } else {
+                            mkm::get_moments_list_async(io, username, page_size, *current_page, sort_by, search,
+                                [&res, validator](std::variant<std::vector<mkm::Moment>, mkm::ErrorCode> result) {
+                                    if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                                        return complete_async(res, db_error_response(std::get<mkm::ErrorCode>(result)));
+                                    }
+                                    crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+                                        json.begin_object();
+                                        json.key("moments");
+                                        mkm::write_moments_json(json, std::get<std::vector<mkm::Moment>>(result));
+                                        json.end_object();
+                                    });
+                                    set_validator_headers(response, validator);
+                                    complete_async(res, std::move(response));
+                                });
+                        }
+                    });
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in moments: " << e.what();
+                return complete_async(res, crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error"));
+            }
+        });
+
+        // Add Moment Route
+        // The image part is streamed into the image store while the form is parsed; only the
+        // text fields are held in memory
+        CROW_ROUTE(app, "/addmoment")
+        .methods(crow::HTTPMethod::POST)
+        ([](const crow::request& req) {
+            try {
+                mkm::RequestArena arena;
+                mkm::Moment moment = mkm::moment_with_memory(arena.resource());
+                if (!mkm::verify_authorization_header(req, moment.username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
+                }
+
+                mkm::StreamedForm form(mkm::image_store(), "moment-image", MAX_DESCRIPTION_LENGTH, MAX_REQUEST_SIZE);
+                if (auto error = parse_form(req, form)) {
                     return crow::response(crow::status::BAD_REQUEST, *error);
                 }
-                if (auto error = validate_string(password, MAX_FIELD_LENGTH, "password")) {
+                if (auto error = moment_from_form(form, moment)) {
                     return crow::response(crow::status::BAD_REQUEST, *error);
                 }
+                if (moment.title.empty() || moment.date == mkm::NO_DATE || moment.description.empty()) {
+                    return crow::response(crow::status::BAD_REQUEST, "Missing title, date or description");
+                }
 
-                auto result = mkm::get_user_details(username);
+                if (!mkm::add_new_moment(moment)) {
+                    return crow::response(crow::status::INTERNAL_SERVER_ERROR,
+                        mkm::error_str(mkm::ErrorCode::INTERNAL_ERROR));
+                }
+                return crow::response(crow::status::OK);
+
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in addmoment: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in addmoment: " << e.what();
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+            }
+        });
+
+        // Update Moment Route
+        // Only the submitted fields change; a new image replaces the old one and its variants
+        CROW_ROUTE(app, "/update/<uint>")
+        .methods(crow::HTTPMethod::POST)
+        ([](const crow::request& req, uint64_t moment_id) {
+            try {
+                mkm::RequestArena arena;
+                mkm::Moment moment = mkm::moment_with_memory(arena.resource());
+                moment.id = moment_id;
+                if (!mkm::verify_authorization_header(req, moment.username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
+                }
+
+                mkm::StreamedForm form(mkm::image_store(), "moment-image", MAX_DESCRIPTION_LENGTH, MAX_REQUEST_SIZE);
+                if (auto error = parse_form(req, form)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
+                if (auto error = moment_from_form(form, moment)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
+
+                if (!mkm::update_moment(moment)) {
+                    return crow::response(crow::status::INTERNAL_SERVER_ERROR,
+                        mkm::error_str(mkm::ErrorCode::INTERNAL_ERROR));
+                }
+                return crow::response(crow::status::OK);
+
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in update: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in update: " << e.what();
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+            }
+        });
+
+        // Bulk Import Route
+        // NDJSON, one moment per line, as the body (application/x-ndjson) or as the "moments" part
+        // of a multipart form. Invalid lines are reported by line number; the valid ones are
+        // imported together, in one transaction.
+        CROW_ROUTE(app, "/moments/import")
+        .methods(crow::HTTPMethod::POST)
+        ([](const crow::request& req) {
+            try {
+                std::string username;
+                if (!mkm::verify_authorization_header(req, username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
+                }
+
+                // Holds the accepted moments until they are sent
+                mkm::RequestArena arena;
+                mkm::MomentImport import(mkm::moment_import_config().max_moments, arena.resource());
+                if (auto error = parse_import(req, import)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
+                if (import.moments().empty() && import.rejections().empty()) {
+                    return crow::response(crow::status::BAD_REQUEST, "No moments to import");
+                }
+
+                uint64_t imported = 0;
+                if (!import.moments().empty()) {
+                    auto result = mkm::import_moments(username, import.moments());
+                    if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                        return db_error_response(std::get<mkm::ErrorCode>(result));
+                    }
+                    imported = std::get<uint64_t>(result);
+                }
+                return mkm::json_response([&](mkm::JsonWriter& json) {
+                    json.begin_object();
+                    json.field("imported", imported);
+                    json.key("rejected");
+                    json.begin_array();
+                    for (const auto& rejection : import.rejections()) {
+                        json.begin_object();
+                        json.field("line", static_cast<uint64_t>(rejection.line));
+                        json.field("error", rejection.error);
+                        json.end_object();
+                    }
+                    json.end_array();
+                    json.end_object();
+                });
+
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in moments/import: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/import: " << e.what();
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+            }
+        });
+
+        // Batch Update Route
+        // {"ids": [...]} plus any of the fields of an import line, which then change on every
+        // listed moment at once. Images are replaced one moment at a time, through /update.
+        CROW_ROUTE(app, "/moments/batch/update")
+        .methods(crow::HTTPMethod::POST)
+        ([](const crow::request& req) {
+            try {
+                mkm::RequestArena arena;
+                mkm::Moment changes = mkm::moment_with_memory(arena.resource());
+                if (!mkm::verify_authorization_header(req, changes.username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
+                }
+
+                const auto body = crow::json::load(req.body);
+                if (!body) {
+                    return crow::response(crow::status::BAD_REQUEST, "Invalid JSON");
+                }
+                std::vector<uint64_t> ids;
+                if (auto error = batch_ids_from_json(body, ids)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
+                if (auto error = mkm::moment_from_json(body, changes, false)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
+                if (changes.title.empty() && changes.description.empty() && changes.date == mkm::NO_DATE
+                    && changes.feelings.empty() && changes.image_caption.empty()) {
+                    return crow::response(crow::status::BAD_REQUEST, "Nothing to update");
+                }
+
+                auto result = mkm::update_moments(changes, ids);
                 if (std::holds_alternative<mkm::ErrorCode>(result)) {
-                    return crow::response(crow::status::UNAUTHORIZED, 
-                        mkm::error_str(std::get<mkm::ErrorCode>(result)));
+                    return db_error_response(std::get<mkm::ErrorCode>(result));
                 }
+                return batch_response("updated", ids, std::move(std::get<std::vector<uint64_t>>(result)));
 
-                const auto& user = std::get<mkm::User>(result);
-                if (!mkm::is_password_valid(password, user.password_hash)) {
-                    return crow::response(crow::status::UNAUTHORIZED, 
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in moments/batch/update: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/batch/update: " << e.what();
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+            }
+        });
+
+        // Batch Delete Route
+        // {"ids": [...]}, deleted in one statement
+        CROW_ROUTE(app, "/moments/batch/delete")
+        .methods(crow::HTTPMethod::POST)
+        ([](const crow::request& req) {
+            try {
+                std::string username;
+                if (!mkm::verify_authorization_header(req, username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
                         mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
                 }
 
-                auto current_time = std::chrono::system_clock::now();
-                auto token = jwt::create()
-                            .set_issuer("MKM")
-                            .set_type("JWS")
-                            .set_issued_at(current_time)
-                            .set_expires_at(current_time + std::chrono::seconds{JWT_EXPIRY_SECONDS})
-                            .set_payload_claim("username", jwt::claim(user.username))
-                            .sign(jwt::algorithm::hs512{JWT_SECRET});
+                const auto body = crow::json::load(req.body);
+                if (!body) {
+                    return crow::response(crow::status::BAD_REQUEST, "Invalid JSON");
+                }
+                std::vector<uint64_t> ids;
+                if (auto error = batch_ids_from_json(body, ids)) {
+                    return crow::response(crow::status::BAD_REQUEST, *error);
+                }
 
-                crow::json::wvalue resp{
-                    {"access_token", token},
-                    {"username", user.username},
-                    {"expires_in", JWT_EXPIRY_SECONDS}
-                };
-                return crow::response(crow::status::OK, resp);
+                auto result = mkm::delete_moments(username, ids);
+                if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                    return db_error_response(std::get<mkm::ErrorCode>(result));
+                }
+                return batch_response("deleted", ids, std::move(std::get<std::vector<uint64_t>>(result)));
 
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in moments/batch/delete: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
             } catch (const std::exception& e) {
-                CROW_LOG_ERROR << "Exception in login: " << e.what();
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/batch/delete: " << e.what();
                 return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
             }
         });
 
-        // Get Total Moments Route
-        CROW_ROUTE(app, "/moments/total")
+        // Moment Details Route
+        // Conditional requests for an unchanged moment are answered from its cached validator,
+        // without reading the moment or its image
+        CROW_ROUTE(app, "/moments/<uint>")
         .methods(crow::HTTPMethod::GET)
-        ([](const crow::request& req) {
+        ([](const crow::request& req, uint64_t moment_id) {
+            try {
+                std::string username;
+                if (!mkm::verify_authorization_header(req, username)) {
+                    return crow::response(crow::status::UNAUTHORIZED,
+                        mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
+                }
+
+                auto validated = mkm::get_moment_validator(username, moment_id);
+                if (std::holds_alternative<mkm::ErrorCode>(validated)) {
+                    return db_error_response(std::get<mkm::ErrorCode>(validated));
+                }
+                const auto& validator = std::get<mkm::Validator>(validated);
+                if (is_not_modified(req, validator)) {
+                    return not_modified_response(validator);
+                }
+
+                // Holds the moment's text until the response is written
+                mkm::RequestArena arena;
+                auto result = mkm::get_moment_details(username, moment_id);
+                if (std::holds_alternative<mkm::ErrorCode>(result)) {
+                    return db_error_response(std::get<mkm::ErrorCode>(result));
+                }
+                crow::response response = mkm::json_response([&](mkm::JsonWriter& json) {
+                    mkm::write_moment_json(json, std::get<mkm::Moment>(result));
+                });
+                set_validator_headers(response, validator);
+                return response;
+
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in moments/details: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
+            } catch (const std::exception& e) {
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/details: " << e.what();
+                return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
+            }
+        });
+
+        // Moment Image Route
+        // Serves the image bytes of one moment, honouring If-None-Match and single byte ranges.
+        // size=thumb|preview picks the smallest generated variant that fits, falling back to the
+        // original while the variants are still being generated.
+        CROW_ROUTE(app, "/moments/<uint>/image")
+        .methods(crow::HTTPMethod::GET)
+        ([](const crow::request& req, uint64_t moment_id) {
             try {
                 std::string username;
-                if (!verify_authorization_header(req, username)) {
+                if (!mkm::verify_authorization_header(req, username)) {
                     return crow::response(crow::status::UNAUTHORIZED, 
                         mkm::error_str(mkm::ErrorCode::AUTHENTICATION_ERROR));
                 }
 
-                crow::json::wvalue resp_json{{"total_moments", mkm::get_moment_count(username)}};
-                return crow::response(crow::status::OK, resp_json);
+                auto info_result = mkm::get_moment_image_info(username, moment_id);
+                if (std::holds_alternative<mkm::ErrorCode>(info_result)) {
+                    const auto error = std::get<mkm::ErrorCode>(info_result);
+                    return crow::response(
+                        error == mkm::ErrorCode::INTERNAL_ERROR ? crow::status::INTERNAL_SERVER_ERROR
+                                                                : crow::status::NOT_FOUND,
+                        mkm::error_str(error));
+                }
+                auto& info = std::get<mkm::MomentImageInfo>(info_result);
+
+                const char* size_param = req.url_params.get("size");
+                const std::string size = size_param != nullptr ? size_param : "original";
+                if (size != "original" && size != "thumb" && size != "preview") {
+                    return crow::response(crow::status::BAD_REQUEST, "Invalid size");
+                }
+                std::string content_type = content_type_for(info.filename);
+                std::string variant_hash = info.hash;
+                if (size == "thumb" && !info.thumbnail_hash.empty()) {
+                    variant_hash = info.thumbnail_hash;
+                } else if (size != "original" && !info.preview_hash.empty()) {
+                    variant_hash = info.preview_hash;
+                }
+                if (variant_hash != info.hash) {
+                    // Generated variants are always JPEG
+                    content_type = "image/jpeg";
+                    info.hash = std::move(variant_hash);
+                    std::error_code error;
+                    info.size = std::filesystem::file_size(mkm::image_store().path_for(info.hash), error);
+                    if (error) {
+                        MKM_LOG_WARNING(IMAGES) << "Image " << info.hash << " of moment " << moment_id
+                                                << " is missing from the store: " << error.message();
+                        return crow::response(crow::status::NOT_FOUND, mkm::error_str(mkm::ErrorCode::IMAGE_NOT_FOUND));
+                    }
+                }
+
+                // Stored images are named by their SHA-256, which makes a perfect strong validator.
+                // For images still in the database, last_modified_date is bumped by every update,
+                // so together with the id it identifies the bytes.
+                const std::string etag = info.hash.empty()
+                    ? "\"" + std::to_string(moment_id) + '-' + std::to_string(info.modified_us) + '"'
+                    : "\"" + info.hash + '"';
+
+                crow::response response;
+                response.set_header("ETag", etag);
+                response.set_header("Accept-Ranges", "bytes");
+                response.set_header("Cache-Control", "private, no-cache");
 
+                const auto& if_none_match = req.get_header_value("If-None-Match");
+                if (!if_none_match.empty() && etag_matches(if_none_match, etag)) {
+                    response.code = crow::status::NOT_MODIFIED;
+                    return response;
+                }
+
+                ByteRange range{0, info.size};
+                response.code = crow::status::OK;
+                const auto& range_header = req.get_header_value("Range");
+                const auto& if_range = req.get_header_value("If-Range");
+                if (!range_header.empty() && (if_range.empty() || if_range == etag)) {
+                    if (auto requested = parse_range_header(range_header, info.size)) {
+                        if (requested->length == 0) {
+                            response.code = crow::status::RANGE_NOT_SATISFIABLE;
+                            response.set_header("Content-Range", "bytes */" + std::to_string(info.size));
+                            return response;
+                        }
+                        range = *requested;
+                        response.code = crow::status::PARTIAL_CONTENT;
+                        response.set_header("Content-Range", "bytes " + std::to_string(range.offset) + '-'
+                            + std::to_string(range.offset + range.length - 1) + '/' + std::to_string(info.size));
+                    }
+                }
+
+                if (!info.hash.empty()) {
+                    if (response.code == crow::status::OK) {
+                        // Let Crow stream the file from disk instead of loading it into the body
+                        response.set_static_file_info(mkm::image_store().path_for(info.hash).string());
+                    } else {
+                        response.body = mkm::image_store().read_range(info.hash, range.offset, range.length);
+                    }
+                    response.set_header("Content-Type", content_type);
+                    return response;
+                }
+
+                auto chunk_result = mkm::get_moment_image_chunk(username, moment_id, range.offset, range.length);
+                if (std::holds_alternative<mkm::ErrorCode>(chunk_result)) {
+                    return crow::response(crow::status::INTERNAL_SERVER_ERROR,
+                        mkm::error_str(std::get<mkm::ErrorCode>(chunk_result)));
+                }
+                // Content-Length is filled in from the body when the response is written
+                response.set_header("Content-Type", content_type);
+                response.body = std::move(std::get<std::string>(chunk_result));
+                return response;
+
+            } catch (const mkm::pool_timeout& e) {
+                MKM_LOG_ERROR(HTTP) << "Database pool exhausted in moments/image: " << e.what();
+                return crow::response(crow::status::SERVICE_UNAVAILABLE, "Server busy");
             } catch (const std::exception& e) {
-                CROW_LOG_ERROR << "Exception in moments/total: " << e.what();
+                MKM_LOG_ERROR(HTTP) << "Exception in moments/image: " << e.what();
                 return crow::response(crow::status::INTERNAL_SERVER_ERROR, "Server error");
             }
         });
 
-        // Start the server
-        app.loglevel(crow::LogLevel::DEBUG);
+        // Open the shared database pool up front rather than on the first request
+        const auto& pool = mkm::db_pool();
+        MKM_LOG_INFO(HTTP) << "Database pool ready with " << pool.size() << " connection(s), max "
+                           << pool.config().max_size;
+        // Moment forms are checked against the feelings table, so there is no serving without it
+        if (!mkm::load_feelings()) {
+            throw std::runtime_error("Couldn't load the feelings table");
+        }
+        register_metric_collectors();
+
+        // SIGUSR1 switches request tracing on and off
+        mkm::tracer();
+        std::signal(SIGUSR1, [](int) { mkm::tracer().toggle(); });
+
+        // Pick up thumbnails that were still pending when the server last stopped
+        mkm::derivative_pipeline().requeue_pending();
+
+        // Start the server. Log levels come from MKM_LOG_LEVEL / MKM_LOG_LEVELS_FILE, not from here.
         app.port(5000).run();
 
     } catch (const std::exception& e) {
-        CROW_LOG_ERROR << "Fatal error: " << e.what();
+        MKM_LOG_ERROR(HTTP) << "Fatal error: " << e.what();
+        mkm::async_log().flush();
         return 1;
     }
+    mkm::async_log().flush();
     return 0;
 }
\ No newline at end of file
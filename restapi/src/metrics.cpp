@@ -0,0 +1,513 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <unordered_map>
+
+namespace mkm
+{
+    namespace
+    {
+        // Upper bounds of the histogram buckets, +Inf is implied
+        constexpr std::array<double, 14> REQUEST_SECONDS = {
+            0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+        constexpr std::array<double, 14> QUERY_SECONDS = {
+            0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 5};
+        constexpr std::array<double, 10> SIZE_BYTES = {
+            64, 256, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216};
+
+        // Label sets per family; the first one of each is the "other" series
+        constexpr size_t MAX_REQUEST_SERIES = 256;
+        constexpr size_t MAX_ROUTE_SERIES = 64;
+        constexpr size_t MAX_QUERY_SERIES = 64;
+
+        // Only the owning thread writes a shard, so an increment needs no atomic read-modify-write -
+        // the atomics are there for the scraping thread to read them safely
+        void bump(std::atomic<uint64_t>& cell, uint64_t by = 1)
+        {
+            cell.store(cell.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        }
+
+        template<size_t N>
+        struct HistogramCells
+        {
+            // The last bucket counts samples above every bound
+            std::array<std::atomic<uint64_t>, N + 1> buckets{};
+            // In nanoseconds or bytes, so that it can be an integer too
+            std::atomic<uint64_t> sum{};
+
+            void observe(const std::array<double, N>& bounds, double value, uint64_t raw)
+            {
+                const size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin();
+                bump(buckets[bucket]);
+                bump(sum, raw);
+            }
+        };
+
+        template<size_t N>
+        struct HistogramTotals
+        {
+            std::array<uint64_t, N + 1> buckets{};
+            uint64_t sum = 0;
+
+            void add(const HistogramCells<N>& cells)
+            {
+                for (size_t i = 0; i <= N; i++)
+                {
+                    buckets[i] += cells.buckets[i].load(std::memory_order_relaxed);
+                }
+                sum += cells.sum.load(std::memory_order_relaxed);
+            }
+
+            uint64_t count() const
+            {
+                uint64_t total = 0;
+                for (const auto bucket : buckets)
+                {
+                    total += bucket;
+                }
+                return total;
+            }
+        };
+
+        struct RequestCells
+        {
+            HistogramCells<REQUEST_SECONDS.size()> latency;
+            HistogramCells<SIZE_BYTES.size()> request_size;
+            HistogramCells<SIZE_BYTES.size()> response_size;
+        };
+
+        // Async handlers may finish on another thread than the one they started on - each side
+        // counts in its own shard and the gauge is the difference of the sums
+        struct RouteCells
+        {
+            std::atomic<uint64_t> started{};
+            std::atomic<uint64_t> finished{};
+        };
+
+        struct QueryCells
+        {
+            HistogramCells<QUERY_SECONDS.size()> latency;
+            std::atomic<uint64_t> errors{};
+        };
+
+        struct PoolCells
+        {
+            HistogramCells<QUERY_SECONDS.size()> wait;
+            std::atomic<uint64_t> timeouts{};
+        };
+
+        struct Shard
+        {
+            std::unique_ptr<RequestCells[]> requests = std::make_unique<RequestCells[]>(MAX_REQUEST_SERIES);
+            std::unique_ptr<RouteCells[]> routes = std::make_unique<RouteCells[]>(MAX_ROUTE_SERIES);
+            std::unique_ptr<QueryCells[]> queries = std::make_unique<QueryCells[]>(MAX_QUERY_SERIES);
+            PoolCells pool;
+        };
+
+        /**
+         * Label sets of one metric family, numbered in order of first use. Only touched when a
+         * thread meets a label set for the first time, and when scraping.
+         */
+        class SeriesIndex
+        {
+        public:
+            SeriesIndex(size_t capacity, std::string other_labels)
+                : capacity_(capacity)
+            {
+                labels_.push_back(std::move(other_labels));
+            }
+
+            size_t find_or_add(const std::string& labels)
+            {
+                std::lock_guard lock(mutex_);
+                auto it = ids_.find(labels);
+                if (it != ids_.end())
+                {
+                    return it->second;
+                }
+                if (labels_.size() >= capacity_)
+                {
+                    return 0;
+                }
+                labels_.push_back(labels);
+                ids_.emplace(labels, labels_.size() - 1);
+                return labels_.size() - 1;
+            }
+
+            std::vector<std::string> labels() const
+            {
+                std::lock_guard lock(mutex_);
+                return labels_;
+            }
+
+        private:
+            mutable std::mutex mutex_;
+            std::unordered_map<std::string, size_t> ids_;
+            std::vector<std::string> labels_;
+            const size_t capacity_;
+        };
+
+        SeriesIndex& request_series()
+        {
+            static SeriesIndex index(MAX_REQUEST_SERIES, "route=\"other\",method=\"other\",status=\"other\"");
+            return index;
+        }
+
+        SeriesIndex& route_series()
+        {
+            static SeriesIndex index(MAX_ROUTE_SERIES, "route=\"other\",method=\"other\"");
+            return index;
+        }
+
+        SeriesIndex& query_series()
+        {
+            static SeriesIndex index(MAX_QUERY_SERIES, "query=\"other\"");
+            return index;
+        }
+
+        // Shards outlive their threads, so that counters never go backwards
+        std::mutex shards_mutex;
+        std::vector<std::unique_ptr<Shard>> shards;
+
+        struct ThreadState
+        {
+            Shard* shard = nullptr;
+            std::unordered_map<std::string, size_t> request_ids;
+            std::unordered_map<std::string, size_t> route_ids;
+            std::unordered_map<std::string, size_t> query_ids;
+        };
+
+        ThreadState& thread_state()
+        {
+            thread_local ThreadState state;
+            if (state.shard == nullptr)
+            {
+                auto shard = std::make_unique<Shard>();
+                state.shard = shard.get();
+                std::lock_guard lock(shards_mutex);
+                shards.push_back(std::move(shard));
+            }
+            return state;
+        }
+
+        size_t series_id(std::unordered_map<std::string, size_t>& cache, SeriesIndex& index, const std::string& labels)
+        {
+            auto it = cache.find(labels);
+            if (it != cache.end())
+            {
+                return it->second;
+            }
+            const size_t id = index.find_or_add(labels);
+            // Label sets that didn't fit are looked up again each time rather than remembered, so
+            // that they can't grow the cache either
+            if (id != 0)
+            {
+                cache.emplace(labels, id);
+            }
+            return id;
+        }
+
+        void append_label(std::string& labels, std::string_view name, std::string_view value)
+        {
+            if (!labels.empty())
+            {
+                labels += ',';
+            }
+            labels += name;
+            labels += "=\"";
+            for (const char c : value)
+            {
+                switch (c)
+                {
+                case '\\': labels += "\\\\"; break;
+                case '"': labels += "\\\""; break;
+                case '\n': labels += "\\n"; break;
+                default: labels += c;
+                }
+            }
+            labels += '"';
+        }
+
+        double seconds(Metrics::Duration elapsed)
+        {
+            return std::chrono::duration<double>(elapsed).count();
+        }
+
+        uint64_t nanoseconds(Metrics::Duration elapsed)
+        {
+            return static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+
+        std::string format_value(double value)
+        {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+            return buffer;
+        }
+
+        void append_sample(std::string& out, std::string_view name, std::string_view labels, std::string_view value)
+        {
+            out += name;
+            if (!labels.empty())
+            {
+                out += '{';
+                out += labels;
+                out += '}';
+            }
+            out += ' ';
+            out += value;
+            out += '\n';
+        }
+
+        template<size_t N>
+        void append_histogram(std::string& out, std::string_view name, const std::string& labels,
+                              const std::array<double, N>& bounds, const HistogramTotals<N>& totals, double sum_scale)
+        {
+            const std::string separator = labels.empty() ? "" : ",";
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i <= N; i++)
+            {
+                cumulative += totals.buckets[i];
+                const std::string le = i < N ? format_value(bounds[i]) : "+Inf";
+                append_sample(out, std::string(name) + "_bucket", labels + separator + "le=\"" + le + '"',
+                              std::to_string(cumulative));
+            }
+            append_sample(out, std::string(name) + "_sum", labels, format_value(totals.sum * sum_scale));
+            append_sample(out, std::string(name) + "_count", labels, std::to_string(cumulative));
+        }
+
+        // Sums a family over every shard
+        template<typename Cells, typename Totals, typename Add>
+        std::vector<Totals> collect(size_t series, std::unique_ptr<Cells[]> Shard::*cells, Add add)
+        {
+            std::vector<Totals> totals(series);
+            std::lock_guard lock(shards_mutex);
+            for (const auto& shard : shards)
+            {
+                for (size_t i = 0; i < series; i++)
+                {
+                    add(totals[i], ((*shard).*cells)[i]);
+                }
+            }
+            return totals;
+        }
+    }
+
+    void Metrics::request_started(std::string_view route, std::string_view method)
+    {
+        std::string labels;
+        append_label(labels, "route", route);
+        append_label(labels, "method", method);
+        ThreadState& state = thread_state();
+        bump(state.shard->routes[series_id(state.route_ids, route_series(), labels)].started);
+    }
+
+    void Metrics::request_finished(std::string_view route, std::string_view method, int status, Duration elapsed,
+                                   size_t request_bytes, size_t response_bytes)
+    {
+        std::string labels;
+        append_label(labels, "route", route);
+        append_label(labels, "method", method);
+        ThreadState& state = thread_state();
+        bump(state.shard->routes[series_id(state.route_ids, route_series(), labels)].finished);
+
+        append_label(labels, "status", std::to_string(status));
+        RequestCells& cells = state.shard->requests[series_id(state.request_ids, request_series(), labels)];
+        cells.latency.observe(REQUEST_SECONDS, seconds(elapsed), nanoseconds(elapsed));
+        cells.request_size.observe(SIZE_BYTES, static_cast<double>(request_bytes), request_bytes);
+        cells.response_size.observe(SIZE_BYTES, static_cast<double>(response_bytes), response_bytes);
+    }
+
+    void Metrics::query_finished(std::string_view query, Duration elapsed, bool failed)
+    {
+        std::string labels;
+        append_label(labels, "query", query);
+        ThreadState& state = thread_state();
+        QueryCells& cells = state.shard->queries[series_id(state.query_ids, query_series(), labels)];
+        cells.latency.observe(QUERY_SECONDS, seconds(elapsed), nanoseconds(elapsed));
+        if (failed)
+        {
+            bump(cells.errors);
+        }
+    }
+
+    void Metrics::pool_checkout(Duration waited, bool timed_out)
+    {
+        PoolCells& cells = thread_state().shard->pool;
+        cells.wait.observe(QUERY_SECONDS, seconds(waited), nanoseconds(waited));
+        if (timed_out)
+        {
+            bump(cells.timeouts);
+        }
+    }
+
+    void Metrics::add_collector(Collector collector)
+    {
+        std::lock_guard lock(collectors_mutex_);
+        collectors_.push_back(std::move(collector));
+    }
+
+    std::string Metrics::render()
+    {
+        using RequestTotals = std::array<HistogramTotals<SIZE_BYTES.size()>, 2>;
+        std::string out;
+
+        // Requests
+        const auto request_labels = request_series().labels();
+        const auto latencies = collect<RequestCells, HistogramTotals<REQUEST_SECONDS.size()>>(
+            request_labels.size(), &Shard::requests,
+            [](auto& totals, const RequestCells& cells) { totals.add(cells.latency); });
+        const auto sizes = collect<RequestCells, RequestTotals>(
+            request_labels.size(), &Shard::requests,
+            [](auto& totals, const RequestCells& cells) {
+                totals[0].add(cells.request_size);
+                totals[1].add(cells.response_size);
+            });
+
+        append_metric_header(out, "mkm_http_requests_total", "counter", "Finished HTTP requests by route, method and status");
+        for (size_t i = 0; i < request_labels.size(); i++)
+        {
+            if (latencies[i].count() > 0)
+            {
+                append_sample(out, "mkm_http_requests_total", request_labels[i], std::to_string(latencies[i].count()));
+            }
+        }
+        append_metric_header(out, "mkm_http_request_duration_seconds", "histogram", "Time from routing a request to finishing its response");
+        for (size_t i = 0; i < request_labels.size(); i++)
+        {
+            if (latencies[i].count() > 0)
+            {
+                append_histogram(out, "mkm_http_request_duration_seconds", request_labels[i], REQUEST_SECONDS, latencies[i], 1e-9);
+            }
+        }
+        append_metric_header(out, "mkm_http_request_size_bytes", "histogram", "Request body sizes");
+        for (size_t i = 0; i < request_labels.size(); i++)
+        {
+            if (sizes[i][0].count() > 0)
+            {
+                append_histogram(out, "mkm_http_request_size_bytes", request_labels[i], SIZE_BYTES, sizes[i][0], 1);
+            }
+        }
+        append_metric_header(out, "mkm_http_response_size_bytes", "histogram", "Response body sizes, before compression");
+        for (size_t i = 0; i < request_labels.size(); i++)
+        {
+            if (sizes[i][1].count() > 0)
+            {
+                append_histogram(out, "mkm_http_response_size_bytes", request_labels[i], SIZE_BYTES, sizes[i][1], 1);
+            }
+        }
+
+        // In flight
+        const auto route_labels = route_series().labels();
+        const auto in_flight = collect<RouteCells, std::pair<uint64_t, uint64_t>>(
+            route_labels.size(), &Shard::routes,
+            [](auto& totals, const RouteCells& cells) {
+                totals.first += cells.started.load(std::memory_order_relaxed);
+                totals.second += cells.finished.load(std::memory_order_relaxed);
+            });
+        append_metric_header(out, "mkm_http_requests_in_flight", "gauge", "Requests routed but not finished yet");
+        for (size_t i = 0; i < route_labels.size(); i++)
+        {
+            // Shards are read one after the other, so a request may be seen finishing but not starting
+            const auto& [started, finished] = in_flight[i];
+            append_sample(out, "mkm_http_requests_in_flight", route_labels[i],
+                          std::to_string(started > finished ? started - finished : 0));
+        }
+
+        // Database
+        const auto query_labels = query_series().labels();
+        const auto queries = collect<QueryCells, std::pair<HistogramTotals<QUERY_SECONDS.size()>, uint64_t>>(
+            query_labels.size(), &Shard::queries,
+            [](auto& totals, const QueryCells& cells) {
+                totals.first.add(cells.latency);
+                totals.second += cells.errors.load(std::memory_order_relaxed);
+            });
+        append_metric_header(out, "mkm_db_query_duration_seconds", "histogram", "Database round trips by prepared statement");
+        for (size_t i = 0; i < query_labels.size(); i++)
+        {
+            if (queries[i].first.count() > 0)
+            {
+                append_histogram(out, "mkm_db_query_duration_seconds", query_labels[i], QUERY_SECONDS, queries[i].first, 1e-9);
+            }
+        }
+        append_metric_header(out, "mkm_db_query_errors_total", "counter", "Failed database queries by prepared statement");
+        for (size_t i = 0; i < query_labels.size(); i++)
+        {
+            if (queries[i].first.count() > 0)
+            {
+                append_sample(out, "mkm_db_query_errors_total", query_labels[i], std::to_string(queries[i].second));
+            }
+        }
+
+        HistogramTotals<QUERY_SECONDS.size()> pool_wait;
+        uint64_t pool_timeouts = 0;
+        {
+            std::lock_guard lock(shards_mutex);
+            for (const auto& shard : shards)
+            {
+                pool_wait.add(shard->pool.wait);
+                pool_timeouts += shard->pool.timeouts.load(std::memory_order_relaxed);
+            }
+        }
+        append_metric_header(out, "mkm_db_pool_wait_seconds", "histogram", "Time spent checking out a pooled connection");
+        append_histogram(out, "mkm_db_pool_wait_seconds", "", QUERY_SECONDS, pool_wait, 1e-9);
+        append_metric_header(out, "mkm_db_pool_timeouts_total", "counter", "Checkouts that gave up waiting for a connection");
+        append_sample(out, "mkm_db_pool_timeouts_total", "", std::to_string(pool_timeouts));
+
+        std::lock_guard lock(collectors_mutex_);
+        for (const auto& collector : collectors_)
+        {
+            collector(out);
+        }
+        return out;
+    }
+
+    Metrics& metrics()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    std::string metrics_route(std::string_view path)
+    {
+        std::string route;
+        route.reserve(path.size());
+        size_t pos = 0;
+        while (pos < path.size())
+        {
+            const size_t end = std::min(path.find('/', pos), path.size());
+            const std::string_view segment = path.substr(pos, end - pos);
+            const bool numeric = !segment.empty()
+                && std::all_of(segment.begin(), segment.end(), [](char c) { return c >= '0' && c <= '9'; });
+            route += numeric ? std::string_view("<uint>") : segment;
+            if (end < path.size())
+            {
+                route += '/';
+            }
+            pos = end + 1;
+        }
+        return route.empty() ? "/" : route;
+    }
+
+    void append_metric_header(std::string& out, std::string_view name, std::string_view type, std::string_view help)
+    {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    void append_metric_sample(std::string& out, std::string_view name, std::string_view labels, double value)
+    {
+        append_sample(out, name, labels, format_value(value));
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mkm
+{
+/**
+ * @brief Process-wide request, query and connection pool metrics, rendered in the Prometheus text
+ * exposition format.
+ *
+ * Recording is lock-free: every thread writes counters and histogram buckets in its own shard, and
+ * shards are only summed when metrics are scraped. Label combinations are registered once per
+ * thread; after that, recording a sample is a thread-local lookup and a few relaxed stores.
+ * The number of distinct label sets per family is capped, beyond that samples are counted under
+ * a single "other" series so that odd labels can't grow memory without bound. Routes should still
+ * be folded to a fixed set by the caller, or odd URLs crowd the real routes out of their series.
+ */
+class Metrics
+{
+public:
+    using Duration = std::chrono::steady_clock::duration;
+    // Appends further samples, e.g. gauges read from other subsystems at scrape time
+    using Collector = std::function<void(std::string& out)>;
+
+    void request_started(std::string_view route, std::string_view method);
+    void request_finished(std::string_view route, std::string_view method, int status, Duration elapsed,
+                          size_t request_bytes, size_t response_bytes);
+
+    /**
+     * @param query name of the prepared statement, see db_statements.h
+     */
+    void query_finished(std::string_view query, Duration elapsed, bool failed);
+
+    void pool_checkout(Duration waited, bool timed_out);
+
+    void add_collector(Collector collector);
+
+    std::string render();
+
+private:
+    std::mutex collectors_mutex_;
+    std::vector<Collector> collectors_;
+};
+
+Metrics& metrics();
+
+/**
+ * @brief Route label for a request path: numeric segments become <uint>, as in the route templates,
+ * so that every moment shares the series of its route
+ */
+std::string metrics_route(std::string_view path);
+
+/**
+ * @brief Helpers for collectors
+ */
+void append_metric_header(std::string& out, std::string_view name, std::string_view type, std::string_view help);
+void append_metric_sample(std::string& out, std::string_view name, std::string_view labels, double value);
+
+/**
+ * @brief Run a synchronous query and record its duration under the statement's name
+ */
+template<typename Run>
+auto timed_query(const char* statement, Run&& run) -> decltype(run())
+{
+    const auto started = std::chrono::steady_clock::now();
+    try
+    {
+        auto result = run();
+        metrics().query_finished(statement, std::chrono::steady_clock::now() - started, false);
+        return result;
+    }
+    catch (...)
+    {
+        metrics().query_finished(statement, std::chrono::steady_clock::now() - started, true);
+        throw;
+    }
+}
+}   // namespace mkm
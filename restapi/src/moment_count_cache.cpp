@@ -0,0 +1,39 @@
+#include "moment_count_cache.h"
+#include "config_env.h"
+
+namespace mkm
+{
+    MomentCountCache::MomentCountCache(size_t capacity, std::chrono::seconds time_to_live)
+        : cache_(capacity)
+        , time_to_live_(time_to_live)
+    {
+    }
+
+    std::optional<uint64_t> MomentCountCache::get(const std::string& username)
+    {
+        return cache_.get(username);
+    }
+
+    uint64_t MomentCountCache::generation(const std::string& username) const
+    {
+        return generations_.generation(username);
+    }
+
+    void MomentCountCache::put(const std::string& username, uint64_t count, uint64_t generation)
+    {
+        generations_.put(cache_, username, generation, username, count, std::chrono::system_clock::now() + time_to_live_);
+    }
+
+    void MomentCountCache::invalidate(const std::string& username)
+    {
+        generations_.invalidate(username);
+        cache_.erase(username);
+    }
+
+    MomentCountCache& moment_count_cache()
+    {
+        static MomentCountCache cache(env_or("MKM_COUNT_CACHE_SIZE", size_t{10000}),
+                                      std::chrono::seconds(env_or("MKM_COUNT_CACHE_TTL_S", size_t{60})));
+        return cache;
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "generation_guard.h"
+#include "lru_cache.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace mkm
+{
+/**
+ * @brief Per-user moment totals kept in memory in front of users.moment_count.
+ *
+ * Write paths call invalidate() after their transaction commits. Readers take a generation()
+ * before querying and hand it back to put(), which drops the value if a write to the same user
+ * happened meanwhile - otherwise a slow reader could cache a count that predates the write.
+ * Entries also expire after a while, which bounds staleness when several API processes share one
+ * database.
+ */
+class MomentCountCache
+{
+public:
+    MomentCountCache(size_t capacity, std::chrono::seconds time_to_live);
+
+    std::optional<uint64_t> get(const std::string& username);
+
+    uint64_t generation(const std::string& username) const;
+
+    void put(const std::string& username, uint64_t count, uint64_t generation);
+
+    void invalidate(const std::string& username);
+
+private:
+    ShardedLruCache<std::string, uint64_t> cache_;
+    const std::chrono::seconds time_to_live_;
+    GenerationGuard<std::string> generations_;
+};
+
+/**
+ * @brief Process-wide cache for MKM_COUNT_CACHE_SIZE (default 10000) users, entries live for
+ * MKM_COUNT_CACHE_TTL_S (default 60) seconds
+ */
+MomentCountCache& moment_count_cache();
+}   // namespace mkm
@@ -0,0 +1,69 @@
+#include "moment_detail_cache.h"
+#include "config_env.h"
+
+namespace mkm
+{
+    namespace
+    {
+        // Short strings live inside the object; only longer ones own a heap block
+        template<typename String>
+        size_t heap_size(const String& value)
+        {
+            return value.capacity() > String().capacity() ? value.capacity() + 1 : 0;
+        }
+    }
+
+    size_t MomentDetailCache::Weigh::operator()(const Key& key, const std::shared_ptr<const Moment>& moment) const noexcept
+    {
+        // Entry, list node, index node and the control block of the shared pointer
+        size_t weight = sizeof(Key) + sizeof(Moment) + 128 + heap_size(key.username);
+        if (!moment)
+        {
+            return weight;
+        }
+        weight += heap_size(moment->username);
+        for (const std::pmr::string* field : {&moment->title, &moment->description, &moment->image_filename,
+                                              &moment->image_path, &moment->thumbnail_path, &moment->preview_path,
+                                              &moment->image_caption})
+        {
+            weight += heap_size(*field);
+        }
+        return weight + moment->image_content.size();
+    }
+
+    MomentDetailCache::MomentDetailCache(size_t capacity_bytes, std::chrono::seconds time_to_live)
+        : cache_(capacity_bytes)
+        , time_to_live_(time_to_live)
+    {
+    }
+
+    std::shared_ptr<const Moment> MomentDetailCache::get(const std::string& username, uint64_t id)
+    {
+        return cache_.get(Key{username, id}).value_or(nullptr);
+    }
+
+    uint64_t MomentDetailCache::generation(const std::string& username, uint64_t id) const
+    {
+        return generations_.generation(Key{username, id});
+    }
+
+    void MomentDetailCache::put(const std::string& username, uint64_t id, std::shared_ptr<const Moment> moment, uint64_t generation)
+    {
+        const Key key{username, id};
+        generations_.put(cache_, key, generation, key, std::move(moment), std::chrono::system_clock::now() + time_to_live_);
+    }
+
+    void MomentDetailCache::invalidate(const std::string& username, uint64_t id)
+    {
+        Key key{username, id};
+        generations_.invalidate(key);
+        cache_.erase(key);
+    }
+
+    MomentDetailCache& moment_detail_cache()
+    {
+        static MomentDetailCache cache(env_or("MKM_DETAIL_CACHE_BYTES", size_t{64} * 1024 * 1024),
+                                       std::chrono::seconds(env_or("MKM_DETAIL_CACHE_TTL_S", size_t{60})));
+        return cache;
+    }
+}
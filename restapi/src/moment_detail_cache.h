@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Moment.h"
+#include "generation_guard.h"
+#include "lru_cache.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace mkm
+{
+/**
+ * @brief Decoded moments as returned by get_moment_details(), keyed by (user, id) and bounded by
+ * the memory they hold - legacy image bytes included - rather than by their number.
+ *
+ * Entries are shared and immutable, so a hit copies a pointer under the shard lock and nothing
+ * else. Invalidation follows MomentCountCache: writers call invalidate() after committing, readers
+ * pass the generation() taken before their query to put().
+ */
+class MomentDetailCache
+{
+public:
+    struct Key
+    {
+        std::string username;
+        uint64_t id;
+
+        bool operator==(const Key& other) const { return id == other.id && username == other.username; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const noexcept
+        {
+            return std::hash<std::string>{}(key.username) ^ (key.id * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    // Approximate heap and inline bytes of an entry, so that the bound holds for large descriptions
+    // and images as well as for the common small moment
+    struct Weigh
+    {
+        size_t operator()(const Key& key, const std::shared_ptr<const Moment>& moment) const noexcept;
+    };
+
+    using Cache = ShardedLruCache<Key, std::shared_ptr<const Moment>, KeyHash, 16, Weigh>;
+    using Stats = Cache::Stats;
+
+    MomentDetailCache(size_t capacity_bytes, std::chrono::seconds time_to_live);
+
+    std::shared_ptr<const Moment> get(const std::string& username, uint64_t id);
+
+    uint64_t generation(const std::string& username, uint64_t id) const;
+
+    void put(const std::string& username, uint64_t id, std::shared_ptr<const Moment> moment, uint64_t generation);
+
+    void invalidate(const std::string& username, uint64_t id);
+
+    Stats stats() const { return cache_.stats(); }
+
+private:
+    Cache cache_;
+    const std::chrono::seconds time_to_live_;
+    GenerationGuard<Key, KeyHash> generations_;
+};
+
+/**
+ * @brief Process-wide cache of MKM_DETAIL_CACHE_BYTES (default 64 MiB), entries live for
+ * MKM_DETAIL_CACHE_TTL_S (default 60) seconds
+ */
+MomentDetailCache& moment_detail_cache();
+}   // namespace mkm
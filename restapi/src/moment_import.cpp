@@ -0,0 +1,334 @@
+#include "moment_import.h"
+#include "config_env.h"
+#include "epoch_time.h"
+#include "feelings.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace mkm
+{
+    namespace
+    {
+        // Sizes of the moments columns, in characters. A single oversized value would fail a
+        // whole bulk import, so they are checked here rather than left to the database.
+        constexpr size_t MAX_TITLE_CHARACTERS = 100;
+        constexpr size_t MAX_DESCRIPTION_CHARACTERS = 2000;
+        constexpr size_t MAX_CAPTION_CHARACTERS = 100;
+        constexpr size_t DATE_CHARACTERS = 10;
+
+        // Room for the longest valid moment even with every character escaped as \uXXXX
+        constexpr size_t MAX_LINE_BYTES = 64 * 1024;
+
+        /**
+         * Number of characters in text, or std::nullopt if it isn't valid UTF-8 or contains a NUL
+         * character - Postgres accepts neither in a text column
+         */
+        std::optional<size_t> utf8_characters(std::string_view text)
+        {
+            size_t characters = 0;
+            for (size_t i = 0; i < text.size(); ++characters)
+            {
+                const auto lead = static_cast<unsigned char>(text[i]);
+                if (lead < 0x80)
+                {
+                    if (lead == 0)
+                    {
+                        return std::nullopt;
+                    }
+                    ++i;
+                    continue;
+                }
+                size_t length;
+                uint32_t code;
+                uint32_t smallest;
+                if ((lead & 0xE0) == 0xC0)
+                {
+                    length = 2;
+                    code = lead & 0x1F;
+                    smallest = 0x80;
+                }
+                else if ((lead & 0xF0) == 0xE0)
+                {
+                    length = 3;
+                    code = lead & 0x0F;
+                    smallest = 0x800;
+                }
+                else if ((lead & 0xF8) == 0xF0)
+                {
+                    length = 4;
+                    code = lead & 0x07;
+                    smallest = 0x10000;
+                }
+                else
+                {
+                    return std::nullopt;
+                }
+                if (length > text.size() - i)
+                {
+                    return std::nullopt;
+                }
+                for (size_t k = 1; k < length; ++k)
+                {
+                    const auto next = static_cast<unsigned char>(text[i + k]);
+                    if ((next & 0xC0) != 0x80)
+                    {
+                        return std::nullopt;
+                    }
+                    code = (code << 6) | (next & 0x3F);
+                }
+                // Overlong encodings, surrogates and code points past Unicode
+                if (code < smallest || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF))
+                {
+                    return std::nullopt;
+                }
+                i += length;
+            }
+            return characters;
+        }
+
+        /**
+         * Copy the string member key of object into value, if present
+         * @param value a std::pmr::string of the moment, or any other string
+         */
+        template<typename String>
+        std::optional<std::string> read_text(const crow::json::rvalue& object, const char* key, size_t max_characters,
+                                             bool single_line, bool required, String& value)
+        {
+            if (!object.has(key))
+            {
+                if (required)
+                {
+                    return std::string(key) + " is missing";
+                }
+                return std::nullopt;
+            }
+            const auto& member = object[key];
+            if (member.t() != crow::json::type::String)
+            {
+                return std::string(key) + " must be a string";
+            }
+            const auto text = member.s();
+            const std::string_view view(text.begin(), text.size());
+            if (view.empty())
+            {
+                return std::string(key) + " cannot be empty";
+            }
+            const auto characters = utf8_characters(view);
+            if (!characters || (single_line && view.find_first_of("\r\n") != std::string_view::npos))
+            {
+                return std::string(key) + " contains invalid characters";
+            }
+            if (*characters > max_characters)
+            {
+                return std::string(key) + " exceeds maximum length of " + std::to_string(max_characters);
+            }
+            value.assign(view.data(), view.size());
+            return std::nullopt;
+        }
+
+        std::optional<std::string> read_feelings(const crow::json::rvalue& object, FeelingSet& feelings)
+        {
+            if (!object.has("feelings") || object["feelings"].t() == crow::json::type::Null)
+            {
+                return std::nullopt;
+            }
+            const auto& list = object["feelings"];
+            if (list.t() != crow::json::type::List)
+            {
+                return std::string("feelings must be an array of names");
+            }
+            for (const auto& item : list)
+            {
+                if (item.t() != crow::json::type::String)
+                {
+                    return std::string("feelings must be an array of names");
+                }
+                const auto name = item.s();
+                const std::string_view view(name.begin(), name.size());
+                const auto id = feeling_dictionary().find(view);
+                if (!id)
+                {
+                    return "Unknown feeling: " + std::string(view);
+                }
+                feelings.add(*id);
+            }
+            return std::nullopt;
+        }
+    }
+
+    MomentImportConfig MomentImportConfig::from_env()
+    {
+        MomentImportConfig config;
+        config.max_moments = std::max<size_t>(env_or("MKM_IMPORT_MAX_MOMENTS", config.max_moments), 1);
+        config.max_batch_ids = std::max<size_t>(env_or("MKM_BATCH_MAX_IDS", config.max_batch_ids), 1);
+        return config;
+    }
+
+    const MomentImportConfig& moment_import_config()
+    {
+        static const MomentImportConfig config = MomentImportConfig::from_env();
+        return config;
+    }
+
+    std::optional<std::string> moment_from_json(const crow::json::rvalue& object, Moment& moment, bool required)
+    {
+        if (object.t() != crow::json::type::Object)
+        {
+            return std::string("Expected a JSON object");
+        }
+        if (auto error = read_text(object, "title", MAX_TITLE_CHARACTERS, true, required, moment.title))
+        {
+            return error;
+        }
+        if (auto error = read_text(object, "description", MAX_DESCRIPTION_CHARACTERS, false, required, moment.description))
+        {
+            return error;
+        }
+        std::string date;
+        if (auto error = read_text(object, "date", DATE_CHARACTERS, true, required, date))
+        {
+            return error;
+        }
+        if (!date.empty())
+        {
+            const auto days = parse_date(date);
+            if (!days)
+            {
+                return std::string("Invalid date, expected YYYY-MM-DD");
+            }
+            moment.date = *days;
+        }
+        if (auto error = read_text(object, "image_caption", MAX_CAPTION_CHARACTERS, true, false, moment.image_caption))
+        {
+            return error;
+        }
+        return read_feelings(object, moment.feelings);
+    }
+
+    MomentImport::MomentImport(size_t max_moments, std::pmr::memory_resource* memory)
+        : max_moments_(max_moments)
+        , memory_(memory)
+        , moments_(memory)
+        , pending_(memory)
+    {
+    }
+
+    void MomentImport::feed(std::string_view data)
+    {
+        while (true)
+        {
+            const size_t newline = data.find('\n');
+            const std::string_view piece = data.substr(0, newline);
+            if (!skipping_)
+            {
+                if (pending_.size() + piece.size() > MAX_LINE_BYTES)
+                {
+                    pending_.clear();
+                    skipping_ = true;
+                }
+                else if (newline == std::string_view::npos)
+                {
+                    pending_.append(piece);
+                    return;
+                }
+            }
+            if (newline == std::string_view::npos)
+            {
+                return;
+            }
+
+            if (skipping_)
+            {
+                ++lines_;
+                read_line({});
+                skipping_ = false;
+            }
+            else if (pending_.empty())
+            {
+                // The common case: the whole line is in this piece and is read in place
+                ++lines_;
+                read_line(piece);
+            }
+            else
+            {
+                pending_.append(piece);
+                ++lines_;
+                read_line(pending_);
+                pending_.clear();
+            }
+            data.remove_prefix(newline + 1);
+        }
+    }
+
+    void MomentImport::finish()
+    {
+        if (skipping_ || !pending_.empty())
+        {
+            ++lines_;
+            read_line(pending_);
+            pending_.clear();
+            skipping_ = false;
+        }
+    }
+
+    void MomentImport::read_line(std::string_view line)
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        if (!skipping_ && line.find_first_not_of(" \t") == std::string_view::npos)
+        {
+            return;
+        }
+        if (moments_.size() + rejections_.size() >= max_moments_)
+        {
+            throw import_error("An import takes at most " + std::to_string(max_moments_) + " moments");
+        }
+        if (skipping_)
+        {
+            rejections_.push_back({lines_, "Line exceeds maximum length of " + std::to_string(MAX_LINE_BYTES) + " bytes"});
+            return;
+        }
+
+        const auto object = crow::json::load(line.data(), line.size());
+        if (!object)
+        {
+            rejections_.push_back({lines_, "Invalid JSON"});
+            return;
+        }
+        Moment moment = moment_with_memory(memory_);
+        if (auto error = moment_from_json(object, moment, true))
+        {
+            rejections_.push_back({lines_, std::move(*error)});
+            return;
+        }
+        // Captions only make sense together with an image, and imports carry none
+        moment.image_caption.clear();
+        moments_.push_back(std::move(moment));
+    }
+
+    void MomentImport::on_part_begin(const MultipartParser::PartHeaders& headers)
+    {
+        if (headers.name != "moments")
+        {
+            throw multipart_error("Unexpected part '" + headers.name + "'");
+        }
+        if (part_seen_)
+        {
+            throw multipart_error("Duplicate field 'moments'");
+        }
+        part_seen_ = true;
+    }
+
+    void MomentImport::on_part_data(std::string_view data)
+    {
+        feed(data);
+    }
+
+    void MomentImport::on_part_end()
+    {
+        finish();
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Moment.h"
+#include "multipart_stream.h"
+#include "request_arena.h"
+
+#include <crow/json.h>
+
+#include <cstddef>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mkm
+{
+struct MomentImportConfig
+{
+    // Moments one import may carry; bigger migrations are sent as several imports
+    size_t max_moments = 10000;
+    // Ids one batch update or delete may name
+    size_t max_batch_ids = 1000;
+
+    /**
+     * @brief MKM_IMPORT_MAX_MOMENTS, MKM_BATCH_MAX_IDS
+     */
+    static MomentImportConfig from_env();
+};
+
+const MomentImportConfig& moment_import_config();
+
+// An import that can't be taken as a whole, e.g. one with too many moments - answer 400
+class import_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Copy the fields of a JSON moment - "title", "description", "date" (YYYY-MM-DD),
+ * "feelings" (array of names) and "image_caption" - into moment. Other keys are ignored.
+ * Values are checked against the sizes of their columns, so that the insert can't fail on them.
+ * @param required whether title, description and date must be present, as for a new moment
+ * @return std::optional<std::string> Error message if the object or a field is invalid
+ */
+std::optional<std::string> moment_from_json(const crow::json::rvalue& object, Moment& moment, bool required);
+
+struct ImportRejection
+{
+    // 1-based line number in the NDJSON stream
+    size_t line;
+    std::string error;
+};
+
+/**
+ * @brief Reads the moments of a bulk import from NDJSON, one JSON object per line as taken by
+ * moment_from_json(). Each line is validated on its own: an invalid one is reported by its line
+ * number and the rest are still imported. Blank lines are skipped.
+ *
+ * The stream may be fed in arbitrary pieces, straight from a request body or as the "moments"
+ * part of a multipart form, for which it is the MultipartParser handler. Accepted moments are
+ * kept in the given memory, the request's arena by default, and have no username yet.
+ */
+class MomentImport : public MultipartParser::Handler
+{
+public:
+    explicit MomentImport(size_t max_moments, std::pmr::memory_resource* memory = request_memory());
+
+    /**
+     * @throws import_error if the stream holds more than max_moments moments
+     */
+    void feed(std::string_view data);
+
+    /**
+     * @brief Call once the whole stream was fed, for a last line without a newline
+     */
+    void finish();
+
+    const std::pmr::vector<Moment>& moments() const { return moments_; }
+    const std::vector<ImportRejection>& rejections() const { return rejections_; }
+
+    void on_part_begin(const MultipartParser::PartHeaders& headers) override;
+    void on_part_data(std::string_view data) override;
+    void on_part_end() override;
+
+private:
+    void read_line(std::string_view line);
+
+    const size_t max_moments_;
+    std::pmr::memory_resource* const memory_;
+    std::pmr::vector<Moment> moments_;
+    std::vector<ImportRejection> rejections_;
+
+    // Start of a line that continues in the next piece
+    std::pmr::string pending_;
+    // The current line is too long and is being dropped up to its end
+    bool skipping_ = false;
+    size_t lines_ = 0;
+    bool part_seen_ = false;
+};
+}   // namespace mkm
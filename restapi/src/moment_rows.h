@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Moment.h"
+#include "async_log.h"
+#include "request_arena.h"
+
+#include <pqxx/pqxx>
+
+#include <memory_resource>
+#include <string_view>
+
+namespace mkm
+{
+/**
+ * @brief Add the elements of a text[] column to feelings, interning names the dictionary
+ * doesn't know yet
+ * @param field a pqxx::field, or a PgField of an asynchronous result
+ */
+template<typename Field>
+void read_feelings(const Field& field, FeelingSet& feelings)
+{
+    if (field.is_null())
+    {
+        return;
+    }
+    auto array_parser_obj = field.as_array();
+    while (true)
+    {
+        const auto& [juncture_val, array_val] = array_parser_obj.get_next();
+        if (juncture_val == pqxx::array_parser::juncture::done)
+        {
+            break;
+        }
+        if (juncture_val == pqxx::array_parser::juncture::string_value)
+        {
+            if (const auto id = feeling_dictionary().intern(array_val))
+            {
+                feelings.add(*id);
+            }
+            else
+            {
+                MKM_LOG_WARNING(DB) << "Feeling dictionary is full, dropping '" << array_val << "'";
+            }
+        }
+    }
+}
+
+/**
+ * @brief Read a "(moment_date - DATE '1970-01-01')" column
+ * @param field a pqxx::field, or a PgField of an asynchronous result
+ */
+template<typename Field>
+EpochDays read_epoch_days(const Field& field)
+{
+    return field.is_null() ? NO_DATE : field.template as<EpochDays>();
+}
+
+/**
+ * @brief Map a row of the listing statements (stmt::MOMENTS_PAGE_ASC and friends) to a Moment
+ * @param row a pqxx::row, or a PgRow of an asynchronous result
+ * @param memory where the text fields allocate, the request's arena if one is open
+ */
+template<typename Row>
+Moment moment_from_list_row(const Row& row, std::pmr::memory_resource* memory = request_memory())
+{
+    Moment moment = moment_with_memory(memory);
+    moment.id = row["id"].template as<uint64_t>();
+    moment.username = row["username"].c_str();
+    moment.title = row["title"].c_str();
+    moment.description = row["description"].c_str();
+    moment.date = read_epoch_days(row["moment_days"]);
+    moment.image_filename = row["image_filename"].c_str();
+    moment.image_path = row["image_path"].c_str();
+    moment.thumbnail_path = row["thumbnail_path"].c_str();
+    moment.preview_path = row["preview_path"].c_str();
+    moment.derivative_status = static_cast<DerivativeStatus>(row["derivative_status"].template as<int>());
+    moment.image_caption = row["image_caption"].c_str();
+    moment.created_date = row["created_us"].template as<EpochMicros>();
+    moment.last_modified_date = row["last_modified_us"].template as<EpochMicros>();
+    read_feelings(row["feelings"], moment.feelings);
+    return moment;
+}
+}   // namespace mkm
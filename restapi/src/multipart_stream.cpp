@@ -0,0 +1,393 @@
+#include "multipart_stream.h"
+
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
+namespace mkm
+{
+    namespace
+    {
+        // Pieces of at most this size are stitched onto carried-over bytes before parsing resumes
+        // directly on the caller's buffer
+        constexpr size_t STITCH_SIZE = 4096;
+        // Header block of a single part
+        constexpr size_t MAX_HEADER_SIZE = 8192;
+        // RFC 2046 limits boundaries to 70 characters
+        constexpr size_t MAX_BOUNDARY_SIZE = 70;
+
+        std::string_view trim(std::string_view value)
+        {
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+            {
+                value.remove_prefix(1);
+            }
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+            {
+                value.remove_suffix(1);
+            }
+            return value;
+        }
+
+        bool iequals(std::string_view a, std::string_view b)
+        {
+            return a.size() == b.size()
+                && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+                       return std::tolower(x) == std::tolower(y);
+                   });
+        }
+
+        std::string unquote(std::string_view value)
+        {
+            value = trim(value);
+            if (value.size() < 2 || value.front() != '"' || value.back() != '"')
+            {
+                return std::string(value);
+            }
+            value = value.substr(1, value.size() - 2);
+            std::string unquoted;
+            unquoted.reserve(value.size());
+            for (size_t i = 0; i < value.size(); i++)
+            {
+                if (value[i] == '\\' && i + 1 < value.size())
+                {
+                    i++;
+                }
+                unquoted += value[i];
+            }
+            return unquoted;
+        }
+
+        /**
+         * Split "type; key=value; key2="value 2"" into its parameters, honouring quoted semicolons
+         */
+        std::vector<std::pair<std::string_view, std::string_view>> header_params(std::string_view value)
+        {
+            std::vector<std::pair<std::string_view, std::string_view>> params;
+            size_t pos = value.find(';');
+            while (pos != std::string_view::npos)
+            {
+                const size_t start = pos + 1;
+                bool quoted = false;
+                size_t end = start;
+                while (end < value.size() && (quoted || value[end] != ';'))
+                {
+                    if (value[end] == '"')
+                    {
+                        quoted = !quoted;
+                    }
+                    else if (value[end] == '\\' && quoted)
+                    {
+                        end++;
+                    }
+                    end++;
+                }
+                const std::string_view param = value.substr(start, std::min(end, value.size()) - start);
+                const size_t equals = param.find('=');
+                if (equals != std::string_view::npos)
+                {
+                    params.emplace_back(trim(param.substr(0, equals)), param.substr(equals + 1));
+                }
+                pos = end < value.size() ? end : std::string_view::npos;
+            }
+            return params;
+        }
+    }
+
+    std::optional<std::string> multipart_boundary(std::string_view content_type)
+    {
+        const std::string_view type = trim(content_type.substr(0, content_type.find(';')));
+        if (!iequals(type, "multipart/form-data"))
+        {
+            return std::nullopt;
+        }
+        for (const auto& [key, value] : header_params(content_type))
+        {
+            if (iequals(key, "boundary"))
+            {
+                std::string boundary = unquote(value);
+                if (boundary.empty() || boundary.size() > MAX_BOUNDARY_SIZE)
+                {
+                    return std::nullopt;
+                }
+                return boundary;
+            }
+        }
+        return std::nullopt;
+    }
+
+    MultipartParser::MultipartParser(std::string_view boundary, Handler& handler)
+        : delimiter_("\r\n--" + std::string(boundary))
+        , handler_(handler)
+    {
+    }
+
+    void MultipartParser::feed(std::string_view data)
+    {
+        // Bytes carried over from the previous piece: stitch a little of the new one onto them until
+        // the carry is used up, then hand back what is left of the stitched piece
+        while (!pending_.empty() && !data.empty())
+        {
+            const size_t carried = pending_.size();
+            const size_t take = std::min(data.size(), STITCH_SIZE);
+            pending_.append(data.data(), take);
+            const size_t used = parse(pending_);
+            if (used >= carried)
+            {
+                data.remove_prefix(used - carried);
+                pending_.clear();
+                break;
+            }
+            pending_.erase(0, used);
+            data.remove_prefix(take);
+            if (pending_.size() > MAX_HEADER_SIZE)
+            {
+                throw multipart_error("Multipart part headers too large");
+            }
+        }
+        if (!pending_.empty())
+        {
+            return;
+        }
+
+        const size_t used = parse(data);
+        if (data.size() - used > MAX_HEADER_SIZE)
+        {
+            throw multipart_error("Multipart part headers too large");
+        }
+        pending_.assign(data.substr(used));
+    }
+
+    void MultipartParser::finish()
+    {
+        if (state_ != State::DONE)
+        {
+            throw multipart_error("Multipart body is incomplete");
+        }
+    }
+
+    size_t MultipartParser::parse(std::string_view data)
+    {
+        size_t pos = 0;
+        while (pos < data.size())
+        {
+            switch (state_)
+            {
+            case State::PREAMBLE:
+            {
+                // The first delimiter may open the body, without the CRLF of the ones that follow
+                const std::string_view first_delimiter = std::string_view(delimiter_).substr(2);
+                const size_t found = data.find(first_delimiter, pos);
+                if (found == std::string_view::npos)
+                {
+                    // Anything before the first delimiter is ignored, keep what may be its beginning
+                    return std::max(pos, data.size() - std::min(data.size(), first_delimiter.size() - 1));
+                }
+                pos = found + first_delimiter.size();
+                state_ = State::AFTER_DELIMITER;
+                break;
+            }
+            case State::AFTER_DELIMITER:
+            {
+                if (data.size() - pos < 2)
+                {
+                    return pos;
+                }
+                const std::string_view marker = data.substr(pos, 2);
+                if (marker == "--")
+                {
+                    state_ = State::DONE;
+                    return data.size();
+                }
+                if (marker != "\r\n")
+                {
+                    throw multipart_error("Malformed multipart delimiter");
+                }
+                pos += 2;
+                state_ = State::HEADERS;
+                break;
+            }
+            case State::HEADERS:
+            {
+                // A part without any headers starts with the empty line right away
+                size_t end;
+                size_t block_end;
+                if (data.substr(pos, 2) == "\r\n")
+                {
+                    end = pos;
+                    block_end = pos + 2;
+                }
+                else
+                {
+                    end = data.find("\r\n\r\n", pos);
+                    if (end == std::string_view::npos)
+                    {
+                        return pos;
+                    }
+                    block_end = end + 4;
+                }
+                if (end - pos > MAX_HEADER_SIZE)
+                {
+                    throw multipart_error("Multipart part headers too large");
+                }
+                handler_.on_part_begin(parse_headers(data.substr(pos, end - pos)));
+                pos = block_end;
+                state_ = State::BODY;
+                break;
+            }
+            case State::BODY:
+            {
+                const size_t found = data.find(delimiter_, pos);
+                if (found == std::string_view::npos)
+                {
+                    // Hold back what could be the beginning of a delimiter split across two pieces
+                    const size_t safe = data.size() - std::min(data.size(), delimiter_.size() - 1);
+                    if (safe > pos)
+                    {
+                        handler_.on_part_data(data.substr(pos, safe - pos));
+                        pos = safe;
+                    }
+                    return pos;
+                }
+                if (found > pos)
+                {
+                    handler_.on_part_data(data.substr(pos, found - pos));
+                }
+                handler_.on_part_end();
+                pos = found + delimiter_.size();
+                state_ = State::AFTER_DELIMITER;
+                break;
+            }
+            case State::DONE:
+                // Epilogue
+                return data.size();
+            }
+        }
+        return pos;
+    }
+
+    MultipartParser::PartHeaders MultipartParser::parse_headers(std::string_view block) const
+    {
+        PartHeaders headers;
+        bool has_disposition = false;
+        while (!block.empty())
+        {
+            const size_t line_end = block.find("\r\n");
+            const std::string_view line = block.substr(0, line_end);
+            block = line_end == std::string_view::npos ? std::string_view() : block.substr(line_end + 2);
+
+            const size_t colon = line.find(':');
+            if (colon == std::string_view::npos)
+            {
+                throw multipart_error("Malformed multipart part header");
+            }
+            const std::string_view name = trim(line.substr(0, colon));
+            const std::string_view value = trim(line.substr(colon + 1));
+            if (iequals(name, "Content-Disposition"))
+            {
+                has_disposition = true;
+                for (const auto& [key, param] : header_params(value))
+                {
+                    if (iequals(key, "name"))
+                    {
+                        headers.name = unquote(param);
+                    }
+                    else if (iequals(key, "filename"))
+                    {
+                        headers.filename = unquote(param);
+                    }
+                }
+            }
+            else if (iequals(name, "Content-Type"))
+            {
+                headers.content_type = std::string(value);
+            }
+        }
+        if (!has_disposition || headers.name.empty())
+        {
+            throw multipart_error("Multipart part without a field name");
+        }
+        return headers;
+    }
+
+    StreamedForm::StreamedForm(const ImageStore& store, std::string file_field, size_t max_field_size, size_t max_file_size)
+        : store_(store)
+        , file_field_(std::move(file_field))
+        , max_field_size_(max_field_size)
+        , max_file_size_(max_file_size)
+    {
+    }
+
+    const std::string* StreamedForm::field(const std::string& name) const
+    {
+        auto it = fields_.find(name);
+        return it == fields_.end() ? nullptr : &it->second;
+    }
+
+    void StreamedForm::on_part_begin(const MultipartParser::PartHeaders& headers)
+    {
+        if (headers.name == file_field_ && headers.filename.has_value())
+        {
+            if (file_.has_value() || writer_.has_value())
+            {
+                throw multipart_error("Only one file may be uploaded");
+            }
+            if (headers.filename->size() > max_field_size_)
+            {
+                throw multipart_error("Filename too long");
+            }
+            file_name_ = *headers.filename;
+            file_size_ = 0;
+            writer_.emplace(store_.begin());
+            return;
+        }
+        if (headers.filename.has_value())
+        {
+            throw multipart_error("Unexpected file part '" + headers.name + "'");
+        }
+        auto [it, inserted] = fields_.try_emplace(headers.name);
+        if (!inserted)
+        {
+            throw multipart_error("Duplicate field '" + headers.name + "'");
+        }
+        current_field_ = &it->second;
+    }
+
+    void StreamedForm::on_part_data(std::string_view data)
+    {
+        if (writer_.has_value())
+        {
+            file_size_ += data.size();
+            if (file_size_ > max_file_size_)
+            {
+                throw multipart_error("File size too large");
+            }
+            writer_->write(data.data(), data.size());
+            return;
+        }
+        if (current_field_->size() + data.size() > max_field_size_)
+        {
+            throw multipart_error("Field exceeds maximum length of " + std::to_string(max_field_size_));
+        }
+        current_field_->append(data);
+    }
+
+    void StreamedForm::on_part_end()
+    {
+        if (writer_.has_value())
+        {
+            // Browsers send an empty file part when no file was chosen - that's no image, not an empty one
+            if (file_size_ > 0)
+            {
+                file_ = writer_->commit();
+            }
+            else
+            {
+                file_name_.clear();
+            }
+            writer_.reset();
+            return;
+        }
+        current_field_ = nullptr;
+    }
+}
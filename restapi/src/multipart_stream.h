@@ -0,0 +1,127 @@
+#pragma once
+
+#include "image_store.h"
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace mkm
+{
+// Malformed or oversized multipart/form-data body - the client's fault, answer 400
+class multipart_error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/**
+ * @brief Boundary parameter of a multipart/form-data Content-Type header value
+ * @return std::nullopt if the value isn't multipart/form-data or has no usable boundary
+ */
+std::optional<std::string> multipart_boundary(std::string_view content_type);
+
+/**
+ * @brief Incremental multipart/form-data parser.
+ *
+ * The body may be fed in arbitrary pieces; part data is handed to the handler as views into
+ * whatever was fed, so nothing is copied except the few bytes that straddle two pieces (a
+ * possible delimiter, or an incomplete header block).
+ */
+class MultipartParser
+{
+public:
+    struct PartHeaders
+    {
+        std::string name;
+        // Present for file parts, possibly empty when a form is submitted without choosing a file
+        std::optional<std::string> filename;
+        std::string content_type;
+    };
+
+    class Handler
+    {
+    public:
+        virtual ~Handler() = default;
+        virtual void on_part_begin(const PartHeaders& headers) = 0;
+        virtual void on_part_data(std::string_view data) = 0;
+        virtual void on_part_end() = 0;
+    };
+
+    MultipartParser(std::string_view boundary, Handler& handler);
+
+    /**
+     * @throws multipart_error if the body is malformed
+     */
+    void feed(std::string_view data);
+
+    /**
+     * @brief Call once the whole body was fed
+     * @throws multipart_error if the closing delimiter never came
+     */
+    void finish();
+
+private:
+    enum class State
+    {
+        PREAMBLE,
+        AFTER_DELIMITER,
+        HEADERS,
+        BODY,
+        DONE
+    };
+
+    // Returns how many bytes of data were consumed; the rest must be offered again
+    size_t parse(std::string_view data);
+    PartHeaders parse_headers(std::string_view block) const;
+
+    // "\r\n--<boundary>"; the very first delimiter has no leading CRLF
+    const std::string delimiter_;
+    Handler& handler_;
+    State state_ = State::PREAMBLE;
+    std::string pending_;
+};
+
+/**
+ * @brief Collects a submitted form while it is being parsed: text fields are kept in memory up to
+ * a size limit, the one expected file part is streamed straight into the image store.
+ */
+class StreamedForm : public MultipartParser::Handler
+{
+public:
+    StreamedForm(const ImageStore& store, std::string file_field, size_t max_field_size, size_t max_file_size);
+
+    /**
+     * @brief Value of a text field, nullptr if it wasn't submitted
+     */
+    const std::string* field(const std::string& name) const;
+
+    /**
+     * @brief The stored file, std::nullopt if the form came without one
+     */
+    const std::optional<StoredImage>& file() const { return file_; }
+    const std::string& file_name() const { return file_name_; }
+
+    void on_part_begin(const MultipartParser::PartHeaders& headers) override;
+    void on_part_data(std::string_view data) override;
+    void on_part_end() override;
+
+private:
+    const ImageStore& store_;
+    const std::string file_field_;
+    const size_t max_field_size_;
+    const size_t max_file_size_;
+
+    std::unordered_map<std::string, std::string> fields_;
+    std::optional<StoredImage> file_;
+    std::string file_name_;
+
+    // Part currently being received: either a text field or the file
+    std::string* current_field_ = nullptr;
+    std::optional<ImageStore::Writer> writer_;
+    uint64_t file_size_ = 0;
+};
+}   // namespace mkm
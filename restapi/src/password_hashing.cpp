@@ -0,0 +1,139 @@
+#include "password_hashing.h"
+#include "async_log.h"
+#include "config_env.h"
+#include "tracing.h"
+
+#include <crypt.h>
+#include <openssl/crypto.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace mkm
+{
+    namespace
+    {
+        // struct crypt_data is ~32KB - allocate one per thread instead of on the stack
+        crypt_data& thread_crypt_data()
+        {
+            thread_local auto data = std::make_unique<crypt_data>();
+            return *data;
+        }
+
+    }
+
+    bool verify_password(const std::string& password, const std::string& stored_hash)
+    {
+        Span span("auth", "verify_password");
+        crypt_data& data = thread_crypt_data();
+        const char* computed = crypt_rn(password.c_str(), stored_hash.c_str(), &data, sizeof(data));
+        if (computed == nullptr)
+        {
+            MKM_LOG_ERROR(AUTH) << "Stored password hash is not in a supported format";
+            return false;
+        }
+        const size_t computed_size = std::strlen(computed);
+        return computed_size == stored_hash.size()
+            && CRYPTO_memcmp(computed, stored_hash.data(), computed_size) == 0;
+    }
+
+    std::string hash_password(const std::string& password)
+    {
+        Span span("auth", "hash_password");
+        char setting[CRYPT_GENSALT_OUTPUT_SIZE];
+        // A null rbytes makes libxcrypt draw the salt from the OS random source
+        if (crypt_gensalt_rn("$2a$", BCRYPT_COST, nullptr, 0, setting, sizeof(setting)) == nullptr)
+        {
+            throw std::runtime_error("Could not generate bcrypt salt");
+        }
+        crypt_data& data = thread_crypt_data();
+        const char* hash = crypt_rn(password.c_str(), setting, &data, sizeof(data));
+        if (hash == nullptr)
+        {
+            throw std::runtime_error("bcrypt hashing failed");
+        }
+        return hash;
+    }
+
+    HashingPool::Config HashingPool::Config::from_env()
+    {
+        Config config;
+        config.threads = std::max<size_t>(1, env_or("MKM_HASH_THREADS", config.threads));
+        config.max_queue = env_or("MKM_HASH_QUEUE", config.max_queue);
+        return config;
+    }
+
+    HashingPool::HashingPool(Config config)
+        : config_(config)
+    {
+        threads_.reserve(config_.threads);
+        for (size_t i = 0; i < config_.threads; i++)
+        {
+            threads_.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    HashingPool::~HashingPool()
+    {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    bool HashingPool::submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            if (stopping_ || queue_.size() >= config_.max_queue)
+            {
+                return false;
+            }
+            queue_.push_back([job = std::move(job), trace = current_trace()] {
+                TraceScope scope(trace);
+                job();
+            });
+        }
+        wake_.notify_one();
+        return true;
+    }
+
+    void HashingPool::worker_loop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (stopping_ && queue_.empty())
+                {
+                    return;
+                }
+                job = std::move(queue_.front());
+                queue_.pop_front();
+            }
+            try
+            {
+                job();
+            }
+            catch (const std::exception& e)
+            {
+                MKM_LOG_ERROR(AUTH) << "Password hashing job failed: " << e.what();
+            }
+        }
+    }
+
+    HashingPool& hashing_pool()
+    {
+        static HashingPool pool(HashingPool::Config::from_env());
+        return pool;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mkm
+{
+// Same cost factor pgcrypto used with gen_salt('bf', 8), so old and new hashes take equally long
+constexpr unsigned long BCRYPT_COST = 8;
+
+/**
+ * @brief Check a password against a stored bcrypt hash, including the $2a$ hashes written by
+ * pgcrypto's crypt(). CPU heavy - call it from the hashing pool.
+ */
+bool verify_password(const std::string& password, const std::string& stored_hash);
+
+/**
+ * @brief Hash a password with bcrypt and a fresh random salt, in pgcrypto-compatible $2a$ form
+ * @throws std::runtime_error if hashing fails
+ */
+std::string hash_password(const std::string& password);
+
+/**
+ * @brief Small, fixed pool of threads reserved for password hashing, so that a burst of logins can
+ * neither hog the Crow I/O threads nor queue up without bound
+ */
+class HashingPool
+{
+public:
+    struct Config
+    {
+        size_t threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+        // Jobs allowed to wait for a free thread; beyond that submit() refuses work
+        size_t max_queue = 64;
+
+        /**
+         * @brief Read MKM_HASH_THREADS and MKM_HASH_QUEUE, keeping the defaults above otherwise
+         */
+        static Config from_env();
+    };
+
+    explicit HashingPool(Config config);
+    HashingPool(const HashingPool&) = delete;
+    HashingPool& operator=(const HashingPool&) = delete;
+    ~HashingPool();
+
+    /**
+     * @brief Queue a job without blocking
+     * @return false if the queue is full - the caller should shed the request (503)
+     */
+    bool submit(std::function<void()> job);
+
+private:
+    void worker_loop();
+
+    const Config config_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::function<void()>> queue_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+HashingPool& hashing_pool();
+}   // namespace mkm
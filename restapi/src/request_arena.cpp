@@ -0,0 +1,107 @@
+#include "request_arena.h"
+#include "config_env.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace mkm
+{
+    namespace
+    {
+        std::atomic<uint64_t> arenas_opened{0};
+        std::atomic<uint64_t> overflow_bytes{0};
+
+        // Heap allocations of arenas that outgrew their block, counted for /metrics
+        class OverflowResource : public std::pmr::memory_resource
+        {
+        private:
+            void* do_allocate(size_t bytes, size_t alignment) override
+            {
+                overflow_bytes.fetch_add(bytes, std::memory_order_relaxed);
+                return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            }
+
+            void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+            {
+                std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+            }
+
+            bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+            {
+                return this == &other;
+            }
+        };
+
+        OverflowResource overflow_resource;
+
+        // Blocks of closed arenas, reused by the next arena of the same thread without touching malloc
+        struct BlockPool
+        {
+            std::vector<std::unique_ptr<std::byte[]>> blocks;
+
+            std::unique_ptr<std::byte[]> take(size_t size)
+            {
+                if (blocks.empty())
+                {
+                    return std::make_unique<std::byte[]>(size);
+                }
+                auto block = std::move(blocks.back());
+                blocks.pop_back();
+                return block;
+            }
+
+            void give_back(std::unique_ptr<std::byte[]> block, size_t limit)
+            {
+                if (blocks.size() < limit)
+                {
+                    blocks.push_back(std::move(block));
+                }
+            }
+        };
+
+        thread_local BlockPool block_pool;
+        thread_local RequestArena* current_arena = nullptr;
+    }
+
+    RequestArenaConfig RequestArenaConfig::from_env()
+    {
+        RequestArenaConfig config;
+        config.block_bytes = std::max<size_t>(env_or("MKM_ARENA_BLOCK_BYTES", config.block_bytes), 1024);
+        config.pooled_blocks = env_or("MKM_ARENA_POOLED_BLOCKS", config.pooled_blocks);
+        return config;
+    }
+
+    const RequestArenaConfig& request_arena_config()
+    {
+        static const RequestArenaConfig config = RequestArenaConfig::from_env();
+        return config;
+    }
+
+    RequestArena::RequestArena()
+        : block_(block_pool.take(request_arena_config().block_bytes))
+        , resource_(block_.get(), request_arena_config().block_bytes, &overflow_resource)
+        , previous_(current_arena)
+    {
+        current_arena = this;
+        arenas_opened.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    RequestArena::~RequestArena()
+    {
+        current_arena = previous_;
+        resource_.release();
+        block_pool.give_back(std::move(block_), request_arena_config().pooled_blocks);
+    }
+
+    RequestArenaStats RequestArena::stats()
+    {
+        return {arenas_opened.load(std::memory_order_relaxed), overflow_bytes.load(std::memory_order_relaxed)};
+    }
+
+    std::pmr::memory_resource* request_memory() noexcept
+    {
+        return current_arena != nullptr ? current_arena->resource() : std::pmr::get_default_resource();
+    }
+}
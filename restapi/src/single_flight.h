@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mkm
+{
+/**
+ * @brief Add one part to the key of a coalesced call. Parts are length-prefixed, so no two
+ * different lists of parts make the same key, whatever characters they contain.
+ */
+inline void append_flight_key(std::string& key, std::string_view part)
+{
+    key += std::to_string(part.size());
+    key += ':';
+    key += part;
+}
+
+inline std::string flight_key(std::initializer_list<std::string_view> parts)
+{
+    std::string key;
+    for (const auto& part : parts)
+    {
+        append_flight_key(key, part);
+    }
+    return key;
+}
+
+// How many calls ran and how many shared the result of one already running
+struct FlightStats
+{
+    uint64_t leaders;
+    uint64_t followers;
+};
+
+/**
+ * @brief Coalesces identical concurrent blocking calls: the first caller of a key runs the work,
+ * callers arriving while it runs wait for and share its result - or its exception.
+ *
+ * Once the work finishes the key is free again, so a call never gets a result that was complete
+ * before it started. Keys should carry whatever cache generation the result depends on, so that a
+ * call starting after a write doesn't join a flight that started before it.
+ */
+template<typename Result>
+class SingleFlight
+{
+public:
+    template<typename Work>
+    Result run(const std::string& key, Work&& work)
+    {
+        std::unique_lock lock(mutex_);
+        if (auto it = flights_.find(key); it != flights_.end())
+        {
+            std::shared_future<Result> flight = it->second;
+            lock.unlock();
+            followers_.fetch_add(1, std::memory_order_relaxed);
+            return flight.get();
+        }
+        std::promise<Result> promise;
+        flights_.emplace(key, promise.get_future().share());
+        lock.unlock();
+        leaders_.fetch_add(1, std::memory_order_relaxed);
+
+        try
+        {
+            Result result = work();
+            land(key);
+            promise.set_value(result);
+            return result;
+        }
+        catch (...)
+        {
+            land(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    FlightStats stats() const
+    {
+        return {leaders_.load(std::memory_order_relaxed), followers_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    void land(const std::string& key)
+    {
+        std::lock_guard lock(mutex_);
+        flights_.erase(key);
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<Result>> flights_;
+    std::atomic<uint64_t> leaders_{0};
+    std::atomic<uint64_t> followers_{0};
+};
+
+/**
+ * @brief Same for calls that complete through a callback, such as AsyncDb queries. Callers may
+ * be on different threads: each passes a deliver function that runs the completion where the
+ * caller wants it, typically by posting to its own event loop.
+ */
+template<typename Result>
+class AsyncSingleFlight
+{
+public:
+    using Callback = std::function<void(const Result&)>;
+    using Deliver = std::function<void(std::function<void()>)>;
+    // Completion handed to the work; must be called exactly once, on any thread
+    using Done = std::function<void(Result)>;
+
+    /**
+     * @param on_exception result every waiter gets if starting the work throws
+     */
+    explicit AsyncSingleFlight(Result on_exception)
+        : on_exception_(std::move(on_exception))
+    {
+    }
+
+    template<typename Start>
+    void run(const std::string& key, Deliver deliver, Callback callback, Start&& start)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            auto [it, inserted] = flights_.try_emplace(key);
+            it->second.push_back({std::move(deliver), std::move(callback)});
+            if (!inserted)
+            {
+                followers_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        leaders_.fetch_add(1, std::memory_order_relaxed);
+
+        // Work that completes and then throws must not land a later flight of the same key
+        auto landed = std::make_shared<std::atomic<bool>>(false);
+        Done done = [this, key, landed](Result result) {
+            if (!landed->exchange(true))
+            {
+                land(key, result);
+            }
+        };
+        try
+        {
+            start(std::move(done));
+        }
+        catch (...)
+        {
+            if (!landed->exchange(true))
+            {
+                land(key, on_exception_);
+            }
+        }
+    }
+
+    FlightStats stats() const
+    {
+        return {leaders_.load(std::memory_order_relaxed), followers_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    struct Waiter
+    {
+        Deliver deliver;
+        Callback callback;
+    };
+
+    void land(const std::string& key, const Result& result)
+    {
+        std::vector<Waiter> waiters;
+        {
+            std::lock_guard lock(mutex_);
+            auto it = flights_.find(key);
+            if (it == flights_.end())
+            {
+                return;
+            }
+            waiters = std::move(it->second);
+            flights_.erase(it);
+        }
+        for (auto& waiter : waiters)
+        {
+            waiter.deliver([callback = std::move(waiter.callback), result] { callback(result); });
+        }
+    }
+
+    const Result on_exception_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::vector<Waiter>> flights_;
+    std::atomic<uint64_t> leaders_{0};
+    std::atomic<uint64_t> followers_{0};
+};
+}   // namespace mkm
@@ -0,0 +1,87 @@
+#include "token_cache.h"
+#include "config_env.h"
+
+#include <openssl/evp.h>
+
+#include <stdexcept>
+
+namespace mkm
+{
+    namespace
+    {
+        // token68 characters as accepted by the Authorization header parser so far
+        constexpr bool is_token_char(char c)
+        {
+            return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+                || c == '_' || c == '-' || c == '.' || c == '~' || c == '+';
+        }
+    }
+
+    std::string_view extract_bearer_token(std::string_view authorization_value)
+    {
+        constexpr std::string_view scheme = "Bearer";
+        if (authorization_value.substr(0, scheme.size()) != scheme)
+        {
+            return {};
+        }
+
+        size_t pos = scheme.size();
+        const size_t token_start = authorization_value.find_first_not_of(' ', pos);
+        if (token_start == pos || token_start == std::string_view::npos)
+        {
+            return {};
+        }
+
+        pos = token_start;
+        while (pos < authorization_value.size() && is_token_char(authorization_value[pos]))
+        {
+            pos++;
+        }
+        if (pos == token_start)
+        {
+            return {};
+        }
+        while (pos < authorization_value.size() && authorization_value[pos] == '=')
+        {
+            pos++;
+        }
+        if (pos != authorization_value.size())
+        {
+            return {};
+        }
+        return authorization_value.substr(token_start);
+    }
+
+    TokenCache::TokenCache(size_t capacity)
+        : cache_(capacity)
+    {
+    }
+
+    TokenCache::Digest TokenCache::digest(std::string_view token)
+    {
+        Digest digest{};
+        unsigned int digest_size = 0;
+        if (EVP_Digest(token.data(), token.size(), digest.data(), &digest_size, EVP_sha256(), nullptr) != 1
+            || digest_size != digest.size())
+        {
+            throw std::runtime_error("SHA-256 of token failed");
+        }
+        return digest;
+    }
+
+    std::optional<std::string> TokenCache::lookup(const Digest& digest)
+    {
+        return cache_.get(digest);
+    }
+
+    void TokenCache::remember(const Digest& digest, std::string username, std::chrono::system_clock::time_point expires_at)
+    {
+        cache_.put(digest, std::move(username), expires_at);
+    }
+
+    TokenCache& token_cache()
+    {
+        static TokenCache cache(env_or("MKM_TOKEN_CACHE_SIZE", size_t{10000}));
+        return cache;
+    }
+}
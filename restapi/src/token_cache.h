@@ -0,0 +1,58 @@
+#pragma once
+
+#include "lru_cache.h"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace mkm
+{
+/**
+ * @brief Extract the credentials of a "Bearer <token>" Authorization header value without allocating
+ * @return a view into authorization_value, empty if it isn't a well-formed bearer credential
+ */
+std::string_view extract_bearer_token(std::string_view authorization_value);
+
+/**
+ * @brief Remembers the username of JWTs whose signature and claims were already verified, so that
+ * repeat requests skip decoding and the HMAC. Entries are keyed by the SHA-256 of the token and
+ * disappear when the token expires.
+ */
+class TokenCache
+{
+public:
+    using Digest = std::array<unsigned char, 32>;
+
+    explicit TokenCache(size_t capacity);
+
+    static Digest digest(std::string_view token);
+
+    std::optional<std::string> lookup(const Digest& digest);
+
+    void remember(const Digest& digest, std::string username, std::chrono::system_clock::time_point expires_at);
+
+private:
+    struct DigestHash
+    {
+        size_t operator()(const Digest& digest) const noexcept
+        {
+            // The digest is already uniformly distributed - any 8 bytes of it make a good hash
+            size_t hash;
+            std::memcpy(&hash, digest.data(), sizeof(hash));
+            return hash;
+        }
+    };
+
+    ShardedLruCache<Digest, std::string, DigestHash> cache_;
+};
+
+/**
+ * @brief Process-wide cache holding up to MKM_TOKEN_CACHE_SIZE (default 10000) tokens
+ */
+TokenCache& token_cache();
+}   // namespace mkm
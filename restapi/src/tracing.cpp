@@ -0,0 +1,276 @@
+#include "tracing.h"
+#include "async_log.h"
+#include "config_env.h"
+#include "json_writer.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+namespace mkm
+{
+    namespace
+    {
+        // Scaled to 2^32 so that sampling compares integers
+        uint64_t sample_threshold(double rate)
+        {
+            if (!(rate > 0))
+            {
+                return 0;
+            }
+            return static_cast<uint64_t>(std::ldexp(std::min(rate, 1.0), 32));
+        }
+
+        int64_t microseconds(Tracer::Clock::time_point time)
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+        }
+    }
+
+    Tracer::Config Tracer::Config::from_env()
+    {
+        Config config;
+        config.enabled = env_or("MKM_TRACE", size_t{0}) != 0;
+        config.sample_rate = env_or("MKM_TRACE_SAMPLE", config.sample_rate);
+        config.path = env_or("MKM_TRACE_FILE", config.path);
+        config.max_file_bytes = std::max<size_t>(4096, env_or("MKM_TRACE_FILE_BYTES", config.max_file_bytes));
+        return config;
+    }
+
+    /**
+     * Events of one thread: only that thread pushes and only the writer thread drains, so the ring
+     * needs no lock, just the two ordered indices.
+     */
+    class Tracer::Ring
+    {
+    public:
+        struct Event
+        {
+            uint64_t trace;
+            const char* category;
+            int64_t start_us;
+            int64_t duration_us;
+            // Route names are cut short rather than allocated for
+            uint8_t name_size;
+            char name[63];
+        };
+
+        explicit Ring(uint32_t tid)
+            : tid_(tid)
+        {
+        }
+
+        uint32_t tid() const { return tid_; }
+
+        size_t capacity() const { return events_.size(); }
+
+        /**
+         * @return Events waiting to be written, this one included - 0 if the ring was full
+         */
+        size_t push(const Event& event)
+        {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            const size_t size = head - tail_.load(std::memory_order_acquire);
+            if (size >= events_.size())
+            {
+                return 0;
+            }
+            events_[head % events_.size()] = event;
+            head_.store(head + 1, std::memory_order_release);
+            return size + 1;
+        }
+
+        template<typename Visit>
+        void drain(Visit&& visit)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            const size_t head = head_.load(std::memory_order_acquire);
+            for (; tail != head; tail++)
+            {
+                visit(events_[tail % events_.size()]);
+            }
+            tail_.store(tail, std::memory_order_release);
+        }
+
+    private:
+        const uint32_t tid_;
+        std::array<Event, 2048> events_;
+        std::atomic<size_t> head_{0};
+        std::atomic<size_t> tail_{0};
+    };
+
+    Tracer::Tracer(Config config)
+        : config_(std::move(config))
+        , threshold_(sample_threshold(config_.sample_rate))
+        , enabled_(config_.enabled)
+    {
+    }
+
+    Tracer::~Tracer()
+    {
+        {
+            std::lock_guard lock(writer_mutex_);
+            stopping_ = true;
+        }
+        writer_wake_.notify_all();
+        if (writer_.joinable())
+        {
+            writer_.join();
+        }
+    }
+
+    uint64_t Tracer::sample() noexcept
+    {
+        if (!enabled() || threshold_ == 0)
+        {
+            return 0;
+        }
+        // xorshift64, seeded per thread
+        thread_local uint64_t state = std::hash<std::thread::id>{}(std::this_thread::get_id())
+            ^ static_cast<uint64_t>(Clock::now().time_since_epoch().count()) ^ 0x9e3779b97f4a7c15ULL;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if ((state >> 32) >= threshold_)
+        {
+            return 0;
+        }
+        return next_trace_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Tracer::record(uint64_t trace, const char* category, std::string_view name, Clock::time_point start, Clock::time_point end) noexcept
+    {
+        Ring::Event event;
+        event.trace = trace;
+        event.category = category;
+        event.start_us = microseconds(start);
+        event.duration_us = std::max<int64_t>(0, microseconds(end) - event.start_us);
+        event.name_size = static_cast<uint8_t>(std::min(name.size(), sizeof(event.name)));
+        std::memcpy(event.name, name.data(), event.name_size);
+        try
+        {
+            Ring& ring = thread_ring();
+            const size_t size = ring.push(event);
+            if (size == ring.capacity() / 2)
+            {
+                // Busy thread - don't wait for the next periodic drain
+                drain_requested_.store(true, std::memory_order_relaxed);
+                writer_wake_.notify_one();
+            }
+            if (size != 0)
+            {
+                return;
+            }
+        }
+        catch (const std::exception&)
+        {
+            // Could not set up the thread's ring - count the event as dropped
+        }
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Tracer::Ring& Tracer::thread_ring()
+    {
+        thread_local Ring* ring = nullptr;
+        if (ring == nullptr)
+        {
+            std::call_once(writer_started_, [this] { writer_ = std::thread([this] { writer_loop(); }); });
+            std::lock_guard lock(rings_mutex_);
+            rings_.push_back(std::make_unique<Ring>(static_cast<uint32_t>(rings_.size() + 1)));
+            ring = rings_.back().get();
+        }
+        return *ring;
+    }
+
+    void Tracer::writer_loop()
+    {
+        std::unique_lock lock(writer_mutex_);
+        while (!stopping_)
+        {
+            writer_wake_.wait_for(lock, std::chrono::milliseconds(500), [this] {
+                return stopping_ || drain_requested_.load(std::memory_order_relaxed);
+            });
+            drain_requested_.store(false, std::memory_order_relaxed);
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }
+
+    void Tracer::drain()
+    {
+        std::vector<Ring*> rings;
+        {
+            std::lock_guard lock(rings_mutex_);
+            for (const auto& ring : rings_)
+            {
+                rings.push_back(ring.get());
+            }
+        }
+
+        const std::string pid = std::to_string(getpid());
+        std::string events;
+        for (Ring* ring : rings)
+        {
+            const std::string tid = std::to_string(ring->tid());
+            ring->drain([&](const Ring::Event& event) {
+                events += "{\"name\":";
+                append_json_string(events, std::string_view(event.name, event.name_size));
+                events += ",\"cat\":\"";
+                events += event.category;
+                events += "\",\"ph\":\"X\",\"ts\":";
+                events += std::to_string(event.start_us);
+                events += ",\"dur\":";
+                events += std::to_string(event.duration_us);
+                events += ",\"pid\":" + pid + ",\"tid\":" + tid + ",\"args\":{\"trace\":";
+                events += std::to_string(event.trace);
+                events += "}},\n";
+            });
+        }
+        if (!events.empty())
+        {
+            write(events);
+        }
+    }
+
+    void Tracer::write(const std::string& events)
+    {
+        if (!file_.is_open())
+        {
+            file_.open(config_.path, std::ios::out | std::ios::trunc);
+            if (!file_)
+            {
+                MKM_LOG_WARNING(CORE) << "Could not open trace file " << config_.path << ", discarding trace events";
+                file_.close();
+                return;
+            }
+            // Trace viewers accept the array without its closing bracket, so it can stay open
+            file_ << "[\n";
+            file_bytes_ = 2;
+        }
+        file_ << events;
+        file_.flush();
+        file_bytes_ += events.size();
+
+        if (file_bytes_ >= config_.max_file_bytes)
+        {
+            file_.close();
+            const std::string previous = config_.path + ".1";
+            if (std::rename(config_.path.c_str(), previous.c_str()) != 0)
+            {
+                MKM_LOG_WARNING(CORE) << "Could not rotate trace file " << config_.path;
+            }
+        }
+    }
+
+    Tracer& tracer()
+    {
+        static Tracer instance(Tracer::Config::from_env());
+        return instance;
+    }
+}
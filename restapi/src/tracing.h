@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace mkm
+{
+namespace detail
+{
+// Trace of the request the calling thread is working for, 0 when it isn't sampled
+inline thread_local uint64_t current_trace = 0;
+}   // namespace detail
+
+inline uint64_t current_trace() noexcept
+{
+    return detail::current_trace;
+}
+
+/**
+ * @brief Starts or ends the trace of the request the calling thread works for
+ */
+inline void set_current_trace(uint64_t trace) noexcept
+{
+    detail::current_trace = trace;
+}
+
+/**
+ * @brief Makes spans on this thread belong to trace for the lifetime of the scope. Work handed to
+ * another thread captures current_trace() and opens a scope where it runs.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(uint64_t trace) noexcept
+        : previous_(detail::current_trace)
+    {
+        detail::current_trace = trace;
+    }
+
+    ~TraceScope() { detail::current_trace = previous_; }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const uint64_t previous_;
+};
+
+/**
+ * @brief Head-sampled request tracing, written as Chrome trace events (chrome://tracing, Perfetto).
+ *
+ * Whether a request is traced is decided once when it is routed. Spans of requests that aren't
+ * sampled cost a thread-local load; with tracing off, a request costs one more relaxed load.
+ * Events go to a fixed-size ring of the recording thread, without locks, and a background thread
+ * appends them to a file that is rotated once it reaches its size limit. Events that find their
+ * ring full are dropped and counted.
+ */
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config
+    {
+        // Share of requests traced while tracing is on
+        double sample_rate = 0.01;
+        bool enabled = false;
+        std::string path = "momentos-trace.json";
+        // The current file is renamed to <path>.1 once it grows beyond this
+        size_t max_file_bytes = 64 * 1024 * 1024;
+
+        /**
+         * @brief MKM_TRACE (1 to start with tracing on), MKM_TRACE_SAMPLE, MKM_TRACE_FILE,
+         * MKM_TRACE_FILE_BYTES
+         */
+        static Config from_env();
+    };
+
+    explicit Tracer(Config config);
+    ~Tracer();
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    /**
+     * @brief Head sampling decision for a new request
+     * @return Id of the new trace, 0 if the request isn't traced
+     */
+    uint64_t sample() noexcept;
+
+    // Runtime switch; only touches an atomic, so it may be called from a signal handler
+    void set_enabled(bool enabled) noexcept { enabled_.store(enabled, std::memory_order_relaxed); }
+    void toggle() noexcept { set_enabled(!enabled()); }
+    bool enabled() const noexcept { return enabled_.load(std::memory_order_relaxed); }
+
+    void record(uint64_t trace, const char* category, std::string_view name, Clock::time_point start, Clock::time_point end) noexcept;
+
+    uint64_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    class Ring;
+
+    Ring& thread_ring();
+    void writer_loop();
+    void drain();
+    void write(const std::string& events);
+
+    const Config config_;
+    const uint64_t threshold_;
+    std::atomic<bool> enabled_;
+    std::atomic<uint64_t> next_trace_{1};
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+
+    std::once_flag writer_started_;
+    std::mutex writer_mutex_;
+    std::condition_variable writer_wake_;
+    std::atomic<bool> drain_requested_{false};
+    bool stopping_ = false;
+    std::thread writer_;
+    std::ofstream file_;
+    size_t file_bytes_ = 0;
+};
+
+Tracer& tracer();
+
+/**
+ * @brief Times the enclosing scope as one event of the current trace
+ * @param name must outlive the span, typically a literal
+ */
+class Span
+{
+public:
+    Span(const char* category, const char* name) noexcept
+        : trace_(current_trace()), category_(category), name_(name)
+    {
+        if (trace_ != 0)
+        {
+            start_ = Tracer::Clock::now();
+        }
+    }
+
+    ~Span()
+    {
+        if (trace_ != 0)
+        {
+            tracer().record(trace_, category_, name_, start_, Tracer::Clock::now());
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const uint64_t trace_;
+    const char* const category_;
+    const char* const name_;
+    Tracer::Clock::time_point start_;
+};
+}   // namespace mkm
@@ -0,0 +1,61 @@
+#include "validator_cache.h"
+#include "config_env.h"
+
+namespace mkm
+{
+    ValidatorCache::ValidatorCache(size_t capacity, std::chrono::seconds time_to_live)
+        : lists_(capacity)
+        , moments_(capacity)
+        , time_to_live_(time_to_live)
+    {
+    }
+
+    std::optional<Validator> ValidatorCache::get_list(const std::string& username)
+    {
+        return lists_.get(username);
+    }
+
+    std::optional<Validator> ValidatorCache::get_moment(const std::string& username, uint64_t id)
+    {
+        return moments_.get(moment_key(username, id));
+    }
+
+    uint64_t ValidatorCache::generation(const std::string& username) const
+    {
+        return generations_.generation(username);
+    }
+
+    void ValidatorCache::put_list(const std::string& username, Validator validator, uint64_t generation)
+    {
+        generations_.put(lists_, username, generation, username, std::move(validator),
+                         std::chrono::system_clock::now() + time_to_live_);
+    }
+
+    void ValidatorCache::put_moment(const std::string& username, uint64_t id, Validator validator, uint64_t generation)
+    {
+        generations_.put(moments_, username, generation, moment_key(username, id), std::move(validator),
+                         std::chrono::system_clock::now() + time_to_live_);
+    }
+
+    void ValidatorCache::invalidate(const std::string& username, std::optional<uint64_t> id)
+    {
+        generations_.invalidate(username);
+        lists_.erase(username);
+        if (id.has_value())
+        {
+            moments_.erase(moment_key(username, *id));
+        }
+    }
+
+    std::string ValidatorCache::moment_key(const std::string& username, uint64_t id)
+    {
+        return std::to_string(id) + ':' + username;
+    }
+
+    ValidatorCache& validator_cache()
+    {
+        static ValidatorCache cache(env_or("MKM_VALIDATOR_CACHE_SIZE", size_t{10000}),
+                                    std::chrono::seconds(env_or("MKM_VALIDATOR_CACHE_TTL_S", size_t{60})));
+        return cache;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "generation_guard.h"
+#include "lru_cache.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace mkm
+{
+/**
+ * @brief What a conditional GET is checked against: a strong entity tag and the modification time
+ * behind Last-Modified
+ */
+struct Validator
+{
+    // Quoted, ready for the ETag header
+    std::string etag;
+    // Microseconds since the epoch
+    int64_t modified_us;
+};
+
+/**
+ * @brief Validators of moment details and of each user's moment listings, so that a client
+ * re-opening something unchanged is answered with 304 without a query.
+ *
+ * Works like MomentCountCache: write paths call invalidate() after committing, readers take a
+ * generation() before querying and put() drops validators read across a write. Only the validator
+ * has to be current - a response body read after it may be newer, which merely costs the client
+ * one more full response later.
+ */
+class ValidatorCache
+{
+public:
+    ValidatorCache(size_t capacity, std::chrono::seconds time_to_live);
+
+    std::optional<Validator> get_list(const std::string& username);
+    std::optional<Validator> get_moment(const std::string& username, uint64_t id);
+
+    uint64_t generation(const std::string& username) const;
+
+    void put_list(const std::string& username, Validator validator, uint64_t generation);
+    void put_moment(const std::string& username, uint64_t id, Validator validator, uint64_t generation);
+
+    /**
+     * @brief Forget the user's listing validator and, if given, the one of the changed moment
+     */
+    void invalidate(const std::string& username, std::optional<uint64_t> id = std::nullopt);
+
+private:
+    static std::string moment_key(const std::string& username, uint64_t id);
+
+    ShardedLruCache<std::string, Validator> lists_;
+    // Keyed by "<id>:<username>" - the id can't contain the separator, so keys never collide
+    ShardedLruCache<std::string, Validator> moments_;
+    const std::chrono::seconds time_to_live_;
+    GenerationGuard<std::string> generations_;
+};
+
+/**
+ * @brief Process-wide cache for MKM_VALIDATOR_CACHE_SIZE (default 10000) users and as many moments,
+ * entries live for MKM_VALIDATOR_CACHE_TTL_S (default 60) seconds
+ */
+ValidatorCache& validator_cache();
+}   // namespace mkm